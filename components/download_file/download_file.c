@@ -17,6 +17,9 @@
 #include "esp_crt_bundle.h"
 #include "download_file.h"
 
+/* How often the write task checks whether the download ended while it waits for data */
+#define RECEIVE_POLL_MS 100
+
 static const char *TAG = "file_downloader";
 
 static esp_err_t download_file_event_handler(esp_http_client_event_t *evt);
@@ -29,6 +32,9 @@ typedef struct {
     SemaphoreHandle_t start;
     SemaphoreHandle_t done;
     bool skip_file_buffer;
+    bool started;
+    volatile bool finished;     // the HTTP request is over, no more data comes
+    volatile bool aborted;      // the request failed, the rest of the body is dropped
     size_t bytes_downloaded;
     size_t bytes_written;
     size_t last_download_percent;
@@ -36,10 +42,41 @@ typedef struct {
     int64_t download_waiting_for_ringbuf_us;
     int64_t write_waiting_for_sdcard_us;
     void (*progress_cb)(void *user_data, size_t bytes_done, size_t bytes_total); /*!< Callback to call on progress */
+    esp_err_t (*data_cb)(void *user_data, const void *data, size_t len);
+    esp_err_t write_result;     // first error of data_cb or of writing the file
+    void (*header_cb)(void *user_data, const char *key, const char *value);
     void *user_data;
 } download_args_t;
 
 
+static esp_http_client_handle_t create_client(const char *url, const download_file_config_t *config, void *args)
+{
+    esp_http_client_config_t http_client_config = {
+        .url = url,
+        .event_handler = &download_file_event_handler,
+        .user_data = args,
+#if CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+        .crt_bundle_attach = &esp_crt_bundle_attach,
+#endif
+        .buffer_size = config->buffer_size,
+        .timeout_ms = config->timeout_ms,
+    };
+
+    if (config->http_client_config_cb != NULL &&
+            config->http_client_config_cb(config->user_data, &http_client_config) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed in config callback");
+        return NULL;
+    }
+    return esp_http_client_init(&http_client_config);
+}
+
+esp_err_t download_file_client_create(const char *url, const download_file_config_t *config, esp_http_client_handle_t *out_client)
+{
+    *out_client = create_client(url, config, NULL);
+    ESP_RETURN_ON_FALSE(*out_client != NULL, ESP_FAIL, TAG, "Failed to initialise HTTP client");
+    return ESP_OK;
+}
+
 esp_err_t download_file(const char *url, FILE *f_out, const download_file_config_t *config)
 {
     esp_err_t ret = ESP_OK;
@@ -55,32 +92,25 @@ esp_err_t download_file(const char *url, FILE *f_out, const download_file_config
         .done = xSemaphoreCreateBinary(),
         .skip_file_buffer = config->skip_file_buffer,
         .progress_cb = config->progress_cb,
+        .data_cb = config->data_cb,
+        .header_cb = config->header_cb,
         .user_data = config->user_data,
     };
 
-    esp_http_client_config_t http_client_config = {
-        .url = url,
-        .event_handler = &download_file_event_handler,
-        .user_data = &args,
-#if CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
-        .crt_bundle_attach = &esp_crt_bundle_attach,
-#endif
-        .buffer_size = config->buffer_size,
-        .timeout_ms = config->timeout_ms,
-    };
-
-    if (config->http_client_config_cb != NULL) {
-        ESP_GOTO_ON_ERROR(config->http_client_config_cb(config->user_data, &http_client_config), out, TAG, "Failed in config callback");
+    if (config->client != NULL) {
+        client = config->client;
+        ESP_GOTO_ON_ERROR(esp_http_client_set_url(client, url), out, TAG, "Failed to set URL");
+        ESP_GOTO_ON_ERROR(esp_http_client_set_user_data(client, &args), out, TAG, "Failed to set user data");
+    } else {
+        client = create_client(url, config, &args);
+        ESP_GOTO_ON_FALSE(client != NULL, ESP_ERR_NO_MEM, out, TAG, "Failed to initialise HTTP client");
     }
 
-    client = esp_http_client_init(&http_client_config);
-    ESP_GOTO_ON_FALSE(client != NULL, ESP_ERR_NO_MEM, out, TAG, "Failed to initialise HTTP client");
-
     if (config->http_client_post_init_cb != NULL) {
         ESP_GOTO_ON_ERROR(config->http_client_post_init_cb(config->user_data, client), out, TAG, "Failed in post init callback");
     }
 
-    int res = xTaskCreatePinnedToCore(&file_write_task, "download_file_task", 4096, &args, 5, &task_handle, 1);
+    int res = xTaskCreatePinnedToCore(&file_write_task, "download_file_task", config->download_task_stack, &args, config->download_task_priority, &task_handle, 1);
     ESP_GOTO_ON_FALSE(res == pdPASS, ESP_ERR_NO_MEM, out, TAG, "Failed to create file write task");
 
     int64_t start = esp_timer_get_time();
@@ -88,27 +118,74 @@ esp_err_t download_file(const char *url, FILE *f_out, const download_file_config
     int64_t end = esp_timer_get_time();
 
     int http_status = esp_http_client_get_status_code(client);
-    bool http_status_ok = http_status >= 200 && http_status < 300;
+    bool http_status_ok = (http_status >= 200 && http_status < 300) || http_status == HttpStatus_NotModified;
+    if (config->http_status != NULL) {
+        *config->http_status = http_status;
+    }
+    // The task may still be passing on the body; args, the ringbuffer and whatever data_cb
+    // writes into must outlive it
+    args.aborted = ret != ESP_OK || !http_status_ok;
+    args.finished = true;
+    if (!args.started) {
+        // No body to write (e.g. 304 Not Modified, or the request failed)
+        xSemaphoreGive(args.start);
+    }
+    xSemaphoreTake(args.done, portMAX_DELAY);
 
     if (!http_status_ok) {
         ESP_LOGE(TAG, "HTTP result: %s, HTTP Status = %d", esp_err_to_name(ret), http_status);
         ret = ESP_FAIL;
     }
-    if (ret == ESP_OK) {
+    if (ret == ESP_OK && args.started) {
         ESP_LOGI(TAG, "Size: %u Time taken: %d ms Speed: %.2f kB/sec", args.content_length, (int) (end - start) / 1000, (args.content_length / 1024.0f) / ((end - start) / 1000000.0f));
         ESP_LOGI(TAG, "Download task spent %d ms blocked on writing to ringbuffer", (int) args.download_waiting_for_ringbuf_us / 1000);
         ESP_LOGI(TAG, "File write task spent %d ms blocked on writing to SD card", (int) args.write_waiting_for_sdcard_us / 1000);
-        xSemaphoreTake(args.done, portMAX_DELAY);
+        if (args.write_result != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write the data: %s", esp_err_to_name(args.write_result));
+            ret = args.write_result;
+        } else if (args.bytes_written < args.content_length) {
+            ESP_LOGE(TAG, "Response ended after %d of %d bytes", args.bytes_written, args.content_length);
+            ret = ESP_ERR_INVALID_SIZE;
+        }
     }
 out:
-    if (client != NULL) {
+    if (client != NULL && client != config->client) {
         esp_http_client_cleanup(client);
     }
     vRingbufferDelete(args.rb);
+    vSemaphoreDelete(args.start);
     vSemaphoreDelete(args.done);
     return ret;
 }
 
+esp_err_t download_file_post(esp_http_client_handle_t client, const char *url, const char *content_type,
+                             const char *data, size_t len, int *out_http_status)
+{
+    esp_err_t ret = ESP_OK;
+    ESP_RETURN_ON_ERROR(esp_http_client_set_url(client, url), TAG, "Failed to set URL");
+    // No download arguments: the event handler ignores the response
+    ESP_RETURN_ON_ERROR(esp_http_client_set_user_data(client, NULL), TAG, "Failed to set user data");
+    ESP_GOTO_ON_ERROR(esp_http_client_set_method(client, HTTP_METHOD_POST), out, TAG, "Failed to set method");
+    ESP_GOTO_ON_ERROR(esp_http_client_set_header(client, "Content-Type", content_type), out, TAG, "Failed to set header");
+    ESP_GOTO_ON_ERROR(esp_http_client_set_post_field(client, data, len), out, TAG, "Failed to set body");
+
+    ret = esp_http_client_perform(client);
+    int http_status = esp_http_client_get_status_code(client);
+    if (out_http_status != NULL) {
+        *out_http_status = http_status;
+    }
+    if (ret == ESP_OK && (http_status < 200 || http_status >= 300)) {
+        ESP_LOGE(TAG, "POST: HTTP Status = %d", http_status);
+        ret = ESP_FAIL;
+    }
+
+out:
+    // Back to the defaults of a download
+    esp_http_client_set_post_field(client, NULL, 0);
+    esp_http_client_delete_header(client, "Content-Type");
+    esp_http_client_set_method(client, HTTP_METHOD_GET);
+    return ret;
+}
 
 static void file_write_task(void *arg)
 {
@@ -116,41 +193,51 @@ static void file_write_task(void *arg)
     args->bytes_written = 0;
     xSemaphoreTake(args->start, portMAX_DELAY);
     if (args->content_length == 0) {
-        ESP_LOGE(TAG, "Content length is 0");
+        ESP_LOGD(TAG, "Nothing to write");
+        xSemaphoreGive(args->done);
         vTaskDelete(NULL);
         return;
     }
 
-    while (args->bytes_written < args->content_length) {
-        size_t remaining = 0;
-        vRingbufferGetInfo(args->rb, NULL, NULL, NULL, NULL, &remaining);
-
-        size_t to_write = args->buffer_size;
-        if (args->bytes_written + remaining == args->content_length) {
-            to_write = remaining;
-        }
-        ESP_LOGD(TAG, "to_write: %d, remaining: %d", to_write, remaining);
-        uint8_t *rb_buf = xRingbufferReceive(args->rb, &to_write, pdMS_TO_TICKS(10000));
+    size_t received = 0;
+    while (received < args->content_length) {
+        // Read before waiting: if it was set already, an empty ringbuffer stays empty
+        bool finished = args->finished;
+        size_t size = 0;
+        uint8_t *rb_buf = xRingbufferReceive(args->rb, &size, pdMS_TO_TICKS(RECEIVE_POLL_MS));
         if (rb_buf == NULL) {
-            ESP_LOGE(TAG, "Failed to read from ringbuffer");
+            if (finished) {
+                // The request is over and the ringbuffer is empty: the body was cut short
+                break;
+            }
+            continue;
+        }
+        received += size;
+        if (args->aborted || args->write_result != ESP_OK) {
+            // Keep draining the ringbuffer so that the HTTP client isn't blocked
+            vRingbufferReturnItem(args->rb, rb_buf);
             continue;
         }
         int64_t start = esp_timer_get_time();
 
         ssize_t written_bytes;
-        if (args->skip_file_buffer) {
-            written_bytes = write(fileno(args->f_out), rb_buf, to_write);
+        if (args->data_cb != NULL) {
+            args->write_result = args->data_cb(args->user_data, rb_buf, size);
+            written_bytes = size;
+        } else if (args->skip_file_buffer) {
+            written_bytes = write(fileno(args->f_out), rb_buf, size);
         } else {
-            written_bytes = fwrite(rb_buf, 1, to_write, args->f_out);
+            written_bytes = fwrite(rb_buf, 1, size, args->f_out);
         }
         int64_t end = esp_timer_get_time();
-        if (written_bytes != to_write) {
+        vRingbufferReturnItem(args->rb, rb_buf);
+        if (written_bytes != size) {
             ESP_LOGE(TAG, "Failed to write to file");
-            break;
+            args->write_result = ESP_FAIL;
+            continue;
         }
         args->write_waiting_for_sdcard_us += end - start;
         args->bytes_written += written_bytes;
-        vRingbufferReturnItem(args->rb, rb_buf);
 
         ESP_LOGD(TAG, "Downloaded %d, written %d", args->bytes_downloaded, args->bytes_written);
         size_t download_percent = (args->bytes_downloaded * 100) / args->content_length;
@@ -172,6 +259,10 @@ static void file_write_task(void *arg)
 static esp_err_t download_file_event_handler(esp_http_client_event_t *evt)
 {
     download_args_t *args = (download_args_t *) evt->user_data;
+    if (args == NULL) {
+        // A request made by download_file_post
+        return ESP_OK;
+    }
     switch (evt->event_id) {
     case HTTP_EVENT_ERROR:
         ESP_LOGE(TAG, "HTTP_EVENT_ERROR");
@@ -183,10 +274,14 @@ static esp_err_t download_file_event_handler(esp_http_client_event_t *evt)
         ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
         break;
     case HTTP_EVENT_ON_HEADER:
+        if (args->header_cb != NULL) {
+            args->header_cb(args->user_data, evt->header_key, evt->header_value);
+        }
         if (strcmp(evt->header_key, "Content-Length") == 0) {
             args->content_length = atoi(evt->header_value);
             ESP_LOGI(TAG, "Content-length: %d", args->content_length);
             // start the file write task
+            args->started = true;
             xSemaphoreGive(args->start);
         }
         break;
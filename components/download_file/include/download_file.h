@@ -25,6 +25,10 @@ typedef struct {
     esp_err_t (*http_client_config_cb)(void *user_data, esp_http_client_config_t *http_client_config);    /*!< Callback to call to configure http client */
     esp_err_t (*http_client_post_init_cb)(void *user_data, esp_http_client_handle_t http_client); /*!< Callback to call after http client is initialized */
     void (*progress_cb)(void *user_data, size_t bytes_done, size_t bytes_total); /*!< Callback to call on progress */
+    esp_err_t (*data_cb)(void *user_data, const void *data, size_t len); /*!< If set, called with the downloaded data instead of writing it to the file. Runs in the download task. */
+    void (*header_cb)(void *user_data, const char *key, const char *value); /*!< If set, called for each response header, before any data is passed on */
+    esp_http_client_handle_t client; /*!< If set, this client (from download_file_client_create) is used and left open */
+    int *http_status;       /*!< If set, receives the HTTP status of the response */
 } download_file_config_t;
 
 #define DOWNLOAD_FILE_CONFIG_DEFAULT() { \
@@ -36,10 +40,61 @@ typedef struct {
     .http_client_config_cb = NULL, \
     .http_client_post_init_cb = NULL, \
     .progress_cb = NULL, \
+    .data_cb = NULL, \
+    .header_cb = NULL, \
+    .client = NULL, \
+    .http_status = NULL, \
 }
 
+/**
+ * @brief Download a file over HTTP(S)
+ *
+ * Data is received in the calling task and handed over through a ringbuffer to a download task
+ * pinned to the other core, which writes it to f_out, or passes it to config->data_cb if set.
+ *
+ * A 304 (Not Modified) response, to a request with a validator set in
+ * config->http_client_post_init_cb, is not an error; no data is written then.
+ *
+ * @param url  URL to download
+ * @param f_out  File to write the data to; may be NULL if config->data_cb is set
+ * @param config  Download configuration
+ * The download task has finished when this returns, whatever the result, so config->data_cb
+ * isn't called any more and what it writes into can be freed.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the response ended before Content-Length
+ *         bytes, or the first error returned by the HTTP client or config->data_cb
+ */
 esp_err_t download_file(const char *url, FILE *f_out, const download_file_config_t *config);
 
+/**
+ * @brief Create an HTTP client for several downloads
+ *
+ * Pass it to download_file in config->client. Downloads from the same server then share
+ * one connection, as long as the server keeps it open. Free it with esp_http_client_cleanup.
+ *
+ * @param url  URL of the first download
+ * @param config  Download configuration; http_client_config_cb is applied
+ * @param[out] out_client  The client
+ */
+esp_err_t download_file_client_create(const char *url, const download_file_config_t *config, esp_http_client_handle_t *out_client);
+
+/**
+ * @brief Send data in a POST request over a client from download_file_client_create
+ *
+ * Meant for small uploads between downloads, sharing their connection. The response
+ * body is discarded. The client is left ready for further downloads.
+ *
+ * @param client  The client
+ * @param url  URL to post to
+ * @param content_type  Value of the Content-Type header
+ * @param data  Request body
+ * @param len  Its length
+ * @param[out] out_http_status  HTTP status of the response (optional)
+ * @return ESP_OK if the server answered with a 2xx status, ESP_FAIL for other statuses,
+ *         or the error of the HTTP client
+ */
+esp_err_t download_file_post(esp_http_client_handle_t client, const char *url, const char *content_type,
+                             const char *data, size_t len, int *out_http_status);
 
 #ifdef __cplusplus
 }
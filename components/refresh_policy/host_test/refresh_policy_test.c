@@ -0,0 +1,104 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * SPDX-FileCopyrightText: 2023 Ivan Grokhotkov <ivan@igrr.me>
+ */
+
+/*
+ * Decisions of refresh_policy_choose and classifications of refresh_policy_classify on
+ * the host, against the expected ones. Exits with a failure if any of them is wrong.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "refresh_policy.h"
+
+#define PIXELS (960 * 540)
+
+typedef struct {
+    const char *name;
+    refresh_policy_config_t config;
+    refresh_policy_input_t input;
+    refresh_mode_t mode;
+    refresh_waveform_t waveform;    // not checked for REFRESH_SKIP
+} decision_case_t;
+
+/* 5 fast updates between full refreshes, and a full one from 50% changed */
+#define CONFIG { .max_fast_updates = 5, .full_changed_percent = 50 }
+#define KNOWN .panel_known = true, .total_pixels = PIXELS
+static const decision_case_t s_decision_cases[] = {
+    { "panel unknown", CONFIG, { .total_pixels = PIXELS, .content = REFRESH_CONTENT_FEW_LEVELS },
+      REFRESH_FULL, REFRESH_WAVEFORM_GL16 },
+    { "nothing changed", CONFIG, { KNOWN, .fast_updates = 5, .content = REFRESH_CONTENT_CONTINUOUS },
+      REFRESH_SKIP, REFRESH_WAVEFORM_DU },
+    { "fast updates used up", CONFIG, { KNOWN, .changed_pixels = 1000, .changed_to_gray = 10, .fast_updates = 5, .content = REFRESH_CONTENT_FEW_LEVELS },
+      REFRESH_FULL, REFRESH_WAVEFORM_GL16 },
+    { "last fast update", CONFIG, { KNOWN, .changed_pixels = 1000, .changed_to_gray = 10, .fast_updates = 4, .content = REFRESH_CONTENT_FEW_LEVELS },
+      REFRESH_PARTIAL, REFRESH_WAVEFORM_GL16 },
+    { "no fast updates", { .max_fast_updates = 0, .full_changed_percent = 100 }, { KNOWN, .changed_pixels = 1, .content = REFRESH_CONTENT_BILEVEL },
+      REFRESH_FULL, REFRESH_WAVEFORM_DU },
+    { "half changed", CONFIG, { KNOWN, .changed_pixels = PIXELS / 2, .changed_to_gray = 10, .content = REFRESH_CONTENT_CONTINUOUS },
+      REFRESH_FULL, REFRESH_WAVEFORM_GC16 },
+    { "just under half changed", CONFIG, { KNOWN, .changed_pixels = PIXELS / 2 - 1, .changed_to_gray = 10, .content = REFRESH_CONTENT_CONTINUOUS },
+      REFRESH_PARTIAL, REFRESH_WAVEFORM_GC16 },
+    { "bilevel", CONFIG, { KNOWN, .changed_pixels = 1000, .content = REFRESH_CONTENT_BILEVEL },
+      REFRESH_PARTIAL, REFRESH_WAVEFORM_DU },
+    { "few levels", CONFIG, { KNOWN, .changed_pixels = 1000, .changed_to_gray = 1, .content = REFRESH_CONTENT_FEW_LEVELS },
+      REFRESH_PARTIAL, REFRESH_WAVEFORM_GL16 },
+    { "continuous", CONFIG, { KNOWN, .changed_pixels = 1000, .changed_to_gray = 1, .content = REFRESH_CONTENT_CONTINUOUS },
+      REFRESH_PARTIAL, REFRESH_WAVEFORM_GC16 },
+    { "continuous, changed to black and white", CONFIG, { KNOWN, .changed_pixels = 1000, .content = REFRESH_CONTENT_CONTINUOUS },
+      REFRESH_PARTIAL, REFRESH_WAVEFORM_DU },
+    { "full, bilevel", CONFIG, { .total_pixels = PIXELS, .content = REFRESH_CONTENT_BILEVEL },
+      REFRESH_FULL, REFRESH_WAVEFORM_DU },
+    { "full, continuous", CONFIG, { .total_pixels = PIXELS, .content = REFRESH_CONTENT_CONTINUOUS },
+      REFRESH_FULL, REFRESH_WAVEFORM_GC16 },
+};
+
+/* A frame of the given levels, in equal shares, with level changes between the given share of neighbours */
+static refresh_content_t classify_levels(const int *levels, int count, int transitions_percent)
+{
+    uint32_t histogram[16] = { 0 };
+    for (int i = 0; i < count; i++) {
+        histogram[levels[i]] += PIXELS / count;
+    }
+    return refresh_policy_classify(histogram, (uint64_t) PIXELS * transitions_percent / 100);
+}
+
+int main(void)
+{
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(s_decision_cases) / sizeof(s_decision_cases[0]); i++) {
+        const decision_case_t *c = &s_decision_cases[i];
+        refresh_decision_t d = refresh_policy_choose(&c->config, &c->input);
+        if (d.mode != c->mode || (d.mode != REFRESH_SKIP && d.waveform != c->waveform)) {
+            printf("%s: %s %s instead of %s %s\n", c->name,
+                   refresh_mode_name(d.mode), refresh_waveform_name(d.waveform),
+                   refresh_mode_name(c->mode), refresh_waveform_name(c->waveform));
+            failures++;
+        }
+    }
+
+    static const int bilevel[] = { 0, 15 };
+    static const int text[] = { 0, 5, 10, 15 };
+    static const int photo[] = { 0, 2, 4, 6, 8, 10, 12, 15 };
+    const struct {
+        const char *name;
+        refresh_content_t content;
+        refresh_content_t expected;
+    } contents[] = {
+        { "black and white", classify_levels(bilevel, 2, 30), REFRESH_CONTENT_BILEVEL },
+        { "antialiased text", classify_levels(text, 4, 30), REFRESH_CONTENT_FEW_LEVELS },
+        { "photo", classify_levels(photo, 8, 30), REFRESH_CONTENT_CONTINUOUS },
+        { "flat gray fills", classify_levels(photo, 8, 1), REFRESH_CONTENT_FEW_LEVELS },
+    };
+    for (size_t i = 0; i < sizeof(contents) / sizeof(contents[0]); i++) {
+        if (contents[i].content != contents[i].expected) {
+            printf("%s classified as %s instead of %s\n", contents[i].name,
+                   refresh_content_name(contents[i].content), refresh_content_name(contents[i].expected));
+            failures++;
+        }
+    }
+    printf("Refresh policy decisions: %d wrong\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
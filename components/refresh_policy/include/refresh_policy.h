@@ -0,0 +1,92 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * SPDX-FileCopyrightText: 2023 Ivan Grokhotkov <ivan@igrr.me>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief How to bring the panel to the new frame
+ */
+typedef enum {
+    REFRESH_SKIP,       /*!< Nothing changed, leave the panel off */
+    REFRESH_PARTIAL,    /*!< Update the changed areas only, without clearing the panel */
+    REFRESH_FULL,       /*!< Clear the panel, then draw the whole frame. Removes ghosting. */
+} refresh_mode_t;
+
+/**
+ * @brief Waveform to draw with, from the fastest to the slowest
+ */
+typedef enum {
+    REFRESH_WAVEFORM_DU,    /*!< Black and white only */
+    REFRESH_WAVEFORM_GL16,  /*!< Grayscale, doesn't flash pixels which stay white */
+    REFRESH_WAVEFORM_GC16,  /*!< Grayscale, flashes every updated pixel; best for continuous tones */
+} refresh_waveform_t;
+
+/**
+ * @brief Tonal character of the whole new frame
+ */
+typedef enum {
+    REFRESH_CONTENT_BILEVEL,    /*!< Only black and white */
+    REFRESH_CONTENT_FEW_LEVELS, /*!< A few gray levels, e.g. antialiased text and flat fills */
+    REFRESH_CONTENT_CONTINUOUS, /*!< Photographs, gradients with detail */
+} refresh_content_t;
+
+/**
+ * @brief Thresholds of the policy
+ */
+typedef struct {
+    uint32_t max_fast_updates;      /*!< Updates allowed between full refreshes; 0 makes every update a full one */
+    uint32_t full_changed_percent;  /*!< Share of changed pixels from which a full refresh is done anyway */
+} refresh_policy_config_t;
+
+/**
+ * @brief What is known about the update
+ */
+typedef struct {
+    bool panel_known;           /*!< The previous frame is known, so changed_* are meaningful */
+    uint32_t total_pixels;
+    uint32_t changed_pixels;
+    uint32_t changed_to_gray;   /*!< Changed pixels whose new level is neither black nor white */
+    uint32_t fast_updates;      /*!< Partial updates since the last full refresh */
+    refresh_content_t content;  /*!< See refresh_policy_classify */
+} refresh_policy_input_t;
+
+typedef struct {
+    refresh_mode_t mode;
+    refresh_waveform_t waveform;
+} refresh_decision_t;
+
+/**
+ * @brief Classify a frame by its level histogram and its horizontal level transitions
+ *
+ * Levels covering at least 1% of the pixels count as used. With more than 4 of them
+ * and level changes between at least 10% of neighbouring pixels, the frame is taken
+ * as continuous tone.
+ */
+refresh_content_t refresh_policy_classify(const uint32_t histogram[16], uint32_t transitions);
+
+/**
+ * @brief Choose the refresh mode and waveform
+ *
+ * Ghosting builds up with each partial update. The caller counts them (in memory which
+ * survives deep sleep) and resets the count after a full refresh; once it reaches
+ * max_fast_updates a full refresh is forced. The waveform is the cheapest one which
+ * renders the new pixels correctly.
+ */
+refresh_decision_t refresh_policy_choose(const refresh_policy_config_t *config, const refresh_policy_input_t *input);
+
+const char *refresh_mode_name(refresh_mode_t mode);
+const char *refresh_waveform_name(refresh_waveform_t waveform);
+const char *refresh_content_name(refresh_content_t content);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,119 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * SPDX-FileCopyrightText: 2023 Ivan Grokhotkov <ivan@igrr.me>
+ */
+
+#include <stdint.h>
+#include "refresh_policy.h"
+
+#define USED_LEVEL_PERCENT 1
+#define MAX_FEW_LEVELS 4
+#define CONTINUOUS_TRANSITION_PERCENT 10
+
+refresh_content_t refresh_policy_classify(const uint32_t histogram[16], uint32_t transitions)
+{
+    uint64_t pixels = 0;
+    uint32_t grays = 0;
+    for (int i = 0; i < 16; i++) {
+        pixels += histogram[i];
+        if (i != 0 && i != 15) {
+            grays += histogram[i];
+        }
+    }
+    if (grays == 0) {
+        return REFRESH_CONTENT_BILEVEL;
+    }
+    int used = 0;
+    for (int i = 0; i < 16; i++) {
+        used += (uint64_t) histogram[i] * 100 >= pixels * USED_LEVEL_PERCENT;
+    }
+    if (used > MAX_FEW_LEVELS && (uint64_t) transitions * 100 >= pixels * CONTINUOUS_TRANSITION_PERCENT) {
+        return REFRESH_CONTENT_CONTINUOUS;
+    }
+    return REFRESH_CONTENT_FEW_LEVELS;
+}
+
+static refresh_waveform_t waveform_for(refresh_content_t content)
+{
+    switch (content) {
+    case REFRESH_CONTENT_BILEVEL:
+        return REFRESH_WAVEFORM_DU;
+    case REFRESH_CONTENT_FEW_LEVELS:
+        return REFRESH_WAVEFORM_GL16;
+    default:
+        return REFRESH_WAVEFORM_GC16;
+    }
+}
+
+refresh_decision_t refresh_policy_choose(const refresh_policy_config_t *config, const refresh_policy_input_t *input)
+{
+    refresh_decision_t full = {
+        .mode = REFRESH_FULL,
+        .waveform = waveform_for(input->content),
+    };
+    if (!input->panel_known) {
+        return full;
+    }
+    if (input->changed_pixels == 0) {
+        return (refresh_decision_t) {
+            .mode = REFRESH_SKIP
+        };
+    }
+    if (input->fast_updates >= config->max_fast_updates) {
+        return full;
+    }
+    if ((uint64_t) input->changed_pixels * 100 >= (uint64_t) config->full_changed_percent * input->total_pixels) {
+        return full;
+    }
+    refresh_decision_t partial = {
+        .mode = REFRESH_PARTIAL,
+        .waveform = waveform_for(input->content),
+    };
+    // DU can only drive pixels to black or white, but that's enough if no changed pixel ends up gray
+    if (input->changed_to_gray == 0) {
+        partial.waveform = REFRESH_WAVEFORM_DU;
+    }
+    return partial;
+}
+
+const char *refresh_mode_name(refresh_mode_t mode)
+{
+    switch (mode) {
+    case REFRESH_SKIP:
+        return "skip";
+    case REFRESH_PARTIAL:
+        return "partial";
+    case REFRESH_FULL:
+        return "full";
+    default:
+        return "?";
+    }
+}
+
+const char *refresh_waveform_name(refresh_waveform_t waveform)
+{
+    switch (waveform) {
+    case REFRESH_WAVEFORM_DU:
+        return "DU";
+    case REFRESH_WAVEFORM_GL16:
+        return "GL16";
+    case REFRESH_WAVEFORM_GC16:
+        return "GC16";
+    default:
+        return "?";
+    }
+}
+
+const char *refresh_content_name(refresh_content_t content)
+{
+    switch (content) {
+    case REFRESH_CONTENT_BILEVEL:
+        return "bilevel";
+    case REFRESH_CONTENT_FEW_LEVELS:
+        return "few levels";
+    case REFRESH_CONTENT_CONTINUOUS:
+        return "continuous";
+    default:
+        return "?";
+    }
+}
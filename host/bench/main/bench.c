@@ -0,0 +1,922 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * SPDX-FileCopyrightText: 2023 Ivan Grokhotkov <ivan@igrr.me>
+ */
+
+/*
+ * Benchmarks of the image code on the host, with the panel simulated by epd_sim:
+ * - the row pipeline (scaling and tone mapping into the framebuffer), timed on the host CPU;
+ * - refresh strategies over a day of dashboard updates, with the panel-on time and the
+ *   energy estimated by the epd_sim cost model;
+ * - a text dashboard sent as a display list, against the same frame sent as a raster image;
+ * - patches against the frame on the panel: applied, and rejected when malformed or against another frame;
+ * - log capture: recording the arguments of a message, against formatting it;
+ * - text drawing: the glyph cache, writing glyphs into the framebuffer as spans against pixel
+ *   by pixel, and the flash size and drawing speed of the glyph encodings.
+ * Images of the results are written to the current directory as PGM files.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <sys/param.h>
+#include <zlib.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "epd_driver.h"
+#include "epd_highlevel.h"
+#include "epd_sim.h"
+#include "row_pipeline.h"
+#include "delta_decoder.h"
+#include "panel_refresh.h"
+#include "refresh_policy.h"
+#include "dlist.h"
+#include "fonts.h"
+#include "log_ring.h"
+#include "text.h"
+/* FiraSans_20 in each glyph encoding, generated by font_encoding_headers */
+#include "firasans_20_zlib.h"
+#include "firasans_20_rle.h"
+#include "firasans_20_raw.h"
+
+#define PIPELINE_RUNS 5         // the best run is reported
+#define UPDATES 48              // a day of updates every 30 minutes
+#define DLIST_RUNS 20           // the best run is reported
+#define LOG_RUNS 2000           // passes over the messages of a wake-up
+#define TEXT_RUNS 5             // the best run is reported
+#define PATCH_CHUNK 1000        // bytes per write, as they come from the network
+
+static const char *TAG = "bench";
+
+typedef struct {
+    const char *name;
+    int src_width;
+    int src_height;
+    row_pipeline_scale_t scale;
+} pipeline_case_t;
+
+static const pipeline_case_t s_pipeline_cases[] = {
+    { "960x540 1:1", 960, 540, ROW_PIPELINE_SCALE_FIT },
+    { "1920x1080 fit", 1920, 1080, ROW_PIPELINE_SCALE_FIT },
+    { "1280x1024 fill", 1280, 1024, ROW_PIPELINE_SCALE_FILL },
+    { "800x480 fit", 800, 480, ROW_PIPELINE_SCALE_FIT },
+    { "800x600 none", 800, 600, ROW_PIPELINE_SCALE_NONE },
+};
+
+typedef struct {
+    const char *name;
+    refresh_policy_config_t config;
+    bool content_aware;         // otherwise every refresh uses GC16
+} policy_case_t;
+
+static const policy_case_t s_policy_cases[] = {
+    { "full only", { .max_fast_updates = 0, .full_changed_percent = 100 }, false },
+    { "partial, GC16", { .max_fast_updates = 20, .full_changed_percent = 50 }, false },
+    { "partial", { .max_fast_updates = 20, .full_changed_percent = 50 }, true },
+    { "partial, full every 5", { .max_fast_updates = 5, .full_changed_percent = 50 }, true },
+};
+
+static const int s_temperatures[] = { 22, 5 };
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Deterministic noise, so that runs are comparable */
+static uint32_t hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+/* Photo-like test image: smooth gradients, an edge and some noise */
+static void make_image(uint8_t *image, int width, int height, uint32_t seed)
+{
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int value = x * 200 / width + y * 55 / height;
+            if ((x - width / 2) * (x - width / 2) + (y - height / 2) * (y - height / 2) < height * height / 16) {
+                value = 255 - value;
+            }
+            value += (int) (hash(seed + y * width + x) % 17) - 8;
+            image[y * width + x] = value < 0 ? 0 : value > 255 ? 255 : value;
+        }
+    }
+}
+
+static void bench_pipeline(uint8_t *fb)
+{
+    ESP_LOGI(TAG, "Row pipeline (host CPU time)");
+    for (int i = 0; i < sizeof(s_pipeline_cases) / sizeof(s_pipeline_cases[0]); i++) {
+        const pipeline_case_t *c = &s_pipeline_cases[i];
+        uint8_t *image = malloc(c->src_width * c->src_height);
+        assert(image != NULL);
+        make_image(image, c->src_width, c->src_height, i);
+
+        row_pipeline_config_t config = {
+            .src_width = c->src_width,
+            .src_height = c->src_height,
+            .dst = epd_full_screen(),
+            .scale = c->scale,
+            .fb = fb,
+        };
+        int64_t best_us = INT64_MAX;
+        row_pipeline_stats_t stats = { 0 };
+        for (int run = 0; run < PIPELINE_RUNS; run++) {
+            row_pipeline_t *pipeline;
+            ESP_ERROR_CHECK(row_pipeline_create(&config, &pipeline));
+            int64_t start = now_us();
+            for (int y = 0; y < c->src_height; y++) {
+                row_pipeline_push(pipeline, &image[y * c->src_width]);
+            }
+            int64_t elapsed = now_us() - start;
+            best_us = elapsed < best_us ? elapsed : best_us;
+            row_pipeline_get_stats(pipeline, &stats);
+            row_pipeline_delete(pipeline);
+        }
+        ESP_LOGI(TAG, "  %-16s %7.2f ms  %5.2f ns/source px  %s", c->name, best_us / 1000.0,
+                 best_us * 1000.0 / (c->src_width * c->src_height),
+                 refresh_content_name(refresh_policy_classify(stats.histogram, stats.transitions)));
+        free(image);
+
+        char path[32];
+        snprintf(path, sizeof(path), "pipeline_%d.pgm", i);
+        epd_sim_write_pgm(path, fb);
+    }
+}
+
+/* One update of a dashboard: a clock, an hourly bar chart, and a photo which changes every 6 hours */
+static void draw_dashboard(uint8_t *fb, int update)
+{
+    memset(fb, 0xFF, FB_SIZE);
+    int x = 40;
+    int y = 70;
+    epd_write_default(&FiraSans_20, "Living room", &x, &y, fb);
+    char text[16];
+    snprintf(text, sizeof(text), "%02d:%02d", update / 2, update % 2 * 30);
+    x = 780;
+    y = 70;
+    epd_write_default(&FiraSans_20, text, &x, &y, fb);
+
+    int hours = update / 2 + 1;
+    for (int i = 0; i < hours; i++) {
+        int height = 40 + hash(i) % 160;
+        epd_fill_rect((EpdRect) {
+            .x = 40 + i * 18, .y = 500 - height, .width = 12, .height = height
+        }, 0x00, fb);
+    }
+
+    int photo = update / 12;
+    for (int py = 0; py < 140; py++) {
+        for (int px = 0; px < 240; px++) {
+            int value = (px * 12 / 240 + py * 4 / 140 + photo * 5 + (int) (hash(photo * 100000 + py * 240 + px) % 3)) % 16;
+            epd_draw_pixel(680 + px, 120 + py, value << 4, fb);
+        }
+    }
+}
+
+static refresh_content_t classify(const uint8_t *fb)
+{
+    uint32_t histogram[16] = { 0 };
+    uint32_t transitions = 0;
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        const uint8_t *line = &fb[y * FB_STRIDE];
+        int prev = line[0] & 0x0F;
+        for (int x = 0; x < EPD_WIDTH; x++) {
+            int level = x % 2 ? line[x / 2] >> 4 : line[x / 2] & 0x0F;
+            histogram[level]++;
+            transitions += level != prev;
+            prev = level;
+        }
+    }
+    return refresh_policy_classify(histogram, transitions);
+}
+
+typedef struct {
+    bool panel_known;
+    uint32_t fast_updates;
+    int full;
+    int partial;
+    int skipped;
+} refresh_state_t;
+
+/* As refresh_panel() in display.c does it */
+static void refresh(EpdiyHighlevelState *hl, const policy_case_t *c, int temperature, refresh_state_t *state)
+{
+    refresh_content_t content = c->content_aware ? classify(hl->front_fb) : REFRESH_CONTENT_CONTINUOUS;
+    panel_refresh_plan_t plan;
+    panel_refresh_plan(&c->config, hl->front_fb, state->panel_known ? hl->back_fb : NULL, state->fast_updates,
+                       content, &plan);
+    if (plan.decision.mode == REFRESH_SKIP) {
+        state->skipped++;
+        return;
+    }
+    panel_refresh_run(hl, &plan, temperature, false);
+    if (plan.decision.mode == REFRESH_FULL) {
+        state->panel_known = true;
+        state->fast_updates = 0;
+        state->full++;
+    } else {
+        state->fast_updates++;
+        state->partial++;
+    }
+}
+
+/* Returns the number of runs after which the panel didn't show the last frame */
+static int bench_policies(EpdiyHighlevelState *hl)
+{
+    int failures = 0;
+    ESP_LOGI(TAG, "Refresh policies, %d updates (simulated panel)", UPDATES);
+    ESP_LOGI(TAG, "  %-24s %5s %5s %5s %5s %10s %10s", "policy", "temp", "full", "part", "skip", "panel on", "energy");
+    for (int t = 0; t < sizeof(s_temperatures) / sizeof(s_temperatures[0]); t++) {
+        for (int i = 0; i < sizeof(s_policy_cases) / sizeof(s_policy_cases[0]); i++) {
+            const policy_case_t *c = &s_policy_cases[i];
+            int temperature = s_temperatures[t];
+            refresh_state_t state = { 0 };
+            epd_sim_reset_stats();
+            for (int update = 0; update < UPDATES; update++) {
+                draw_dashboard(hl->front_fb, update);
+                refresh(hl, c, temperature, &state);
+            }
+            epd_sim_stats_t stats;
+            epd_sim_get_stats(&stats);
+            ESP_LOGI(TAG, "  %-24s %4dC %5d %5d %5d %8.1f s %8.2f J", c->name, temperature,
+                     state.full, state.partial, state.skipped,
+                     stats.panel_on_us / 1e6, stats.energy_uj / 1e6);
+            if (memcmp(epd_sim_panel(), hl->front_fb, FB_SIZE) != 0) {
+                ESP_LOGE(TAG, "  %s: the panel doesn't show the last frame", c->name);
+                failures++;
+            }
+            char path[32];
+            snprintf(path, sizeof(path), "policy_%d_%dC.pgm", i, temperature);
+            epd_sim_write_pgm(path, epd_sim_panel());
+        }
+    }
+    return failures;
+}
+
+/* Builds a display list, see dlist.h */
+typedef struct {
+    uint8_t data[2048];
+    size_t len;
+} dlist_buf_t;
+
+static void put_u8(dlist_buf_t *b, uint8_t v)
+{
+    assert(b->len < sizeof(b->data));
+    b->data[b->len++] = v;
+}
+
+static void put_u16(dlist_buf_t *b, int v)
+{
+    put_u8(b, v & 0xFF);
+    put_u8(b, (v >> 8) & 0xFF);
+}
+
+static void put_fill(dlist_buf_t *b, int x, int y, int width, int height, int level)
+{
+    put_u8(b, 0x02);
+    put_u16(b, x);
+    put_u16(b, y);
+    put_u16(b, width);
+    put_u16(b, height);
+    put_u8(b, level);
+}
+
+static void put_text(dlist_buf_t *b, int x, int y, int font, int align, const char *text)
+{
+    put_u8(b, 0x04);
+    put_u16(b, x);
+    put_u16(b, y);
+    put_u8(b, font);
+    put_u8(b, 0);
+    put_u8(b, align);
+    put_u8(b, strlen(text));
+    for (const char *c = text; *c; c++) {
+        put_u8(b, *c);
+    }
+}
+
+/* A text dashboard: title, clock, a table of readings and an hourly bar chart */
+static void make_dlist(dlist_buf_t *b)
+{
+    static const char *rows[][2] = {
+        { "Temperature", "21.4 C" }, { "Humidity", "43 %" }, { "CO2", "612 ppm" },
+        { "Outside", "7.9 C" }, { "Wind", "4 m/s NW" },
+    };
+    memcpy(b->data, DLIST_MAGIC "\x01\x0f\0\0", 8);
+    b->len = 8;
+    put_text(b, 40, 70, 1, 0, "Living room");
+    put_text(b, 920, 70, 1, 2, "12:30");
+    put_u8(b, 0x03);
+    put_u16(b, 40);
+    put_u16(b, 90);
+    put_u16(b, 920);
+    put_u16(b, 90);
+    put_u8(b, 0);
+    for (int i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        put_text(b, 40, 150 + i * 40, 0, 0, rows[i][0]);
+        put_text(b, 420, 150 + i * 40, 0, 2, rows[i][1]);
+    }
+    for (int i = 0; i < 24; i++) {
+        int height = 40 + hash(i) % 160;
+        put_fill(b, 500 + i * 18, 500 - height, 12, height, i % 6 == 0 ? 0 : 8);
+    }
+}
+
+/* What a PNG decoder does with the same frame: inflate 8-bit rows and pack them */
+static int64_t decode_raster(const uint8_t *png_data, size_t png_len, uint8_t *raster, uint8_t *fb)
+{
+    int64_t start = now_us();
+    uLongf raster_len = (EPD_WIDTH + 1) * EPD_HEIGHT;
+    int ret = uncompress(raster, &raster_len, png_data, png_len);
+    assert(ret == Z_OK);
+    row_pipeline_config_t config = {
+        .src_width = EPD_WIDTH,
+        .src_height = EPD_HEIGHT,
+        .dst = epd_full_screen(),
+        .scale = ROW_PIPELINE_SCALE_NONE,
+        .fb = fb,
+    };
+    row_pipeline_t *pipeline;
+    ESP_ERROR_CHECK(row_pipeline_create(&config, &pipeline));
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        row_pipeline_push(pipeline, &raster[y * (EPD_WIDTH + 1) + 1]);
+    }
+    row_pipeline_delete(pipeline);
+    return now_us() - start;
+}
+
+static void bench_dlist(uint8_t *fb)
+{
+    static const EpdFont *const fonts[] = { &FiraSans_12, &FiraSans_20 };
+    dlist_buf_t dl;
+    make_dlist(&dl);
+    dlist_config_t config = {
+        .area = epd_full_screen(),
+        .fb = fb,
+        .fonts = fonts,
+        .font_count = 2,
+    };
+    int64_t dlist_us = INT64_MAX;
+    for (int run = 0; run < DLIST_RUNS; run++) {
+        int64_t start = now_us();
+        ESP_ERROR_CHECK(dlist_render(dl.data, dl.len, &config, NULL));
+        dlist_us = MIN(dlist_us, now_us() - start);
+    }
+    epd_sim_write_pgm("dlist.pgm", fb);
+
+    // The same frame as an 8-bit gray PNG would carry it: rows with a filter byte, deflated
+    size_t raster_len = (EPD_WIDTH + 1) * EPD_HEIGHT;
+    uint8_t *raster = calloc(1, raster_len);
+    uLongf png_len = compressBound(raster_len);
+    uint8_t *png_data = malloc(png_len);
+    uint8_t *decoded = malloc(FB_SIZE);
+    assert(raster != NULL && png_data != NULL && decoded != NULL);
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        for (int x = 0; x < EPD_WIDTH; x++) {
+            uint8_t b = fb[y * FB_STRIDE + x / 2];
+            raster[y * (EPD_WIDTH + 1) + 1 + x] = (x % 2 ? b >> 4 : b & 0x0F) * 17;
+        }
+    }
+    int ret = compress2(png_data, &png_len, raster, raster_len, Z_BEST_COMPRESSION);
+    assert(ret == Z_OK);
+    int64_t raster_us = INT64_MAX;
+    for (int run = 0; run < DLIST_RUNS; run++) {
+        raster_us = MIN(raster_us, decode_raster(png_data, png_len, raster, decoded));
+    }
+
+    ESP_LOGI(TAG, "Text dashboard (host CPU time)");
+    ESP_LOGI(TAG, "  display list %7u bytes %7.2f ms", (unsigned) dl.len, dlist_us / 1000.0);
+    ESP_LOGI(TAG, "  raster       %7u bytes %7.2f ms  (deflated 8-bit rows, as in a PNG)", (unsigned) png_len, raster_us / 1000.0);
+
+    // Right-aligned text ending at the right edge of the area
+    dlist_buf_t edge;
+    memcpy(edge.data, DLIST_MAGIC "\x01\xff\0\0", 8);
+    edge.len = 8;
+    put_text(&edge, 200, 60, 0, 2, "21.4 C");
+    config.area = (EpdRect) { .x = 700, .y = 400, .width = 200, .height = 60 };
+    ESP_ERROR_CHECK(dlist_render(edge.data, edge.len, &config, NULL));
+
+    free(raster);
+    free(png_data);
+    free(decoded);
+}
+
+/* Builds a patch, see delta_decoder.h */
+typedef struct {
+    uint8_t data[65536];
+    size_t len;
+} patch_buf_t;
+
+static void patch_put(patch_buf_t *b, const void *data, size_t len)
+{
+    assert(b->len + len <= sizeof(b->data));
+    memcpy(&b->data[b->len], data, len);
+    b->len += len;
+}
+
+static void patch_put_u32(patch_buf_t *b, uint32_t v)
+{
+    uint8_t bytes[4] = { v, v >> 8, v >> 16, v >> 24 };
+    patch_put(b, bytes, sizeof(bytes));
+}
+
+static void patch_header(patch_buf_t *b, int rects, uint32_t base_crc, uint32_t result_crc)
+{
+    uint8_t header[8] = { 'E', 'P', 'D', 'P', 1, 0, rects & 0xFF, rects >> 8 };
+    b->len = 0;
+    patch_put(b, header, sizeof(header));
+    patch_put_u32(b, base_crc);
+    patch_put_u32(b, result_crc);
+}
+
+static int fb_level(const uint8_t *fb, int x, int y)
+{
+    return (fb[y * FB_STRIDE + x / 2] >> (x % 2 ? 4 : 0)) & 0x0F;
+}
+
+/*
+ * A rectangle taking the pixels of frame, XORed with those of base if it isn't NULL.
+ * Only the first rows rows go into the data, to make a rectangle which ends early.
+ */
+static void patch_rect(patch_buf_t *b, EpdRect rect, const uint8_t *frame, const uint8_t *base, int rows)
+{
+    size_t row_bytes = (rect.width + 1) / 2;
+    uint8_t *raw = calloc(rows, row_bytes);
+    uLongf data_len = compressBound(rows * row_bytes);
+    uint8_t *data = malloc(data_len);
+    assert(raw != NULL && data != NULL);
+    for (int y = 0; y < rows; y++) {
+        for (int i = 0; i < rect.width; i++) {
+            int x = MIN(rect.x + i, EPD_WIDTH - 1);     // a rectangle may reach outside of the screen
+            int level = fb_level(frame, x, rect.y + y) ^ (base != NULL ? fb_level(base, x, rect.y + y) : 0);
+            raw[y * row_bytes + i / 2] |= level << (i % 2 ? 4 : 0);
+        }
+    }
+    int ret = compress2(data, &data_len, raw, rows * row_bytes, Z_BEST_COMPRESSION);
+    assert(ret == Z_OK);
+    uint8_t header[12] = {
+        rect.x & 0xFF, rect.x >> 8, rect.y & 0xFF, rect.y >> 8,
+        rect.width & 0xFF, rect.width >> 8, rect.height & 0xFF, rect.height >> 8,
+        base != NULL ? 1 : 0,
+    };
+    patch_put(b, header, sizeof(header));
+    patch_put_u32(b, data_len);
+    patch_put(b, data, data_len);
+    free(raw);
+    free(data);
+}
+
+/* Feed the patch in chunks, as it arrives from the network; returns the first error */
+static esp_err_t apply_patch(const patch_buf_t *b, uint32_t base_crc, uint8_t *fb, int64_t *out_us)
+{
+    image_decoder_config_t config = { .fb = fb };
+    delta_decoder_t *decoder;
+    ESP_ERROR_CHECK(delta_decoder_create(&config, base_crc, &decoder));
+    int64_t start = now_us();
+    esp_err_t ret = ESP_OK;
+    for (size_t offset = 0; offset < b->len && ret == ESP_OK; offset += PATCH_CHUNK) {
+        ret = delta_decoder_write(decoder, &b->data[offset], MIN(PATCH_CHUNK, b->len - offset));
+    }
+    image_decoder_stats_t stats;
+    if (ret == ESP_OK) {
+        ret = delta_decoder_finish(decoder, &stats);
+    }
+    *out_us = now_us() - start;
+    delta_decoder_delete(decoder);
+    return ret;
+}
+
+static bool check_patch(const char *name, esp_err_t ret, esp_err_t expected)
+{
+    if (ret != expected) {
+        ESP_LOGE(TAG, "  %s: %s, expected %s", name, esp_err_to_name(ret), esp_err_to_name(expected));
+    }
+    return ret == expected;
+}
+
+/* Returns the number of patches which weren't applied, or not rejected, as they should be */
+static int bench_patches(uint8_t *fb)
+{
+    uint8_t *base = malloc(FB_SIZE);
+    uint8_t *frame = malloc(FB_SIZE);
+    patch_buf_t *b = malloc(sizeof(*b));
+    assert(base != NULL && frame != NULL && b != NULL);
+    for (int i = 0; i < FB_SIZE; i++) {
+        base[i] = hash(i) % 3 == 0 ? hash(i + FB_SIZE) : 0xFF;
+    }
+    uint32_t base_crc = esp_rom_crc32_le(0, base, FB_SIZE);
+    // The new frame: a gray box at odd coordinates and a block of noise
+    memcpy(frame, base, FB_SIZE);
+    EpdRect box = { .x = 101, .y = 33, .width = 257, .height = 120 };
+    EpdRect noise = { .x = 600, .y = 300, .width = 200, .height = 80 };
+    epd_fill_rect(box, fb_level_color(7), frame);
+    for (int y = noise.y; y < noise.y + noise.height; y++) {
+        for (int x = noise.x; x < noise.x + noise.width; x += 2) {
+            frame[y * FB_STRIDE + x / 2] = hash(y * EPD_WIDTH + x);
+        }
+    }
+    uint32_t frame_crc = esp_rom_crc32_le(0, frame, FB_SIZE);
+    int failures = 0;
+    int64_t patch_us;
+
+    patch_header(b, 2, base_crc, frame_crc);
+    patch_rect(b, box, frame, NULL, box.height);
+    patch_rect(b, noise, frame, base, noise.height);
+    memcpy(fb, base, FB_SIZE);
+    esp_err_t ret = apply_patch(b, base_crc, fb, &patch_us);
+    if (!check_patch("patch", ret, ESP_OK) || memcmp(fb, frame, FB_SIZE) != 0) {
+        ESP_LOGE(TAG, "  patch: the frame differs from the one patched to");
+        failures++;
+    }
+    ESP_LOGI(TAG, "Patch of a %dx%d box and %dx%d of noise (host CPU time)", box.width, box.height, noise.width, noise.height);
+    ESP_LOGI(TAG, "  %u bytes %7.2f ms", (unsigned) b->len, patch_us / 1000.0);
+
+    // Against another frame: rejected before anything is written
+    memcpy(fb, base, FB_SIZE);
+    ret = apply_patch(b, base_crc ^ 1, fb, &patch_us);
+    if (!check_patch("base CRC mismatch", ret, ESP_ERR_INVALID_VERSION) || memcmp(fb, base, FB_SIZE) != 0) {
+        ESP_LOGE(TAG, "  base CRC mismatch: the frame was changed");
+        failures++;
+    }
+
+    patch_header(b, 1, base_crc, frame_crc);
+    patch_rect(b, box, frame, NULL, box.height - 1);
+    ret = apply_patch(b, base_crc, fb, &patch_us);
+    failures += !check_patch("rectangle data ending early", ret, ESP_ERR_INVALID_SIZE);
+
+    patch_header(b, 1, base_crc, frame_crc);
+    patch_rect(b, box, frame, NULL, box.height);
+    b->len -= 10;
+    ret = apply_patch(b, base_crc, fb, &patch_us);
+    failures += !check_patch("patch cut short", ret, ESP_ERR_INVALID_SIZE);
+
+    patch_header(b, 1, base_crc, frame_crc);
+    patch_rect(b, (EpdRect) { .x = EPD_WIDTH - 100, .y = 10, .width = 101, .height = 4 }, frame, NULL, 4);
+    ret = apply_patch(b, base_crc, fb, &patch_us);
+    failures += !check_patch("rectangle outside of the screen", ret, ESP_ERR_INVALID_SIZE);
+
+    free(base);
+    free(frame);
+    free(b);
+    return failures;
+}
+
+typedef void (*log_fn_t)(char *buf, const char *fmt, ...);
+
+/* The buffer isn't used; the message goes into the log ring */
+static void capture_message(char *buf, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    log_ring_vappend(fmt, args);
+    va_end(args);
+}
+
+static void format_message(char *buf, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, LOG_RING_LINE_MAX, fmt, args);
+    va_end(args);
+}
+
+static void append_message(char *buf, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    size_t len = strlen(buf);
+    vsnprintf(&buf[len], LOG_RING_LINE_MAX, fmt, args);
+    va_end(args);
+}
+
+/* Messages of a wake-up, as esp_log passes them */
+#define WAKE_MESSAGES 7
+static void log_wake(log_fn_t log, char *buf)
+{
+    log(buf, "%c (%lu) %s: Connecting to %s...\n", 'I', 312UL, "connect", "home");
+    log(buf, "%c (%lu) %s: Restored frame %u (CRC %08x)\n", 'I', 398UL, "display", 41u, 0x9dbdfb5au);
+    log(buf, "%c (%lu) %s: Decode: %s, %u bytes, %d ms, %d ms after download (%d ms hidden)\n",
+        'I', 2210UL, "display", "PNG", 23456u, 120, 10, 110);
+    log(buf, "%c (%lu) %s: PSRAM after %s: %u kB used, %u kB peak, %u kB largest free block\n",
+        'I', 2215UL, "main", "download", 1121u, 1290u, 2877u);
+    log(buf, "%c (%lu) %s: Refresh: %s %s at %d C (%s, %u pixels changed, %u to gray, %u partial updates before)\n",
+        'I', 2230UL, "display", "partial", "GL16", 22, "few levels", 31200u, 1800u, 3u);
+    log(buf, "%c (%lu) %s: Saved frame %u in %d ms\n", 'I', 2811UL, "display", 42u, 45);
+    log(buf, "%c (%lu) %s: Timeline (ms): connect %d-%d, download %d-%d, panel prep %d-%d, refresh %d-%d\n",
+        'I', 2812UL, "main", 310, 1650, 1650, 2215, 0, 0, 2230, 2810);
+}
+
+static void bench_log(void)
+{
+    char line[LOG_RING_LINE_MAX];
+    int64_t start = now_us();
+    for (int run = 0; run < LOG_RUNS; run++) {
+        log_wake(capture_message, NULL);
+    }
+    int64_t capture_us = now_us() - start;
+    start = now_us();
+    for (int run = 0; run < LOG_RUNS; run++) {
+        log_wake(format_message, line);
+    }
+    int64_t format_us = now_us() - start;
+
+    // Formatted later, the messages read the same
+    char *expected = calloc(1, LOG_RING_TEXT_SIZE);
+    char *text = malloc(LOG_RING_TEXT_SIZE);
+    assert(expected != NULL && text != NULL);
+    log_wake(append_message, expected);
+    log_wake(capture_message, NULL);
+    start = now_us();
+    size_t len = log_ring_copy(text, LOG_RING_TEXT_SIZE);
+    int64_t copy_us = now_us() - start;
+    assert(len >= strlen(expected) && strcmp(&text[len - strlen(expected)], expected) == 0);
+
+    int messages = LOG_RUNS * WAKE_MESSAGES;
+    ESP_LOGI(TAG, "Log messages (host CPU time per message)");
+    ESP_LOGI(TAG, "  capture arguments %7.1f ns", capture_us * 1000.0 / messages);
+    ESP_LOGI(TAG, "  format to text    %7.1f ns", format_us * 1000.0 / messages);
+    ESP_LOGI(TAG, "  formatting the %d kept messages for the error screen: %.1f us", CONFIG_APP_LOG_LINES, (double) copy_us);
+    free(expected);
+    free(text);
+}
+
+typedef enum EpdDrawError (*write_fn_t)(const EpdFont *font, const char *string, int *cursor_x, int *cursor_y,
+                                        uint8_t *fb, const EpdFontProperties *props);
+
+/* The error screen: a page of log lines; returns the glyphs drawn */
+static int draw_log_page(write_fn_t write, const EpdFont *font, uint8_t *fb)
+{
+    memset(fb, 0xFF, FB_SIZE);
+    char text[LOG_RING_TEXT_SIZE] = "";
+    log_wake(append_message, text);
+    log_wake(append_message, text);
+    EpdFontProperties props = epd_font_properties_default();
+    int glyphs = 0;
+    int y = 60;
+    for (char *line = text, *end; *line != '\0' && y < EPD_HEIGHT - 50; line = end + 1) {
+        end = strchr(line, '\n');
+        *end = '\0';
+        int x = 50;
+        write(font, line, &x, &y, fb, &props);
+        glyphs += strlen(line);
+    }
+    return glyphs;
+}
+
+static int64_t time_log_page(write_fn_t write, const EpdFont *font, uint8_t *fb, bool cold, int *out_glyphs)
+{
+    int64_t best_us = INT64_MAX;
+    for (int run = 0; run < TEXT_RUNS; run++) {
+        if (cold) {
+            text_cache_clear();
+        }
+        int64_t start = now_us();
+        *out_glyphs = draw_log_page(write, font, fb);
+        best_us = MIN(best_us, now_us() - start);
+    }
+    return best_us;
+}
+
+static void bench_text(uint8_t *fb)
+{
+    uint8_t *expected = malloc(FB_SIZE);
+    assert(expected != NULL);
+    int glyphs;
+    // epdiy inflates every glyph each time it is drawn
+    int64_t inflate_us = time_log_page(epd_write_string, &FiraSans_20, fb, false, &glyphs);
+    memcpy(expected, fb, FB_SIZE);
+    int64_t cold_us = time_log_page(text_write, &FiraSans_20, fb, true, &glyphs);
+    assert(memcmp(expected, fb, FB_SIZE) == 0);
+    text_cache_stats_t cold;
+    text_cache_get_stats(&cold);
+    int64_t warm_us = time_log_page(text_write, &FiraSans_20, fb, false, &glyphs);
+    text_cache_stats_t warm;
+    text_cache_get_stats(&warm);
+    assert(memcmp(expected, fb, FB_SIZE) == 0);
+    epd_sim_write_pgm("log_page.pgm", fb);
+
+    ESP_LOGI(TAG, "Log page text, %d glyphs of FiraSans_20 (host CPU time)", glyphs);
+    ESP_LOGI(TAG, "  inflate each glyph %7.2f ms %8.0f glyphs/s", inflate_us / 1000.0, glyphs * 1e6 / inflate_us);
+    ESP_LOGI(TAG, "  glyph cache, cold  %7.2f ms %8.0f glyphs/s", cold_us / 1000.0, glyphs * 1e6 / cold_us);
+    ESP_LOGI(TAG, "  glyph cache, warm  %7.2f ms %8.0f glyphs/s  (%u hits, %u misses per page, %u kB cached)",
+             warm_us / 1000.0, glyphs * 1e6 / warm_us, (unsigned) (warm.hits - cold.hits) / TEXT_RUNS,
+             (unsigned) (warm.misses - cold.misses) / TEXT_RUNS, (unsigned) warm.bytes / 1024);
+    free(expected);
+}
+
+/* Wrap the words of an ASCII paragraph into lines filling the screen, over and over */
+static void draw_screen_text(write_fn_t write, uint8_t *fb, int *out_glyphs)
+{
+    static const char paragraph[] =
+        "The quick brown fox jumps over the lazy dog. Pack my box with five dozen liquor jugs! "
+        "Sphinx of black quartz, judge my vow: 0123456789, 21.5 C, 42 %, 12:30 - 18:00. ";
+    memset(fb, 0xFF, FB_SIZE);
+    EpdFontProperties props = epd_font_properties_default();
+    int glyphs = 0;
+    const char *p = paragraph;
+    for (int y = FiraSans_20.ascender + 10; y - FiraSans_20.descender < EPD_HEIGHT; ) {
+        char line[256];
+        size_t len = 0;
+        int width = 0;
+        // Whole words, until the next one doesn't fit
+        for (;;) {
+            const char *word_end = strchr(p, ' ') + 1;
+            int word_width = 0;
+            for (const char *c = p; c < word_end; c++) {
+                const EpdGlyph *glyph = epd_get_glyph(&FiraSans_20, (uint8_t) *c);
+                word_width += glyph != NULL ? glyph->advance_x : 0;
+            }
+            if (width + word_width > EPD_WIDTH - 40 || len + (word_end - p) >= sizeof(line)) {
+                break;
+            }
+            memcpy(&line[len], p, word_end - p);
+            len += word_end - p;
+            width += word_width;
+            glyphs += word_end - p;
+            p = *word_end != '\0' ? word_end : paragraph;
+        }
+        line[len] = '\0';
+        int x = 20;
+        write(&FiraSans_20, line, &x, &y, fb, &props);
+    }
+    *out_glyphs = glyphs;
+}
+
+static int64_t time_screen_text(write_fn_t write, uint8_t *fb, int *out_glyphs)
+{
+    int64_t best_us = INT64_MAX;
+    for (int run = 0; run < TEXT_RUNS; run++) {
+        int64_t start = now_us();
+        draw_screen_text(write, fb, out_glyphs);
+        best_us = MIN(best_us, now_us() - start);
+    }
+    return best_us;
+}
+
+/* Turn the framebuffer by 180 degrees: the pixels in reverse order */
+static void rotate_half_turn(uint8_t *fb)
+{
+    for (int i = 0, j = FB_SIZE - 1; i <= j; i++, j--) {
+        uint8_t a = fb[i];
+        uint8_t b = fb[j];
+        fb[i] = (b >> 4) | (b << 4);
+        fb[j] = (a >> 4) | (a << 4);
+    }
+}
+
+/*
+ * A screen full of FiraSans_20 text. The glyphs are cached, so this is the cost of writing
+ * them into the framebuffer: as spans of bytes in landscape, the rotation of the app, and
+ * pixel by pixel in inverted landscape, which draw the same text turned by half a turn.
+ */
+static void bench_screen_text(uint8_t *fb)
+{
+    uint8_t *expected = malloc(FB_SIZE);
+    assert(expected != NULL);
+    int glyphs;
+    int64_t epdiy_us = time_screen_text(epd_write_string, fb, &glyphs);
+    memcpy(expected, fb, FB_SIZE);
+    int64_t span_us = time_screen_text(text_write, fb, &glyphs);
+    assert(memcmp(expected, fb, FB_SIZE) == 0);
+    epd_sim_write_pgm("screen_text.pgm", fb);
+    epd_set_rotation(EPD_ROT_INVERTED_LANDSCAPE);
+    int64_t pixel_us = time_screen_text(text_write, fb, &glyphs);
+    epd_set_rotation(EPD_ROT_LANDSCAPE);
+    rotate_half_turn(fb);
+    assert(memcmp(expected, fb, FB_SIZE) == 0);
+
+    ESP_LOGI(TAG, "A screen of text, %d glyphs of FiraSans_20 (host CPU time)", glyphs);
+    ESP_LOGI(TAG, "  epd_write_string   %7.2f ms %8.0f glyphs/s", epdiy_us / 1000.0, glyphs * 1e6 / epdiy_us);
+    ESP_LOGI(TAG, "  pixel by pixel     %7.2f ms %8.0f glyphs/s", pixel_us / 1000.0, glyphs * 1e6 / pixel_us);
+    ESP_LOGI(TAG, "  spans              %7.2f ms %8.0f glyphs/s", span_us / 1000.0, glyphs * 1e6 / span_us);
+    free(expected);
+}
+
+static int put_utf8(char *s, uint32_t cp)
+{
+    if (cp < 0x80) {
+        s[0] = cp;
+        return 1;
+    } else if (cp < 0x800) {
+        s[0] = 0xC0 | cp >> 6;
+        s[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    s[0] = 0xE0 | cp >> 12;
+    s[1] = 0x80 | (cp >> 6 & 0x3F);
+    s[2] = 0x80 | (cp & 0x3F);
+    return 3;
+}
+
+/* Every glyph of the font once, in rows across the screen; returns the glyphs drawn */
+static int draw_glyph_sheet(const EpdFont *font, uint8_t *fb)
+{
+    memset(fb, 0xFF, FB_SIZE);
+    EpdFontProperties props = epd_font_properties_default();
+    int glyphs = 0;
+    int x = 20;
+    int y = 50;
+    for (int i = 0; i < font->interval_count; i++) {
+        for (uint32_t cp = font->intervals[i].first; cp <= font->intervals[i].last; cp++) {
+            char s[4];
+            s[put_utf8(s, cp)] = '\0';
+            if (x > EPD_WIDTH - 60) {
+                x = 20;
+                y += font->advance_y;
+            }
+            int line_y = y;
+            text_write(font, s, &x, &line_y, fb, &props);
+            glyphs++;
+        }
+    }
+    return glyphs;
+}
+
+typedef struct {
+    const char *name;
+    const EpdFont *font;
+    font_encoding_t encoding;
+    size_t bitmap_size;
+    size_t table_size;          // glyphs and intervals
+} encoding_case_t;
+
+#define ENCODING_CASE(e, encoding) { #e, &FiraSans_20_##e, encoding, sizeof(FiraSans_20_##e##Bitmaps), \
+                                     sizeof(FiraSans_20_##e##Glyphs) + sizeof(FiraSans_20_##e##Intervals) }
+
+static void bench_encodings(uint8_t *fb)
+{
+    const encoding_case_t cases[] = {
+        ENCODING_CASE(zlib, FONT_ENCODING_ZLIB),
+        ENCODING_CASE(rle, FONT_ENCODING_RLE),
+        ENCODING_CASE(raw, FONT_ENCODING_RAW),
+    };
+    uint8_t *expected_sheet = malloc(FB_SIZE);
+    uint8_t *expected_page = malloc(FB_SIZE);
+    assert(expected_sheet != NULL && expected_page != NULL);
+    ESP_LOGI(TAG, "FiraSans_20 glyph encodings (host CPU time)");
+    ESP_LOGI(TAG, "  encoding     flash   every glyph once   log page, cold cache");
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const encoding_case_t *c = &cases[i];
+        fonts_set_encoding(c->font, c->encoding);
+        // Each glyph is drawn once, so every one of them is decoded
+        int sheet_glyphs = 0;
+        int64_t sheet_us = INT64_MAX;
+        for (int run = 0; run < TEXT_RUNS; run++) {
+            text_cache_clear();
+            int64_t start = now_us();
+            sheet_glyphs = draw_glyph_sheet(c->font, fb);
+            sheet_us = MIN(sheet_us, now_us() - start);
+        }
+        if (i == 0) {
+            memcpy(expected_sheet, fb, FB_SIZE);
+            epd_sim_write_pgm("glyphs.pgm", fb);
+        }
+        assert(memcmp(expected_sheet, fb, FB_SIZE) == 0);
+        int page_glyphs;
+        int64_t page_us = time_log_page(text_write, c->font, fb, true, &page_glyphs);
+        if (i == 0) {
+            memcpy(expected_page, fb, FB_SIZE);
+        }
+        assert(memcmp(expected_page, fb, FB_SIZE) == 0);
+        ESP_LOGI(TAG, "  %-8s %6.1f kB   %8.0f glyphs/s   %8.0f glyphs/s", c->name,
+                 (c->bitmap_size + c->table_size) / 1024.0, sheet_glyphs * 1e6 / sheet_us, page_glyphs * 1e6 / page_us);
+    }
+    free(expected_sheet);
+    free(expected_page);
+}
+
+void app_main(void)
+{
+    esp_log_level_set("row_pipeline", ESP_LOG_WARN);
+    esp_log_level_set("dlist", ESP_LOG_WARN);
+    // The malformed patches are expected to be rejected
+    esp_log_level_set("delta_decoder", ESP_LOG_NONE);
+    epd_init(EPD_LUT_1K);
+    EpdiyHighlevelState hl = epd_hl_init(EPD_BUILTIN_WAVEFORM);
+    epd_set_rotation(EPD_ROT_LANDSCAPE);
+    ESP_ERROR_CHECK(fonts_init());
+
+    bench_pipeline(epd_hl_get_framebuffer(&hl));
+    int failures = bench_policies(&hl);
+    bench_dlist(epd_hl_get_framebuffer(&hl));
+    failures += bench_patches(epd_hl_get_framebuffer(&hl));
+    bench_log();
+    bench_text(epd_hl_get_framebuffer(&hl));
+    bench_screen_text(epd_hl_get_framebuffer(&hl));
+    bench_encodings(epd_hl_get_framebuffer(&hl));
+    exit(failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,434 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * SPDX-FileCopyrightText: 2023 Ivan Grokhotkov <ivan@igrr.me>
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "epd_driver.h"
+#include "epd_highlevel.h"
+#include "epd_sim.h"
+
+/*
+ * The simulated panel keeps the level of every pixel, the way the real one keeps its
+ * image. Refreshes copy levels from the image being drawn and add their estimated
+ * cost to the statistics. Areas are in panel (landscape) coordinates, as in epdiy.
+ */
+
+#define FB_SIZE (EPD_WIDTH / 2 * EPD_HEIGHT)
+#define WAVEFORM_MODE_MASK 0x3F
+
+struct EpdWaveform {
+    const char *name;
+};
+
+const EpdWaveform epd_sim_waveform = {
+    .name = "simulated",
+};
+
+static const char *TAG = "epd_sim";
+static const epd_sim_model_t s_default_model = EPD_SIM_MODEL_DEFAULT();
+static epd_sim_model_t s_model = EPD_SIM_MODEL_DEFAULT();
+static epd_sim_stats_t s_stats;
+static uint8_t s_panel[FB_SIZE];
+static bool s_initialized;
+static bool s_powered;
+static int s_temperature = 22;
+static enum EpdRotation s_rotation;
+
+static inline int get_level(const uint8_t *fb, int stride, int x, int y)
+{
+    uint8_t byte = fb[y * stride + x / 2];
+    return x % 2 ? byte >> 4 : byte & 0x0F;
+}
+
+static inline void set_level(uint8_t *fb, int stride, int x, int y, int level)
+{
+    uint8_t *byte = &fb[y * stride + x / 2];
+    *byte = x % 2 ? (*byte & 0x0F) | (level << 4) : (*byte & 0xF0) | level;
+}
+
+static EpdRect clip_to_screen(EpdRect area)
+{
+    int x0 = MAX(area.x, 0);
+    int y0 = MAX(area.y, 0);
+    int x1 = MIN(area.x + area.width, EPD_WIDTH);
+    int y1 = MIN(area.y + area.height, EPD_HEIGHT);
+    return (EpdRect) {
+        .x = x0, .y = y0, .width = MAX(x1 - x0, 0), .height = MAX(y1 - y0, 0)
+    };
+}
+
+static int mode_phases(enum EpdDrawMode mode, int temperature)
+{
+    int phases;
+    switch (mode & WAVEFORM_MODE_MASK) {
+    case MODE_DU:
+    case MODE_A2:
+    case MODE_EPDIY_MONOCHROME:
+        phases = s_model.du_phases;
+        break;
+    case MODE_GL16:
+    case MODE_GL16_FAST:
+    case MODE_EPDIY_WHITE_TO_GL16:
+        phases = s_model.gl16_phases;
+        break;
+    default:
+        phases = s_model.gc16_phases;
+        break;
+    }
+    int cold = MAX(20 - temperature, 0);
+    return phases * (100 + cold * s_model.cold_percent) / 100;
+}
+
+/* Frames in which driven_lines lines are driven, with driven_pixels pixels switching in each frame */
+static void add_frames(int frames, int driven_lines, uint64_t driven_pixels)
+{
+    uint64_t frame_us = s_model.frame_us + (uint64_t) driven_lines * s_model.line_us
+                        + (uint64_t) (EPD_HEIGHT - driven_lines) * s_model.skip_line_us;
+    uint64_t us = frames * frame_us;
+    s_stats.frames += frames;
+    s_stats.lines_driven += (uint64_t) frames * driven_lines;
+    s_stats.panel_on_us += us;
+    s_stats.energy_uj += us * s_model.active_mw / 1000 + driven_pixels * frames * s_model.pixel_nj / 1000;
+}
+
+static void check_powered(const char *what)
+{
+    if (!s_powered) {
+        ESP_LOGW(TAG, "%s with the panel powered off", what);
+    }
+}
+
+static void set_panel_level(int x, int y, int level)
+{
+    if (get_level(s_panel, EPD_WIDTH / 2, x, y) != level) {
+        set_level(s_panel, EPD_WIDTH / 2, x, y, level);
+        s_stats.changed_pixels++;
+    }
+}
+
+/*
+ * Drive the lines of area for which drive_line is true (all if NULL) to the levels in
+ * data, which covers data_area with data_area.width / 2 bytes per line. GC16 switches
+ * every pixel of a driven line, the other modes only the pixels which change.
+ */
+static void drive(EpdRect area, const uint8_t *data, EpdRect data_area, const bool *drive_line,
+                  enum EpdDrawMode mode, int temperature)
+{
+    check_powered("Drawing");
+    area = clip_to_screen(area);
+    int stride = data_area.width / 2;
+    bool flash = (mode & WAVEFORM_MODE_MASK) == MODE_GC16;
+    int lines = 0;
+    uint64_t driven_pixels = 0;
+    for (int y = area.y; y < area.y + area.height; y++) {
+        if (drive_line != NULL && !drive_line[y - data_area.y]) {
+            continue;
+        }
+        uint64_t changed = s_stats.changed_pixels;
+        for (int x = area.x; x < area.x + area.width; x++) {
+            set_panel_level(x, y, get_level(data, stride, x - data_area.x, y - data_area.y));
+        }
+        changed = s_stats.changed_pixels - changed;
+        lines++;
+        driven_pixels += flash ? area.width : changed;
+    }
+    s_stats.update_count++;
+    add_frames(mode_phases(mode, temperature), lines, driven_pixels);
+}
+
+void epd_init(enum EpdInitOptions options)
+{
+    // The panel keeps its image between "boots" within one process
+    if (!s_initialized) {
+        memset(s_panel, 0xFF, FB_SIZE);
+        s_initialized = true;
+    }
+}
+
+void epd_deinit(void)
+{
+}
+
+void epd_poweron(void)
+{
+    if (s_powered) {
+        return;
+    }
+    s_powered = true;
+    s_stats.poweron_count++;
+    s_stats.panel_on_us += s_model.poweron_us;
+    s_stats.energy_uj += (uint64_t) s_model.poweron_us * s_model.active_mw / 1000;
+}
+
+void epd_poweroff(void)
+{
+    s_powered = false;
+}
+
+void epd_clear(void)
+{
+    epd_clear_area(epd_full_screen());
+}
+
+void epd_clear_area(EpdRect area)
+{
+    check_powered("Clearing");
+    area = clip_to_screen(area);
+    for (int y = area.y; y < area.y + area.height; y++) {
+        for (int x = area.x; x < area.x + area.width; x++) {
+            set_panel_level(x, y, 15);
+        }
+    }
+    s_stats.clear_count++;
+    add_frames(s_model.clear_frames, area.height, (uint64_t) area.width * area.height);
+}
+
+EpdRect epd_full_screen(void)
+{
+    return (EpdRect) {
+        .x = 0, .y = 0, .width = EPD_WIDTH, .height = EPD_HEIGHT
+    };
+}
+
+float epd_ambient_temperature(void)
+{
+    return s_temperature;
+}
+
+void epd_set_rotation(enum EpdRotation rotation)
+{
+    s_rotation = rotation;
+}
+
+enum EpdRotation epd_get_rotation(void)
+{
+    return s_rotation;
+}
+
+int epd_rotated_display_width(void)
+{
+    return s_rotation == EPD_ROT_PORTRAIT || s_rotation == EPD_ROT_INVERTED_PORTRAIT ? EPD_HEIGHT : EPD_WIDTH;
+}
+
+int epd_rotated_display_height(void)
+{
+    return s_rotation == EPD_ROT_PORTRAIT || s_rotation == EPD_ROT_INVERTED_PORTRAIT ? EPD_WIDTH : EPD_HEIGHT;
+}
+
+void epd_draw_pixel(int x, int y, uint8_t color, uint8_t *framebuffer)
+{
+    if (x < 0 || x >= epd_rotated_display_width() || y < 0 || y >= epd_rotated_display_height()) {
+        return;
+    }
+    int px = x;
+    int py = y;
+    switch (s_rotation) {
+    case EPD_ROT_PORTRAIT:
+        px = EPD_WIDTH - y - 1;
+        py = x;
+        break;
+    case EPD_ROT_INVERTED_LANDSCAPE:
+        px = EPD_WIDTH - x - 1;
+        py = EPD_HEIGHT - y - 1;
+        break;
+    case EPD_ROT_INVERTED_PORTRAIT:
+        px = y;
+        py = EPD_HEIGHT - x - 1;
+        break;
+    default:
+        break;
+    }
+    set_level(framebuffer, EPD_WIDTH / 2, px, py, color >> 4);
+}
+
+void epd_draw_hline(int x, int y, int length, uint8_t color, uint8_t *framebuffer)
+{
+    for (int i = 0; i < length; i++) {
+        epd_draw_pixel(x + i, y, color, framebuffer);
+    }
+}
+
+void epd_draw_vline(int x, int y, int length, uint8_t color, uint8_t *framebuffer)
+{
+    for (int i = 0; i < length; i++) {
+        epd_draw_pixel(x, y + i, color, framebuffer);
+    }
+}
+
+void epd_draw_line(int x0, int y0, int x1, int y1, uint8_t color, uint8_t *framebuffer)
+{
+    int dx = abs(x1 - x0);
+    int dy = -abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    while (true) {
+        epd_draw_pixel(x0, y0, color, framebuffer);
+        if (x0 == x1 && y0 == y1) {
+            break;
+        }
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+void epd_draw_rect(EpdRect rect, uint8_t color, uint8_t *framebuffer)
+{
+    epd_draw_hline(rect.x, rect.y, rect.width, color, framebuffer);
+    epd_draw_hline(rect.x, rect.y + rect.height - 1, rect.width, color, framebuffer);
+    epd_draw_vline(rect.x, rect.y, rect.height, color, framebuffer);
+    epd_draw_vline(rect.x + rect.width - 1, rect.y, rect.height, color, framebuffer);
+}
+
+void epd_fill_rect(EpdRect rect, uint8_t color, uint8_t *framebuffer)
+{
+    for (int y = rect.y; y < rect.y + rect.height; y++) {
+        epd_draw_hline(rect.x, y, rect.width, color, framebuffer);
+    }
+}
+
+enum EpdDrawError epd_draw_base(EpdRect area, const uint8_t *data, EpdRect crop_to, enum EpdDrawMode mode,
+                                int temperature, const bool *drawn_lines, const EpdWaveform *waveform)
+{
+    if (!(mode & MODE_PACKING_2PPB)) {
+        return EPD_DRAW_INVALID_PACKING_MODE;
+    }
+    int x0 = MAX(area.x, crop_to.x);
+    int y0 = MAX(area.y, crop_to.y);
+    int x1 = MIN(area.x + area.width, crop_to.x + crop_to.width);
+    int y1 = MIN(area.y + area.height, crop_to.y + crop_to.height);
+    if (x1 <= x0 || y1 <= y0) {
+        return EPD_DRAW_INVALID_CROP;
+    }
+    EpdRect crop = {
+        .x = x0, .y = y0, .width = x1 - x0, .height = y1 - y0
+    };
+    drive(crop, data, area, drawn_lines, mode, temperature);
+    return EPD_DRAW_SUCCESS;
+}
+
+EpdiyHighlevelState epd_hl_init(const EpdWaveform *waveform)
+{
+    EpdiyHighlevelState state = {
+        .back_fb = malloc(FB_SIZE),
+        .front_fb = malloc(FB_SIZE),
+        .difference_fb = malloc(2 * FB_SIZE),
+        .dirty_lines = malloc(EPD_HEIGHT * sizeof(bool)),
+        .waveform = waveform,
+    };
+    if (state.back_fb == NULL || state.front_fb == NULL || state.difference_fb == NULL || state.dirty_lines == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the framebuffers");
+        abort();
+    }
+    memset(state.back_fb, 0xFF, FB_SIZE);
+    memset(state.front_fb, 0xFF, FB_SIZE);
+    return state;
+}
+
+uint8_t *epd_hl_get_framebuffer(EpdiyHighlevelState *state)
+{
+    return state->front_fb;
+}
+
+void epd_hl_set_all_white(EpdiyHighlevelState *state)
+{
+    memset(state->front_fb, 0xFF, FB_SIZE);
+}
+
+enum EpdDrawError epd_hl_update_screen(EpdiyHighlevelState *state, enum EpdDrawMode mode, int temperature)
+{
+    return epd_hl_update_area(state, mode, temperature, epd_full_screen());
+}
+
+/*
+ * Like epdiy, only pixels where the front and back buffers differ are driven, and only
+ * lines with such pixels. If the back buffer doesn't match the panel, the panel ends up
+ * showing something else than the front buffer, as the real one would.
+ */
+enum EpdDrawError epd_hl_update_area(EpdiyHighlevelState *state, enum EpdDrawMode mode, int temperature, EpdRect area)
+{
+    check_powered("Drawing");
+    area = clip_to_screen(area);
+    bool flash = (mode & WAVEFORM_MODE_MASK) == MODE_GC16;
+    int lines = 0;
+    uint64_t driven_pixels = 0;
+    for (int y = area.y; y < area.y + area.height; y++) {
+        int changed = 0;
+        for (int x = area.x; x < area.x + area.width; x++) {
+            int level = get_level(state->front_fb, EPD_WIDTH / 2, x, y);
+            if (get_level(state->back_fb, EPD_WIDTH / 2, x, y) != level) {
+                set_level(state->back_fb, EPD_WIDTH / 2, x, y, level);
+                set_panel_level(x, y, level);
+                changed++;
+            }
+        }
+        state->dirty_lines[y] = changed > 0;
+        if (changed > 0) {
+            lines++;
+            driven_pixels += flash ? area.width : changed;
+        }
+    }
+    s_stats.update_count++;
+    add_frames(mode_phases(mode, temperature), lines, driven_pixels);
+    return EPD_DRAW_SUCCESS;
+}
+
+void epd_sim_set_model(const epd_sim_model_t *model)
+{
+    s_model = model != NULL ? *model : s_default_model;
+}
+
+void epd_sim_set_temperature(int temperature)
+{
+    s_temperature = temperature;
+}
+
+void epd_sim_get_stats(epd_sim_stats_t *out_stats)
+{
+    *out_stats = s_stats;
+}
+
+void epd_sim_reset_stats(void)
+{
+    s_stats = (epd_sim_stats_t) {
+        0
+    };
+}
+
+const uint8_t *epd_sim_panel(void)
+{
+    return s_panel;
+}
+
+esp_err_t epd_sim_write_pgm(const char *path, const uint8_t *fb)
+{
+    FILE *f = fopen(path, "wb");
+    ESP_RETURN_ON_FALSE(f != NULL, ESP_FAIL, TAG, "Failed to open %s", path);
+    esp_err_t ret = ESP_OK;
+    fprintf(f, "P5\n%d %d\n255\n", EPD_WIDTH, EPD_HEIGHT);
+    uint8_t line[EPD_WIDTH];
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        for (int x = 0; x < EPD_WIDTH; x++) {
+            line[x] = get_level(fb, EPD_WIDTH / 2, x, y) * 0x11;
+        }
+        ESP_GOTO_ON_FALSE(fwrite(line, 1, sizeof(line), f) == sizeof(line), ESP_FAIL, out, TAG, "Failed to write %s", path);
+    }
+out:
+    fclose(f);
+    return ret;
+}
@@ -0,0 +1,177 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * SPDX-FileCopyrightText: 2023 Ivan Grokhotkov <ivan@igrr.me>
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <zlib.h>
+#include "epd_driver.h"
+
+/* Text rendering with the same glyph placement and color mapping as epdiy */
+
+/* Decode the next UTF-8 code point and advance *string past it; 0 at the end of the string */
+static uint32_t next_code_point(const uint8_t **string)
+{
+    const uint8_t *s = *string;
+    if (*s == 0) {
+        return 0;
+    }
+    uint32_t cp;
+    int extra;
+    if (*s < 0x80) {
+        cp = *s;
+        extra = 0;
+    } else if ((*s & 0xE0) == 0xC0) {
+        cp = *s & 0x1F;
+        extra = 1;
+    } else if ((*s & 0xF0) == 0xE0) {
+        cp = *s & 0x0F;
+        extra = 2;
+    } else {
+        cp = *s & 0x07;
+        extra = 3;
+    }
+    s++;
+    for (int i = 0; i < extra && (*s & 0xC0) == 0x80; i++) {
+        cp = (cp << 6) | (*s & 0x3F);
+        s++;
+    }
+    *string = s;
+    return cp;
+}
+
+EpdFontProperties epd_font_properties_default(void)
+{
+    return (EpdFontProperties) {
+        .fg_color = 0, .bg_color = 15, .fallback_glyph = 0, .flags = EPD_DRAW_ALIGN_LEFT
+    };
+}
+
+const EpdGlyph *epd_get_glyph(const EpdFont *font, uint32_t code_point)
+{
+    for (uint32_t i = 0; i < font->interval_count; i++) {
+        const EpdUnicodeInterval *interval = &font->intervals[i];
+        if (code_point >= interval->first && code_point <= interval->last) {
+            return &font->glyph[interval->offset + (code_point - interval->first)];
+        }
+        if (code_point < interval->first) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static enum EpdDrawError draw_char(const EpdFont *font, uint8_t *fb, int *cursor_x, int cursor_y,
+                                   uint32_t code_point, const EpdFontProperties *props)
+{
+    const EpdGlyph *glyph = epd_get_glyph(font, code_point);
+    if (glyph == NULL) {
+        glyph = epd_get_glyph(font, props->fallback_glyph);
+    }
+    if (glyph == NULL) {
+        return EPD_DRAW_GLYPH_FALLBACK_FAILED;
+    }
+    int byte_width = (glyph->width + 1) / 2;
+    unsigned long bitmap_size = byte_width * glyph->height;
+    uint8_t *buffer = NULL;
+    const uint8_t *bitmap = &font->bitmap[glyph->data_offset];
+    if (font->compressed && bitmap_size > 0) {
+        buffer = malloc(bitmap_size);
+        if (buffer == NULL) {
+            return EPD_DRAW_FAILED_ALLOC;
+        }
+        if (uncompress(buffer, &bitmap_size, bitmap, glyph->compressed_size) != Z_OK) {
+            free(buffer);
+            return EPD_DRAW_STRING_INVALID;
+        }
+        bitmap = buffer;
+    }
+
+    uint8_t color_lut[16];
+    int color_difference = (int) props->fg_color - (int) props->bg_color;
+    for (int c = 0; c < 16; c++) {
+        color_lut[c] = MAX(0, MIN(15, props->bg_color + c * color_difference / 15));
+    }
+    bool background = props->flags & EPD_DRAW_BACKGROUND;
+    int start_x = *cursor_x + glyph->left;
+    for (int y = 0; y < glyph->height; y++) {
+        int yy = cursor_y - glyph->top + y;
+        for (int x = 0; x < glyph->width; x++) {
+            uint8_t value = bitmap[y * byte_width + x / 2];
+            value = x % 2 ? value >> 4 : value & 0x0F;
+            if (background || value != 0) {
+                epd_draw_pixel(start_x + x, yy, color_lut[value] << 4, fb);
+            }
+        }
+    }
+    free(buffer);
+    *cursor_x += glyph->advance_x;
+    return EPD_DRAW_SUCCESS;
+}
+
+static int line_width(const EpdFont *font, const char *line, const EpdFontProperties *props)
+{
+    int width = 0;
+    const uint8_t *s = (const uint8_t *) line;
+    uint32_t cp;
+    while ((cp = next_code_point(&s)) != 0) {
+        const EpdGlyph *glyph = epd_get_glyph(font, cp);
+        if (glyph == NULL) {
+            glyph = epd_get_glyph(font, props->fallback_glyph);
+        }
+        width += glyph != NULL ? glyph->advance_x : 0;
+    }
+    return width;
+}
+
+static enum EpdDrawError write_line(const EpdFont *font, const char *line, int *cursor_x, int cursor_y,
+                                    uint8_t *fb, const EpdFontProperties *props)
+{
+    if (*line == 0) {
+        return EPD_DRAW_SUCCESS;
+    }
+    if (props->flags & (EPD_DRAW_ALIGN_RIGHT | EPD_DRAW_ALIGN_CENTER)) {
+        int width = line_width(font, line, props);
+        *cursor_x -= props->flags & EPD_DRAW_ALIGN_RIGHT ? width : width / 2;
+    }
+    enum EpdDrawError err = EPD_DRAW_SUCCESS;
+    const uint8_t *s = (const uint8_t *) line;
+    uint32_t cp;
+    while ((cp = next_code_point(&s)) != 0) {
+        err |= draw_char(font, fb, cursor_x, cursor_y, cp, props);
+    }
+    return err;
+}
+
+enum EpdDrawError epd_write_string(const EpdFont *font, const char *string, int *cursor_x, int *cursor_y,
+                                   uint8_t *framebuffer, const EpdFontProperties *properties)
+{
+    if (string == NULL) {
+        return EPD_DRAW_STRING_INVALID;
+    }
+    char *copy = strdup(string);
+    if (copy == NULL) {
+        return EPD_DRAW_FAILED_ALLOC;
+    }
+    enum EpdDrawError err = EPD_DRAW_SUCCESS;
+    int line_start = *cursor_x;
+    char *rest = copy;
+    char *line;
+    while ((line = strsep(&rest, "\n")) != NULL) {
+        *cursor_x = line_start;
+        err |= write_line(font, line, cursor_x, *cursor_y, framebuffer, properties);
+        *cursor_y += font->advance_y;
+    }
+    free(copy);
+    return err;
+}
+
+enum EpdDrawError epd_write_default(const EpdFont *font, const char *string, int *cursor_x, int *cursor_y,
+                                    uint8_t *framebuffer)
+{
+    EpdFontProperties props = epd_font_properties_default();
+    return epd_write_string(font, string, cursor_x, cursor_y, framebuffer, &props);
+}
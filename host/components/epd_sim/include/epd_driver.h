@@ -0,0 +1,167 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * SPDX-FileCopyrightText: 2023 Ivan Grokhotkov <ivan@igrr.me>
+ */
+
+/*
+ * The part of the epdiy API used by the app, for host builds.
+ * Types and signatures follow epdiy, so that app code builds unchanged.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EPD_WIDTH 960
+#define EPD_HEIGHT 540
+
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} EpdRect;
+
+enum EpdInitOptions {
+    EPD_OPTIONS_DEFAULT = 0,
+    EPD_LUT_1K = 1,
+    EPD_LUT_64K = 2,
+    EPD_FEED_QUEUE_8 = 4,
+    EPD_FEED_QUEUE_32 = 8,
+};
+
+enum EpdDrawMode {
+    MODE_INVALID = 0,
+    MODE_DU = 0x1,
+    MODE_GC16 = 0x2,
+    MODE_GC16_FAST = 0x3,
+    MODE_A2 = 0x4,
+    MODE_GL16 = 0x5,
+    MODE_GL16_FAST = 0x6,
+    MODE_DU4 = 0x7,
+    MODE_GL4 = 0xA,
+    MODE_GL16_INV = 0xB,
+    MODE_EPDIY_WHITE_TO_GL16 = 0x10,
+    MODE_EPDIY_BLACK_TO_GL16 = 0x11,
+    MODE_EPDIY_MONOCHROME = 0x12,
+    MODE_UNKNOWN_WAVEFORM = 0x3F,
+    MODE_PACKING_8PPB = 0x40,
+    MODE_PACKING_2PPB = 0x80,
+    MODE_PACKING_1PPB_DIFFERENCE = 0x100,
+    PREVIOUSLY_WHITE = 0x200,
+    PREVIOUSLY_BLACK = 0x400,
+    INVERT = 0x800,
+};
+
+enum EpdDrawError {
+    EPD_DRAW_SUCCESS = 0x0,
+    EPD_DRAW_INVALID_PACKING_MODE = 0x1,
+    EPD_DRAW_LOOKUP_NOT_IMPLEMENTED = 0x2,
+    EPD_DRAW_STRING_INVALID = 0x4,
+    EPD_DRAW_NO_DRAWABLE_CHARACTERS = 0x8,
+    EPD_DRAW_FAILED_ALLOC = 0x10,
+    EPD_DRAW_GLYPH_FALLBACK_FAILED = 0x20,
+    EPD_DRAW_INVALID_CROP = 0x40,
+    EPD_DRAW_MODE_NOT_FOUND = 0x80,
+    EPD_DRAW_NO_PHASES_AVAILABLE = 0x100,
+    EPD_DRAW_INVALID_FONT_FLAGS = 0x200,
+};
+
+enum EpdRotation {
+    EPD_ROT_LANDSCAPE = 0,
+    EPD_ROT_PORTRAIT = 1,
+    EPD_ROT_INVERTED_LANDSCAPE = 2,
+    EPD_ROT_INVERTED_PORTRAIT = 3,
+};
+
+typedef struct {
+    uint8_t width;              /*!< Bitmap dimensions in pixels */
+    uint8_t height;
+    uint8_t advance_x;          /*!< Distance to advance the cursor */
+    int16_t left;               /*!< X distance from the cursor to the left edge of the bitmap */
+    int16_t top;                /*!< Y distance from the cursor to the top edge of the bitmap */
+    uint32_t compressed_size;   /*!< Size of the zlib-compressed bitmap */
+    uint32_t data_offset;       /*!< Offset into EpdFont::bitmap */
+} EpdGlyph;
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+    uint32_t offset;            /*!< Index of the glyph of the first code point */
+} EpdUnicodeInterval;
+
+typedef struct {
+    const uint8_t *bitmap;      /*!< Glyph bitmaps, concatenated */
+    const EpdGlyph *glyph;
+    const EpdUnicodeInterval *intervals;
+    uint32_t interval_count;
+    bool compressed;
+    uint16_t advance_y;         /*!< Distance between lines */
+    int ascender;
+    int descender;
+} EpdFont;
+
+enum EpdFontFlags {
+    EPD_DRAW_BACKGROUND = 0x1,
+    EPD_DRAW_ALIGN_LEFT = 0x2,
+    EPD_DRAW_ALIGN_RIGHT = 0x4,
+    EPD_DRAW_ALIGN_CENTER = 0x8,
+};
+
+typedef struct {
+    uint8_t fg_color : 4;
+    uint8_t bg_color : 4;
+    uint32_t fallback_glyph;
+    enum EpdFontFlags flags;
+} EpdFontProperties;
+
+/* Refresh timing of the simulated panel, see epd_sim.h */
+typedef struct EpdWaveform EpdWaveform;
+extern const EpdWaveform epd_sim_waveform;
+#define EPD_BUILTIN_WAVEFORM (&epd_sim_waveform)
+
+void epd_init(enum EpdInitOptions options);
+void epd_deinit(void);
+void epd_poweron(void);
+void epd_poweroff(void);
+void epd_clear(void);
+void epd_clear_area(EpdRect area);
+EpdRect epd_full_screen(void);
+float epd_ambient_temperature(void);
+
+void epd_set_rotation(enum EpdRotation rotation);
+enum EpdRotation epd_get_rotation(void);
+int epd_rotated_display_width(void);
+int epd_rotated_display_height(void);
+
+void epd_draw_pixel(int x, int y, uint8_t color, uint8_t *framebuffer);
+void epd_draw_hline(int x, int y, int length, uint8_t color, uint8_t *framebuffer);
+void epd_draw_vline(int x, int y, int length, uint8_t color, uint8_t *framebuffer);
+void epd_draw_line(int x0, int y0, int x1, int y1, uint8_t color, uint8_t *framebuffer);
+void epd_draw_rect(EpdRect rect, uint8_t color, uint8_t *framebuffer);
+void epd_fill_rect(EpdRect rect, uint8_t color, uint8_t *framebuffer);
+
+/**
+ * @brief Drive the panel to the image in data
+ *
+ * Only MODE_PACKING_2PPB is simulated: data is a 4bpp image covering area, of which the
+ * part inside crop_to is drawn.
+ */
+enum EpdDrawError epd_draw_base(EpdRect area, const uint8_t *data, EpdRect crop_to, enum EpdDrawMode mode,
+                                int temperature, const bool *drawn_lines, const EpdWaveform *waveform);
+
+EpdFontProperties epd_font_properties_default(void);
+const EpdGlyph *epd_get_glyph(const EpdFont *font, uint32_t code_point);
+enum EpdDrawError epd_write_string(const EpdFont *font, const char *string, int *cursor_x, int *cursor_y,
+                                   uint8_t *framebuffer, const EpdFontProperties *properties);
+enum EpdDrawError epd_write_default(const EpdFont *font, const char *string, int *cursor_x, int *cursor_y,
+                                    uint8_t *framebuffer);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,32 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * SPDX-FileCopyrightText: 2023 Ivan Grokhotkov <ivan@igrr.me>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "epd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint8_t *back_fb;           /*!< What the panel shows */
+    uint8_t *front_fb;          /*!< What to draw next */
+    uint8_t *difference_fb;
+    bool *dirty_lines;
+    const EpdWaveform *waveform;
+} EpdiyHighlevelState;
+
+EpdiyHighlevelState epd_hl_init(const EpdWaveform *waveform);
+uint8_t *epd_hl_get_framebuffer(EpdiyHighlevelState *state);
+enum EpdDrawError epd_hl_update_screen(EpdiyHighlevelState *state, enum EpdDrawMode mode, int temperature);
+enum EpdDrawError epd_hl_update_area(EpdiyHighlevelState *state, enum EpdDrawMode mode, int temperature, EpdRect area);
+void epd_hl_set_all_white(EpdiyHighlevelState *state);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ * SPDX-FileCopyrightText: 2023 Ivan Grokhotkov <ivan@igrr.me>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Cost model of the simulated panel
+ *
+ * Each refresh drives the panel for a number of frames (waveform phases) which depends
+ * on the mode and grows when the panel is cold. In each frame, every line is either
+ * driven or skipped, the latter being much faster. The defaults are rough figures for
+ * the ED047TC1 panel with epdiy; they are meant for comparing refresh strategies,
+ * not for predicting absolute numbers.
+ */
+typedef struct {
+    int du_phases;          /*!< Frames of a DU update at room temperature */
+    int gl16_phases;        /*!< ... of a GL16 update */
+    int gc16_phases;        /*!< ... of a GC16 update, which flashes the pixels */
+    int clear_frames;       /*!< Frames of epd_clear (alternating black and white) */
+    int cold_percent;       /*!< Extra frames per degree below 20 C, in percent */
+    int line_us;            /*!< Time to drive one line */
+    int skip_line_us;       /*!< Time to skip one line */
+    int frame_us;           /*!< Per frame overhead */
+    int poweron_us;         /*!< Panel power rails ramping up */
+    int active_mw;          /*!< Power drawn while the panel is on */
+    int pixel_nj;           /*!< Energy to switch one pixel for one frame */
+} epd_sim_model_t;
+
+#define EPD_SIM_MODEL_DEFAULT() { \
+    .du_phases = 10, \
+    .gl16_phases = 30, \
+    .gc16_phases = 40, \
+    .clear_frames = 40, \
+    .cold_percent = 4, \
+    .line_us = 40, \
+    .skip_line_us = 2, \
+    .frame_us = 200, \
+    .poweron_us = 5000, \
+    .active_mw = 400, \
+    .pixel_nj = 1, \
+}
+
+/**
+ * @brief What the panel went through since the last epd_sim_reset_stats
+ */
+typedef struct {
+    uint32_t poweron_count;
+    uint32_t clear_count;
+    uint32_t update_count;      /*!< Calls of epd_draw_base / epd_hl_update_* */
+    uint32_t frames;            /*!< Frames driven, clears included */
+    uint64_t lines_driven;      /*!< Lines driven over all frames */
+    uint64_t changed_pixels;    /*!< Pixels whose level on the panel changed */
+    uint64_t panel_on_us;       /*!< Estimated time the panel was driven, power-up included */
+    uint64_t energy_uj;         /*!< Estimated energy */
+} epd_sim_stats_t;
+
+/* Replace the cost model; NULL restores the defaults */
+void epd_sim_set_model(const epd_sim_model_t *model);
+
+/* Temperature reported by epd_ambient_temperature, 22 C by default */
+void epd_sim_set_temperature(int temperature);
+
+void epd_sim_get_stats(epd_sim_stats_t *out_stats);
+void epd_sim_reset_stats(void);
+
+/* 4bpp image of what the panel shows, EPD_WIDTH / 2 bytes per line */
+const uint8_t *epd_sim_panel(void);
+
+/* Write a 4bpp framebuffer (e.g. epd_sim_panel()) as an 8-bit PGM image */
+esp_err_t epd_sim_write_pgm(const char *path, const uint8_t *fb);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,46 @@
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "adc.h"
+
+static const char *TAG = "adc";
+
+esp_err_t app_adc_read_mv(adc_channel_t channel, int samples, int *out_mv)
+{
+    esp_err_t ret = ESP_OK;
+    adc_oneshot_unit_handle_t adc = NULL;
+    adc_cali_handle_t cali = NULL;
+    adc_oneshot_unit_init_cfg_t unit_config = {
+        .unit_id = ADC_UNIT_1,
+    };
+    ESP_RETURN_ON_ERROR(adc_oneshot_new_unit(&unit_config, &adc), TAG, "Failed to init ADC");
+    adc_oneshot_chan_cfg_t channel_config = {
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    ESP_GOTO_ON_ERROR(adc_oneshot_config_channel(adc, channel, &channel_config), out, TAG, "Failed to configure ADC channel");
+    adc_cali_line_fitting_config_t cali_config = {
+        .unit_id = ADC_UNIT_1,
+        .atten = ADC_ATTEN_DB_12,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+        .default_vref = 1100,   // used if the chip has no Vref calibration in eFuse
+    };
+    ESP_GOTO_ON_ERROR(adc_cali_create_scheme_line_fitting(&cali_config, &cali), out, TAG, "Failed to init ADC calibration");
+
+    int sum = 0;
+    for (int i = 0; i < samples; i++) {
+        int raw;
+        ESP_GOTO_ON_ERROR(adc_oneshot_read(adc, channel, &raw), out, TAG, "Failed to read ADC");
+        sum += raw;
+    }
+    ESP_GOTO_ON_ERROR(adc_cali_raw_to_voltage(cali, sum / samples, out_mv), out, TAG, "Failed to convert ADC reading");
+out:
+    if (cali != NULL) {
+        adc_cali_delete_scheme_line_fitting(cali);
+    }
+    adc_oneshot_del_unit(adc);
+    return ret;
+}
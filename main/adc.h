@@ -0,0 +1,24 @@
+#pragma once
+
+#include "esp_err.h"
+#include "hal/adc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Read the voltage at an input of ADC1, in mV
+ *
+ * The ADC unit is set up for the reading and released afterwards. The average of the
+ * samples is converted with the line fitting calibration, at 12 dB attenuation (up to ~3.1 V).
+ *
+ * @param channel  ADC1 channel
+ * @param samples  number of readings averaged
+ * @param[out] out_mv  voltage in mV
+ */
+esp_err_t app_adc_read_mv(adc_channel_t channel, int samples, int *out_mv);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,29 +1,90 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
 #include "esp_err.h"
+#include "temperature.h"
+#include "epd_driver.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Phase boundaries of one wake-up, in microseconds since boot; 0 if the phase didn't happen */
+typedef struct {
+    int64_t connect_start;
+    int64_t connect_end;
+    int64_t download_start;
+    int64_t download_end;
+    int64_t panel_prep_start;
+    int64_t panel_prep_end;
+    int64_t refresh_start;
+    int64_t refresh_end;
+} app_timeline_t;
+
+typedef struct {
+    unsigned success_count;         // fetches, the wake-ups which only updated the widgets aren't counted
+    unsigned fail_count;
+    unsigned awake_time_ms;         // of the fetches
+    unsigned widget_count;          // wake-ups which only updated the widgets
+    unsigned widget_awake_time_ms;
+    unsigned connecting_time_ms;
+    unsigned display_on_time_ms;
+    unsigned decode_time_ms;        // CPU time spent decoding the image, on both cores
+    unsigned decode_hidden_ms;      // part of decode_time_ms which overlapped with the download
+    unsigned image_bytes;           // size of the downloaded image, as transferred
+    int temperature;                // panel temperature used for the refresh, not accumulated
+    unsigned refresh_ms_by_band[APP_TEMPERATURE_BANDS]; // display_on_time_ms, split by app_temperature_band(temperature)
+    unsigned refreshes_by_band[APP_TEMPERATURE_BANDS];
+    unsigned panel_prep_ms;         // powering up and clearing the panel ahead of the refresh
+    unsigned panel_prep_hidden_ms;  // part of panel_prep_ms which overlapped with networking and decoding
+    app_timeline_t timeline;        // not accumulated
+} app_stats_t;
+
+typedef struct app_display_image app_display_image_t;
+
 esp_err_t app_display_init(void);
 void app_display_init_log(void);
 void app_display_show_log(void);
-esp_err_t app_display_png(const uint8_t *png_data, size_t png_len);
 void app_display_poweroff(void);
+/* If the next refresh will be a full one, clear the panel in the background, on the other core */
+void app_display_prepare(void);
+
+/*
+ * Streaming image display: the image is decoded into the framebuffer as data arrives.
+ * With area NULL, the image fills the screen; otherwise it's fitted into area (in screen
+ * coordinates) and the rest of the framebuffer is kept.
+ */
+esp_err_t app_display_image_begin(const EpdRect *area, app_display_image_t **out_image);
+/* Select the decoder from the Content-Type header; without it, the format is detected from the data */
+void app_display_image_set_content_type(app_display_image_t *image, const char *content_type);
+esp_err_t app_display_image_write(app_display_image_t *image, const void *data, size_t len);
+/* Wait for the decode to finish and free the image. Adds to the decode fields of stats */
+esp_err_t app_display_image_end(app_display_image_t *image, app_stats_t *stats);
+/* Show the framebuffer. Fills the display fields of stats */
+void app_display_refresh(app_stats_t *stats);
+/* The framebuffer starts out with what the panel shows, so parts of it can be updated */
+bool app_display_frame_known(void);
+/* CRC of the frame on the panel, as saved in flash; false if unknown. Patches apply to this frame */
+bool app_display_frame_crc(uint32_t *out_crc);
+/* Free the image without showing it */
+void app_display_image_abort(app_display_image_t *image);
+/*
+ * Draw the clock, battery and status widgets (widgets.h) into area, for the next refresh.
+ * updated is the time of the last successful fetch. A refresh which only changed the
+ * widgets doesn't save the frame to flash; the widgets are redrawn from RTC memory.
+ */
+void app_display_widgets(const EpdRect *area, time_t updated, bool stale);
 
 esp_err_t app_wifi_connect_start(void);
 esp_err_t app_wifi_wait_for_connection(void);
 void app_wifi_stop();
-
-typedef struct {
-    unsigned success_count;
-    unsigned fail_count;
-    unsigned awake_time_ms;
-    unsigned connecting_time_ms;
-    unsigned display_on_time_ms;
-} app_stats_t;
+/* Set the clock over SNTP (NTP_SERVER in .env) while connected */
+esp_err_t app_time_sync_start(void);
+/* Wait up to timeout_ms for the time to be set, then stop SNTP */
+void app_time_sync_finish(int timeout_ms);
 
 void app_update_stats(const app_stats_t *stats);
 void app_get_stats(app_stats_t *stats);
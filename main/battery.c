@@ -0,0 +1,30 @@
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "sdkconfig.h"
+#include "battery.h"
+#include "adc.h"
+
+#if CONFIG_APP_BATTERY_SENSE
+
+#define BATTERY_SAMPLES 8
+
+static const char *TAG = "battery";
+
+esp_err_t app_battery_read_mv(int *out_mv)
+{
+    int mv;
+    ESP_RETURN_ON_ERROR(app_adc_read_mv(CONFIG_APP_BATTERY_ADC_CHANNEL, BATTERY_SAMPLES, &mv), TAG, "Failed to read battery");
+    *out_mv = mv * CONFIG_APP_BATTERY_DIVIDER;
+    ESP_LOGI(TAG, "Battery %d mV", *out_mv);
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t app_battery_read_mv(int *out_mv)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
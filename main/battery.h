@@ -0,0 +1,21 @@
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Read the battery voltage
+ *
+ * On the LilyGo T5 4.7" the voltage divider is only supplied while the panel is powered on.
+ *
+ * @param[out] out_mv  Battery voltage in mV
+ * @return ESP_ERR_NOT_SUPPORTED if battery measurement is disabled in menuconfig
+ */
+esp_err_t app_battery_read_mv(int *out_mv);
+
+#ifdef __cplusplus
+}
+#endif
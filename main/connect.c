@@ -7,6 +7,7 @@
 #include "esp_event.h"
 #include "esp_netif.h"
 #include "esp_netif_defaults.h"
+#include "esp_netif_sntp.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "app.h"
@@ -95,6 +96,27 @@ void app_wifi_stop()
     esp_wifi_deinit();
 }
 
+esp_err_t app_time_sync_start(void)
+{
+    const char *server = getenv("NTP_SERVER");
+    if (server == NULL || strlen(server) == 0) {
+        server = "pool.ntp.org";
+    }
+    esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(server);
+    ESP_RETURN_ON_ERROR(esp_netif_sntp_init(&config), TAG, "Failed to start SNTP");
+    return ESP_OK;
+}
+
+void app_time_sync_finish(int timeout_ms)
+{
+    if (esp_netif_sntp_sync_wait(pdMS_TO_TICKS(timeout_ms)) == ESP_OK) {
+        ESP_LOGI(TAG, "Time synchronized");
+    } else {
+        ESP_LOGW(TAG, "Time not synchronized, keeping the RTC time");
+    }
+    esp_netif_sntp_deinit();
+}
+
 static void event_handler(void *arg, esp_event_base_t event_base,
                           int32_t event_id, void *event_data)
 {
@@ -0,0 +1,249 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "zlib.h"
+#include "epd_driver.h"
+#include "delta_decoder.h"
+#include "row_pipeline.h"
+
+#define DELTA_MAGIC "EPDP"
+#define DELTA_VERSION 1
+#define HEADER_SIZE 16
+
+static const char *TAG = "delta_decoder";
+
+typedef enum {
+    DELTA_HEADER,
+    DELTA_RECT_HEADER,
+    DELTA_RECT_DATA,
+    DELTA_DONE,
+} delta_state_t;
+
+typedef enum {
+    DELTA_OP_REPLACE = 0,
+    DELTA_OP_XOR = 1,
+} delta_op_t;
+
+struct delta_decoder {
+    image_decoder_config_t config;
+    uint32_t base_crc;
+    uint32_t result_crc;
+    esp_err_t error;            // first error, returned from all later calls
+    delta_state_t state;
+    uint8_t header[HEADER_SIZE];    // patch or rectangle header, as it arrives
+    size_t header_len;
+    int rects_total;
+    int rects_left;
+    EpdRect rect;               // rectangle being patched
+    delta_op_t op;
+    uint32_t data_left;         // compressed bytes of the rectangle still to come
+    z_stream zs;
+    bool stream_end;
+    int rows_done;
+    size_t row_bytes;
+    size_t row_len;             // bytes of the current row inflated so far
+    uint8_t row[FB_STRIDE + 1];
+    uint32_t pixels;            // patched so far
+    row_pipeline_stats_t tone;
+    int64_t decode_us;
+};
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+esp_err_t delta_decoder_create(const image_decoder_config_t *config, uint32_t base_crc, delta_decoder_t **out_decoder)
+{
+    delta_decoder_t *dec = calloc(1, sizeof(*dec));
+    ESP_RETURN_ON_FALSE(dec != NULL, ESP_ERR_NO_MEM, TAG, "Failed to allocate decoder");
+    dec->config = *config;
+    dec->base_crc = base_crc;
+    if (inflateInit(&dec->zs) != Z_OK) {
+        free(dec);
+        ESP_LOGE(TAG, "Failed to init zlib");
+        return ESP_ERR_NO_MEM;
+    }
+    *out_decoder = dec;
+    return ESP_OK;
+}
+
+static esp_err_t parse_header(delta_decoder_t *dec)
+{
+    const uint8_t *h = dec->header;
+    ESP_RETURN_ON_FALSE(memcmp(h, DELTA_MAGIC, 4) == 0 && h[4] == DELTA_VERSION,
+                        ESP_ERR_INVALID_RESPONSE, TAG, "Not a version %d patch", DELTA_VERSION);
+    uint32_t base_crc = get_u32(&h[8]);
+    ESP_RETURN_ON_FALSE(base_crc == dec->base_crc, ESP_ERR_INVALID_VERSION, TAG,
+                        "Patch is against frame %08x, the panel shows %08x", (unsigned) base_crc, (unsigned) dec->base_crc);
+    dec->rects_total = get_u16(&h[6]);
+    dec->rects_left = dec->rects_total;
+    dec->result_crc = get_u32(&h[12]);
+    dec->state = dec->rects_left > 0 ? DELTA_RECT_HEADER : DELTA_DONE;
+    return ESP_OK;
+}
+
+static esp_err_t parse_rect_header(delta_decoder_t *dec)
+{
+    const uint8_t *h = dec->header;
+    EpdRect rect = {
+        .x = get_u16(&h[0]),
+        .y = get_u16(&h[2]),
+        .width = get_u16(&h[4]),
+        .height = get_u16(&h[6]),
+    };
+    ESP_RETURN_ON_FALSE(rect.width > 0 && rect.height > 0 &&
+                        rect.x + rect.width <= EPD_WIDTH && rect.y + rect.height <= EPD_HEIGHT,
+                        ESP_ERR_INVALID_SIZE, TAG, "Rectangle %d,%d %dx%d outside of the screen",
+                        rect.x, rect.y, rect.width, rect.height);
+    ESP_RETURN_ON_FALSE(h[8] == DELTA_OP_REPLACE || h[8] == DELTA_OP_XOR,
+                        ESP_ERR_INVALID_RESPONSE, TAG, "Unknown operation %d", h[8]);
+    dec->rect = rect;
+    dec->op = (delta_op_t) h[8];
+    dec->data_left = get_u32(&h[12]);
+    ESP_RETURN_ON_FALSE(dec->data_left > 0, ESP_ERR_INVALID_SIZE, TAG, "Rectangle without data");
+    dec->row_bytes = (rect.width + 1) / 2;
+    dec->row_len = 0;
+    dec->rows_done = 0;
+    dec->stream_end = false;
+    ESP_RETURN_ON_FALSE(inflateReset(&dec->zs) == Z_OK, ESP_FAIL, TAG, "Failed to reset zlib");
+    dec->state = DELTA_RECT_DATA;
+    return ESP_OK;
+}
+
+/* Apply one inflated row of the rectangle to the framebuffer */
+static void apply_row(delta_decoder_t *dec)
+{
+    int y = dec->rect.y + dec->rows_done;
+    uint8_t *line = &dec->config.fb[y * FB_STRIDE];
+    for (int i = 0; i < dec->rect.width; i++) {
+        int value = (dec->row[i / 2] >> (i % 2 ? 4 : 0)) & 0x0F;
+        int x = dec->rect.x + i;
+        int shift = x % 2 ? 4 : 0;
+        uint8_t *p = &line[x / 2];
+        if (dec->op == DELTA_OP_XOR) {
+            value ^= (*p >> shift) & 0x0F;
+        }
+        *p = (*p & ~(0x0F << shift)) | (value << shift);
+    }
+    EpdRect row = { .x = dec->rect.x, .y = y, .width = dec->rect.width, .height = 1 };
+    row_pipeline_count_levels(row, dec->config.fb, &dec->tone);
+    dec->pixels += dec->rect.width;
+}
+
+static esp_err_t inflate_data(delta_decoder_t *dec, const uint8_t *data, size_t len)
+{
+    dec->zs.next_in = (Bytef *) data;
+    dec->zs.avail_in = len;
+    while (dec->zs.avail_in > 0 && !dec->stream_end) {
+        // Once all rows are there, only the end of the stream may follow
+        uint8_t spare;
+        bool rows_left = dec->rows_done < dec->rect.height;
+        dec->zs.next_out = rows_left ? &dec->row[dec->row_len] : &spare;
+        dec->zs.avail_out = rows_left ? dec->row_bytes - dec->row_len : 1;
+        int zret = inflate(&dec->zs, Z_NO_FLUSH);
+        ESP_RETURN_ON_FALSE(zret == Z_OK || zret == Z_STREAM_END, ESP_ERR_INVALID_RESPONSE, TAG, "inflate: %d", zret);
+        ESP_RETURN_ON_FALSE(rows_left || dec->zs.avail_out == 1, ESP_ERR_INVALID_SIZE, TAG, "Too much data for the rectangle");
+        if (rows_left) {
+            dec->row_len = dec->row_bytes - dec->zs.avail_out;
+            if (dec->row_len == dec->row_bytes) {
+                apply_row(dec);
+                dec->rows_done++;
+                dec->row_len = 0;
+            }
+        }
+        dec->stream_end = zret == Z_STREAM_END;
+    }
+    ESP_RETURN_ON_FALSE(dec->zs.avail_in == 0, ESP_ERR_INVALID_SIZE, TAG, "Data after the end of the rectangle");
+    return ESP_OK;
+}
+
+static esp_err_t write_data(delta_decoder_t *dec, const uint8_t *p, size_t len)
+{
+    while (len > 0) {
+        size_t chunk;
+        switch (dec->state) {
+        case DELTA_HEADER:
+        case DELTA_RECT_HEADER:
+            chunk = MIN(len, HEADER_SIZE - dec->header_len);
+            memcpy(&dec->header[dec->header_len], p, chunk);
+            dec->header_len += chunk;
+            if (dec->header_len == HEADER_SIZE) {
+                dec->header_len = 0;
+                if (dec->state == DELTA_HEADER) {
+                    ESP_RETURN_ON_ERROR(parse_header(dec), TAG, "Invalid patch header");
+                } else {
+                    ESP_RETURN_ON_ERROR(parse_rect_header(dec), TAG, "Invalid rectangle header");
+                }
+            }
+            break;
+        case DELTA_RECT_DATA:
+            chunk = MIN(len, dec->data_left);
+            ESP_RETURN_ON_ERROR(inflate_data(dec, p, chunk), TAG, "Invalid rectangle data");
+            dec->data_left -= chunk;
+            if (dec->data_left == 0) {
+                ESP_RETURN_ON_FALSE(dec->stream_end && dec->rows_done == dec->rect.height,
+                                    ESP_ERR_INVALID_SIZE, TAG, "Rectangle data ended early");
+                dec->rects_left--;
+                dec->state = dec->rects_left > 0 ? DELTA_RECT_HEADER : DELTA_DONE;
+            }
+            break;
+        default:
+            ESP_LOGE(TAG, "Data after the end of the patch");
+            return ESP_ERR_INVALID_SIZE;
+        }
+        p += chunk;
+        len -= chunk;
+    }
+    return ESP_OK;
+}
+
+esp_err_t delta_decoder_write(delta_decoder_t *dec, const void *data, size_t len)
+{
+    if (dec->error != ESP_OK) {
+        return dec->error;
+    }
+    int64_t start = esp_timer_get_time();
+    dec->error = write_data(dec, (const uint8_t *) data, len);
+    dec->decode_us += esp_timer_get_time() - start;
+    return dec->error;
+}
+
+esp_err_t delta_decoder_finish(delta_decoder_t *dec, image_decoder_stats_t *out_stats)
+{
+    if (dec->error != ESP_OK) {
+        return dec->error;
+    }
+    ESP_RETURN_ON_FALSE(dec->state == DELTA_DONE, ESP_ERR_INVALID_SIZE, TAG, "Patch data ended early");
+
+    int64_t start = esp_timer_get_time();
+    uint32_t crc = esp_rom_crc32_le(0, dec->config.fb, FB_SIZE);
+    int64_t check_us = esp_timer_get_time() - start;
+    ESP_RETURN_ON_FALSE(crc == dec->result_crc, ESP_ERR_INVALID_CRC, TAG,
+                        "Patched frame is %08x, expected %08x", (unsigned) crc, (unsigned) dec->result_crc);
+    ESP_LOGI(TAG, "Patch: %d rectangles, %u pixels", dec->rects_total, (unsigned) dec->pixels);
+
+    *out_stats = (image_decoder_stats_t) {
+        .decode_us = dec->decode_us + check_us,
+        .finish_wait_us = check_us,
+        .tone = dec->tone,
+    };
+    return ESP_OK;
+}
+
+void delta_decoder_delete(delta_decoder_t *dec)
+{
+    inflateEnd(&dec->zs);
+    free(dec);
+}
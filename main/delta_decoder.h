@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "image_decoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A patch against the frame shown on the panel, sent by the server instead of a full image
+ * when it knows that frame (from the X-Frame-CRC request header). All numbers little endian.
+ *
+ * Header, 16 bytes:
+ *   0  "EPDP"
+ *   4  u8   version, 1
+ *   5  u8   reserved, 0
+ *   6  u16  number of rectangles
+ *   8  u32  CRC of the framebuffer the patch applies to
+ *   12 u32  CRC of the framebuffer after applying it
+ * Then for each rectangle, a 16-byte header:
+ *   0  u16  x, y, width, height, in screen coordinates
+ *   8  u8   operation: 0 replaces the pixels, 1 XORs them with the data
+ *   9  u8   reserved[3], 0
+ *   12 u32  length of the data which follows
+ * and the data: a zlib stream of height rows of (width + 1) / 2 bytes, two 4-bit levels
+ * per byte (0 black, 15 white), the left pixel in the low nibble.
+ *
+ * A full-screen XOR rectangle is a compressed XOR against the base frame.
+ * CRCs are esp_rom_crc32_le(0, fb, size) of the 4bpp framebuffer, as in fb_store.
+ */
+
+typedef struct delta_decoder delta_decoder_t;
+
+/**
+ * @brief Create a patch decoder
+ *
+ * The patch is applied to config->fb as data arrives, in the calling task; config->dst,
+ * scale and task_core are not used.
+ *
+ * @param config  Decoder configuration
+ * @param base_crc  CRC of config->fb; a patch against another frame is rejected
+ */
+esp_err_t delta_decoder_create(const image_decoder_config_t *config, uint32_t base_crc, delta_decoder_t **out_decoder);
+
+/**
+ * @brief Feed the next chunk of patch data
+ *
+ * @return ESP_ERR_INVALID_VERSION if the patch is against another frame.
+ *         After an error, all further calls return the same error.
+ */
+esp_err_t delta_decoder_write(delta_decoder_t *decoder, const void *data, size_t len);
+
+/**
+ * @brief Check that the whole patch was applied and the framebuffer has the expected CRC
+ *
+ * @return ESP_OK if the framebuffer now holds the frame the server sent the patch for
+ */
+esp_err_t delta_decoder_finish(delta_decoder_t *decoder, image_decoder_stats_t *out_stats);
+
+/**
+ * @brief Free the decoder
+ */
+void delta_decoder_delete(delta_decoder_t *decoder);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+#include "dirty_rect.h"
+
+/* Bands separated by fewer unchanged lines than this are merged */
+#define MERGE_GAP 16
+
+/* Grow a to also cover b */
+static void merge_into(EpdRect *a, const EpdRect *b)
+{
+    int x0 = MIN(a->x, b->x);
+    int y0 = MIN(a->y, b->y);
+    int x1 = MAX(a->x + a->width, b->x + b->width);
+    int y1 = MAX(a->y + a->height, b->y + b->height);
+    *a = (EpdRect) {
+        .x = x0, .y = y0, .width = x1 - x0, .height = y1 - y0
+    };
+}
+
+/* Make room in a full list by merging the two adjacent bands with the smallest gap */
+static void merge_closest(EpdRect *rects, int count)
+{
+    int best = 0;
+    int best_gap = INT32_MAX;
+    for (int i = 0; i + 1 < count; i++) {
+        int gap = rects[i + 1].y - (rects[i].y + rects[i].height);
+        if (gap < best_gap) {
+            best_gap = gap;
+            best = i;
+        }
+    }
+    merge_into(&rects[best], &rects[best + 1]);
+    memmove(&rects[best + 1], &rects[best + 2], (count - best - 2) * sizeof(EpdRect));
+}
+
+static inline bool is_gray(uint8_t level)
+{
+    return level != 0 && level != 0xF;
+}
+
+/* Count the changed pixels of one line, between the first and last differing bytes */
+static void count_changes(const uint8_t *a, const uint8_t *b, int first, int last, dirty_stats_t *stats)
+{
+    for (int i = first; i <= last; i++) {
+        uint8_t diff = a[i] ^ b[i];
+        if (diff & 0x0F) {
+            stats->changed_pixels++;
+            stats->changed_to_gray += is_gray(a[i] & 0x0F);
+        }
+        if (diff & 0xF0) {
+            stats->changed_pixels++;
+            stats->changed_to_gray += is_gray(a[i] >> 4);
+        }
+    }
+}
+
+int dirty_rects_find(const uint8_t *fb, const uint8_t *prev, int width, int height,
+                     EpdRect *rects, int max_rects, dirty_stats_t *out_stats)
+{
+    const int stride = width / 2;
+    int count = 0;
+    dirty_stats_t stats = { 0 };
+    for (int y = 0; y < height; y++) {
+        const uint8_t *a = fb + y * stride;
+        const uint8_t *b = prev + y * stride;
+        if (memcmp(a, b, stride) == 0) {
+            continue;
+        }
+        int first = 0;
+        while (a[first] == b[first]) {
+            first++;
+        }
+        int last = stride - 1;
+        while (a[last] == b[last]) {
+            last--;
+        }
+        count_changes(a, b, first, last, &stats);
+        EpdRect line = {
+            .x = first * 2, .y = y, .width = (last - first + 1) * 2, .height = 1
+        };
+
+        if (count > 0 && y - (rects[count - 1].y + rects[count - 1].height) < MERGE_GAP) {
+            merge_into(&rects[count - 1], &line);
+            continue;
+        }
+        if (count == max_rects) {
+            if (count == 1) {
+                merge_into(&rects[0], &line);
+                continue;
+            }
+            merge_closest(rects, count);
+            count--;
+        }
+        rects[count++] = line;
+    }
+    if (out_stats != NULL) {
+        *out_stats = stats;
+    }
+    return count;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include "epd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Summary of the changed pixels
+ */
+typedef struct {
+    uint32_t changed_pixels;    /*!< Pixels whose level differs */
+    uint32_t changed_to_gray;   /*!< ... of which the new level is neither black nor white */
+} dirty_stats_t;
+
+/**
+ * @brief Find the areas where two 4bpp framebuffers differ
+ *
+ * The result is a list of horizontal bands, top to bottom, each as wide as the changes
+ * on its lines. The panel is driven line by line, so two changes side by side are
+ * cheaper to update as one band than as two separate areas; bands which are closer
+ * than a few lines are merged for the same reason.
+ *
+ * @param fb  New framebuffer, unrotated, width / 2 bytes per line
+ * @param prev  Framebuffer currently on the panel, same layout
+ * @param width  Framebuffer width in pixels (even)
+ * @param height  Framebuffer height in pixels
+ * @param rects  Output, in framebuffer coordinates
+ * @param max_rects  Size of rects; if more bands are found, the closest ones are merged
+ * @param[out] out_stats  Counts of changed pixels (optional)
+ * @return number of rectangles written, 0 if the framebuffers are identical
+ */
+int dirty_rects_find(const uint8_t *fb, const uint8_t *prev, int width, int height,
+                     EpdRect *rects, int max_rects, dirty_stats_t *out_stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,110 +1,606 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
+#include <sys/param.h>
 #include "esp_err.h"
 #include "sdkconfig.h"
 #include "esp_log.h"
 #include "esp_check.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 
-#include "png.h"
 #include "epd_driver.h"
 #include "epd_highlevel.h"
 #include "epd_board.h"
 #include "app.h"
+#include "png_decoder.h"
+#include "jpeg_decoder.h"
+#include "delta_decoder.h"
+#include "dlist.h"
+#include "row_pipeline.h"
+#include "panel_refresh.h"
+#include "fb_store.h"
+#include "refresh_policy.h"
+#include "temperature.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "fonts.h"
+#include "widgets.h"
+#include "battery.h"
+#include "log_ring.h"
+#include "text.h"
 
-#ifndef __clang__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wbidi-chars"
-#endif // __clang__
-#include "firasans_20.h"
-#ifndef __clang__
-#pragma GCC diagnostic pop
-#endif // __clang__
 
+/* Display lists are kept in memory until the end of the download, then drawn */
+#define DLIST_MAX_SIZE (64 * 1024)
+/* Panel preparation runs next to the download task; it must not be interrupted in the middle of a frame */
+#define PREPARE_TASK_STACK 3072
+#define PREPARE_TASK_PRIORITY 6
+#define PREPARE_TASK_CORE 1
 
-static void init_epd(void);
-static void png_to_gray(uint8_t *buf, size_t buf_len, uint8_t **output, size_t *output_len);
+static esp_err_t init_epd(void);
+static void free_image(app_display_image_t *image);
+static void restore_area(EpdRect area);
+static void refresh_panel(bool full, refresh_content_t content);
 static int app_display_vprintf(const char *fmt, va_list args);
+static void wait_prepared(void);
+static void add_tone(const row_pipeline_stats_t *tone);
 
 static const char *TAG = "display";
+#if !CONFIG_APP_DISPLAY_SINGLE_FB
 static EpdiyHighlevelState s_hl;
+static fb_store_frame_t s_frame;  // the frame on the panel, as saved in flash; generation 0 if unknown
+#endif
+static uint8_t *s_fb;          // the image to show; front buffer of s_hl unless in single buffer mode
 static int s_temperature;
-static FILE *s_log_file;
-static char *s_log_str;
-static size_t s_log_str_len;
+static bool s_panel_known;     // the back buffer matches what the panel shows
+RTC_DATA_ATTR static uint32_t s_fast_updates;  // partial updates since the last full refresh
+static SemaphoreHandle_t s_prepare_done;
+static bool s_precleared;      // the panel was cleared in advance, the next refresh draws everything
+static int64_t s_prepare_start;
+static int64_t s_prepare_end;
+static int64_t s_prepare_wait_us;  // time the refresh waited for the preparation to finish
+static row_pipeline_stats_t s_tone;  // of the images decoded since the last refresh
+static bool s_frame_changed;   // an image was drawn since the last refresh, not only the widgets
+static widgets_t s_widgets;    // drawn since the last refresh, if s_widgets_drawn
+static bool s_widgets_drawn;
+RTC_DATA_ATTR static widgets_t s_widgets_shown;  // on the panel but not in the saved frame
+RTC_DATA_ATTR static bool s_widgets_shown_valid;
+
+#if CONFIG_APP_DISPLAY_SINGLE_FB
+static const refresh_policy_config_t s_refresh_policy = { 0 };  // every update is a full one
+#else
+static const refresh_policy_config_t s_refresh_policy = {
+    .max_fast_updates = CONFIG_APP_REFRESH_MAX_FAST_UPDATES,
+    .full_changed_percent = CONFIG_APP_REFRESH_FULL_CHANGED_PERCENT,
+};
+#endif
+
+typedef enum {
+    IMAGE_FORMAT_UNKNOWN,
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_JPEG,
+    IMAGE_FORMAT_DELTA,         // a patch against the frame on the panel
+    IMAGE_FORMAT_DLIST,         // drawing operations
+} image_format_t;
+
+static const EpdFont *const s_fonts[] = { &FiraSans_12, &FiraSans_20 };
+
+struct app_display_image {
+    image_format_t format;      // from Content-Type, or detected from the first bytes
+    image_decoder_config_t config;
+    png_decoder_t *png;
+    jpeg_decoder_t *jpeg;
+    delta_decoder_t *delta;
+    FILE *dlist;                // collects the display list
+    char *dlist_data;
+    size_t dlist_len;
+    size_t bytes;
+    bool partial;               // only config.dst is drawn, the rest of the framebuffer is kept
+};
 
 esp_err_t app_display_init(void)
 {
-    init_epd();
-    return ESP_OK;
+    return init_epd();
 }
 
 void app_display_init_log(void)
 {
-    s_log_file = open_memstream(&s_log_str, &s_log_str_len);
     esp_log_set_vprintf(app_display_vprintf);
 }
 
-esp_err_t app_display_png(const uint8_t *png_data, size_t png_len)
+esp_err_t app_display_image_begin(const EpdRect *area, app_display_image_t **out_image)
 {
-    uint8_t *gray_buf;
-    size_t gray_len;
-    png_to_gray((uint8_t *) png_data, png_len, &gray_buf, &gray_len);
-    if (gray_buf == NULL) {
-        return ESP_ERR_NO_MEM;
+    app_display_image_t *image = calloc(1, sizeof(*image));
+    ESP_RETURN_ON_FALSE(image != NULL, ESP_ERR_NO_MEM, TAG, "Failed to allocate image");
+
+    EpdRect dst = {
+        .width = epd_rotated_display_width(),
+        .height = epd_rotated_display_height(),
+    };
+    if (area != NULL) {
+        dst = *area;
+        image->partial = true;
     }
-    int width = epd_rotated_display_width();
-    int height = epd_rotated_display_height();
-    uint8_t *fb = epd_hl_get_framebuffer(&s_hl);
+    image->config = (image_decoder_config_t) {
+        .dst = dst,
+        .scale = row_pipeline_scale_from_str(getenv("IMAGE_SCALING")),
+        .fb = s_fb,
+        // The download task feeding the decoder runs on core 1
+        .task_core = 0,
+    };
+    *out_image = image;
+    return ESP_OK;
+}
 
-    epd_hl_set_all_white(&s_hl);
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            uint8_t pixel = gray_buf[y * width + x];
-            epd_draw_pixel(x, y, pixel, fb);
-        }
+void app_display_image_set_content_type(app_display_image_t *image, const char *content_type)
+{
+    if (strncasecmp(content_type, "image/png", 9) == 0) {
+        image->format = IMAGE_FORMAT_PNG;
+    } else if (strncasecmp(content_type, "image/jpeg", 10) == 0 || strncasecmp(content_type, "image/jpg", 9) == 0) {
+        image->format = IMAGE_FORMAT_JPEG;
+    } else if (strncasecmp(content_type, "application/x-epd-delta", 23) == 0) {
+        image->format = IMAGE_FORMAT_DELTA;
+    } else if (strncasecmp(content_type, "application/x-epd-dlist", 23) == 0) {
+        image->format = IMAGE_FORMAT_DLIST;
+    }
+}
+
+static const char *format_name(image_format_t format)
+{
+    switch (format) {
+    case IMAGE_FORMAT_JPEG:
+        return "JPEG";
+    case IMAGE_FORMAT_DELTA:
+        return "patch";
+    case IMAGE_FORMAT_DLIST:
+        return "display list";
+    default:
+        return "PNG";
+    }
+}
+
+bool app_display_frame_crc(uint32_t *out_crc)
+{
+#if CONFIG_APP_DISPLAY_SINGLE_FB
+    return false;
+#else
+    *out_crc = s_frame.crc;
+    // Widgets updated since the frame was saved make it one the server doesn't know
+    return s_panel_known && s_frame.generation != 0 && !s_widgets_shown_valid;
+#endif
+}
+
+/* Pick the decoder once the first data arrives; files are sniffed if the server didn't say */
+static esp_err_t start_decoder(app_display_image_t *image, const uint8_t *data, size_t len)
+{
+    if (image->format == IMAGE_FORMAT_UNKNOWN) {
+        bool is_jpeg = len >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+        bool is_delta = len >= 4 && memcmp(data, "EPDP", 4) == 0;
+        bool is_dlist = len >= 4 && memcmp(data, DLIST_MAGIC, 4) == 0;
+        image->format = is_jpeg ? IMAGE_FORMAT_JPEG : is_delta ? IMAGE_FORMAT_DELTA :
+                        is_dlist ? IMAGE_FORMAT_DLIST : IMAGE_FORMAT_PNG;
+    }
+    if (image->format == IMAGE_FORMAT_DELTA) {
+        // A patch applies to the whole frame on the panel, which is still in the framebuffer
+        uint32_t crc;
+        ESP_RETURN_ON_FALSE(!image->partial && app_display_frame_crc(&crc), ESP_ERR_NOT_SUPPORTED, TAG,
+                            "No frame to apply the patch to");
+        return delta_decoder_create(&image->config, crc, &image->delta);
+    }
+    if (image->format == IMAGE_FORMAT_DLIST) {
+        // Drawn at the end; the display list sets its own background
+        image->dlist = open_memstream(&image->dlist_data, &image->dlist_len);
+        ESP_RETURN_ON_FALSE(image->dlist != NULL, ESP_ERR_NO_MEM, TAG, "Failed to allocate display list");
+        return ESP_OK;
+    }
+    if (!image->partial) {
+        memset(s_fb, 0xFF, FB_SIZE);
+    }
+    if (image->format == IMAGE_FORMAT_JPEG) {
+        return jpeg_decoder_create(&image->config, &image->jpeg);
+    }
+    return png_decoder_create(&image->config, &image->png);
+}
+
+esp_err_t app_display_image_write(app_display_image_t *image, const void *data, size_t len)
+{
+    if (image->png == NULL && image->jpeg == NULL && image->delta == NULL && image->dlist == NULL) {
+        ESP_RETURN_ON_ERROR(start_decoder(image, data, len), TAG, "Failed to start decoding");
+    }
+    image->bytes += len;
+    if (image->jpeg != NULL) {
+        return jpeg_decoder_write(image->jpeg, data, len);
+    }
+    if (image->delta != NULL) {
+        return delta_decoder_write(image->delta, data, len);
+    }
+    if (image->dlist != NULL) {
+        ESP_RETURN_ON_FALSE(image->bytes <= DLIST_MAX_SIZE, ESP_ERR_INVALID_SIZE, TAG, "Display list too large");
+        return fwrite(data, 1, len, image->dlist) == len ? ESP_OK : ESP_ERR_NO_MEM;
+    }
+    return png_decoder_write(image->png, data, len);
+}
+
+static esp_err_t render_dlist(app_display_image_t *image, image_decoder_stats_t *out_stats)
+{
+    ESP_RETURN_ON_FALSE(fflush(image->dlist) == 0, ESP_ERR_NO_MEM, TAG, "Failed to collect display list");
+    dlist_config_t config = {
+        .area = image->config.dst,
+        .fb = s_fb,
+        .fonts = s_fonts,
+        .font_count = sizeof(s_fonts) / sizeof(s_fonts[0]),
+    };
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = dlist_render((const uint8_t *) image->dlist_data, image->dlist_len, &config, &out_stats->tone);
+    // Drawing only starts once all of it is there
+    out_stats->decode_us = esp_timer_get_time() - start;
+    out_stats->finish_wait_us = out_stats->decode_us;
+    return ret;
+}
+
+esp_err_t app_display_image_end(app_display_image_t *image, app_stats_t *stats)
+{
+    image_decoder_stats_t decode_stats = { 0 };
+    esp_err_t ret = ESP_ERR_INVALID_SIZE;
+    if (image->jpeg != NULL) {
+        ret = jpeg_decoder_finish(image->jpeg, &decode_stats);
+    } else if (image->png != NULL) {
+        ret = png_decoder_finish(image->png, &decode_stats);
+    } else if (image->delta != NULL) {
+        ret = delta_decoder_finish(image->delta, &decode_stats);
+    } else if (image->dlist != NULL) {
+        ret = render_dlist(image, &decode_stats);
+    }
+    const char *format = format_name(image->format);
+    size_t bytes = image->bytes;
+    if (ret != ESP_OK) {
+        app_display_image_abort(image);
+        ESP_LOGE(TAG, "Failed to decode %s", format);
+        return ret;
+    }
+    free_image(image);
+
+    int64_t busy_us = decode_stats.decode_us;
+    int64_t hidden_us = MAX(busy_us - decode_stats.finish_wait_us, 0);
+    ESP_LOGI(TAG, "Decode: %s, %u bytes, %d ms, %d ms after download (%d ms hidden)",
+             format, (unsigned) bytes, (int) (busy_us / 1000),
+             (int) (decode_stats.finish_wait_us / 1000), (int) (hidden_us / 1000));
+    stats->image_bytes += bytes;
+    stats->decode_time_ms += busy_us / 1000;
+    stats->decode_hidden_ms += hidden_us / 1000;
+
+    add_tone(&decode_stats.tone);
+    s_frame_changed = true;
+    return ESP_OK;
+}
+
+void app_display_widgets(const EpdRect *area, time_t updated, bool stale)
+{
+    int battery_mv = 0;
+#if CONFIG_APP_BATTERY_SENSE
+    // The battery divider is supplied by the panel power rail; the refresh which follows
+    // powers the panel on anyway. Not while it's being cleared in the background.
+    wait_prepared();
+    epd_poweron();
+    if (app_battery_read_mv(&battery_mv) != ESP_OK) {
+        battery_mv = 0;
+    }
+#endif
+    widgets_format(&s_widgets, *area, time(NULL), updated, stale, battery_mv);
+    row_pipeline_stats_t tone;
+    widgets_draw(&s_widgets, s_fb, &tone);
+    add_tone(&tone);
+    s_widgets_drawn = true;
+}
+
+bool app_display_frame_known(void)
+{
+    return s_panel_known;
+}
+
+void app_display_refresh(app_stats_t *stats)
+{
+    refresh_content_t content = refresh_policy_classify(s_tone.histogram, s_tone.transitions);
+    s_tone = (row_pipeline_stats_t) {
+        0
+    };
+
+    int64_t start = esp_timer_get_time();
+    refresh_panel(false, content);
+    stats->timeline.refresh_start = start;
+    stats->timeline.refresh_end = esp_timer_get_time();
+    stats->display_on_time_ms = (stats->timeline.refresh_end - start) / 1000;
+    stats->timeline.panel_prep_start = s_prepare_start;
+    stats->timeline.panel_prep_end = s_prepare_end;
+    stats->panel_prep_ms = (s_prepare_end - s_prepare_start) / 1000;
+    stats->panel_prep_hidden_ms = MAX(s_prepare_end - s_prepare_start - s_prepare_wait_us, 0) / 1000;
+    stats->temperature = s_temperature;
+    int band = app_temperature_band(s_temperature);
+    stats->refresh_ms_by_band[band] = stats->display_on_time_ms;
+    stats->refreshes_by_band[band] = 1;
+}
+
+static void add_tone(const row_pipeline_stats_t *tone)
+{
+    for (int i = 0; i < 16; i++) {
+        s_tone.histogram[i] += tone->histogram[i];
+    }
+    s_tone.transitions += tone->transitions;
+}
+
+static void free_image(app_display_image_t *image)
+{
+    if (image->png != NULL) {
+        png_decoder_delete(image->png);
+    }
+    if (image->jpeg != NULL) {
+        jpeg_decoder_delete(image->jpeg);
+    }
+    if (image->delta != NULL) {
+        delta_decoder_delete(image->delta);
+    }
+    if (image->dlist != NULL) {
+        fclose(image->dlist);
+        free(image->dlist_data);
+    }
+    free(image);
+}
+
+void app_display_image_abort(app_display_image_t *image)
+{
+    bool started = image->png != NULL || image->jpeg != NULL || image->delta != NULL || image->dlist != NULL;
+    // Patches and display lists draw over the previous frame instead of starting from white
+    bool over_frame = image->delta != NULL || image->dlist != NULL;
+    if ((image->partial || over_frame) && started) {
+        // Don't show a half-decoded region next to the others, or a half-applied patch
+        restore_area(image->config.dst);
     }
+    free_image(image);
+}
+
+static void prepare_task(void *arg)
+{
+    s_prepare_start = esp_timer_get_time();
     epd_poweron();
     epd_clear();
-    epd_hl_update_screen(&s_hl, MODE_GC16, s_temperature);
     epd_poweroff();
-    free(gray_buf);
-    return ESP_OK;
+    s_precleared = true;
+    s_prepare_end = esp_timer_get_time();
+    xSemaphoreGive(s_prepare_done);
+    vTaskDelete(NULL);
+}
+
+void app_display_prepare(void)
+{
+    // If the next refresh is certainly a full one, the panel can be cleared while the image downloads
+    if (s_panel_known && s_fast_updates < s_refresh_policy.max_fast_updates) {
+        return;
+    }
+    s_prepare_done = xSemaphoreCreateBinary();
+    if (s_prepare_done == NULL ||
+            xTaskCreatePinnedToCore(&prepare_task, "epd_prepare", PREPARE_TASK_STACK, NULL,
+                                    PREPARE_TASK_PRIORITY, NULL, PREPARE_TASK_CORE) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to start panel preparation, clearing at refresh time");
+        if (s_prepare_done != NULL) {
+            vSemaphoreDelete(s_prepare_done);
+            s_prepare_done = NULL;
+        }
+    }
+}
+
+static void wait_prepared(void)
+{
+    if (s_prepare_done == NULL) {
+        return;
+    }
+    int64_t start = esp_timer_get_time();
+    xSemaphoreTake(s_prepare_done, portMAX_DELAY);
+    s_prepare_wait_us = esp_timer_get_time() - start;
+    vSemaphoreDelete(s_prepare_done);
+    s_prepare_done = NULL;
 }
 
 void app_display_poweroff(void)
 {
+    wait_prepared();
+    epd_poweroff();
+}
+
+#if CONFIG_APP_DISPLAY_SINGLE_FB
+/* Without the back buffer, nothing is known about the panel and only full refreshes are done */
+static void save_panel(void)
+{
+}
+
+static void restore_panel(void)
+{
+}
+
+static const uint8_t *panel_frame(void)
+{
+    return NULL;
+}
+
+/* Always a full refresh */
+static void run_refresh(const panel_refresh_plan_t *plan)
+{
+    epd_poweron();
+    if (!s_precleared) {
+        epd_clear();
+    }
+    epd_draw_base(epd_full_screen(), s_fb, epd_full_screen(), MODE_PACKING_2PPB | PREVIOUSLY_WHITE | plan->epd_mode,
+                  s_temperature, NULL, EPD_BUILTIN_WAVEFORM);
     epd_poweroff();
 }
 
-static void init_epd(void)
+static void restore_area(EpdRect area)
+{
+    epd_fill_rect(area, 0xFF, s_fb);
+}
+#else
+/* Remember what's on the panel for the next wake-up */
+static void save_panel(void)
+{
+    int64_t start = esp_timer_get_time();
+    if (fb_store_save(s_hl.back_fb, FB_SIZE, &s_frame) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save the framebuffer, the next update will be a full one");
+        return;
+    }
+    ESP_LOGI(TAG, "Saved frame %u in %d ms", (unsigned) s_frame.generation, (int) ((esp_timer_get_time() - start) / 1000));
+}
+
+/* The panel keeps its image through deep sleep; if the saved copy is intact, start from it */
+static void restore_panel(void)
+{
+    if (fb_store_load(s_hl.back_fb, FB_SIZE, &s_frame) != ESP_OK) {
+        return;
+    }
+    if (s_widgets_shown_valid) {
+        // Updated without saving the frame
+        widgets_draw(&s_widgets_shown, s_hl.back_fb, NULL);
+    }
+    memcpy(s_hl.front_fb, s_hl.back_fb, FB_SIZE);
+    s_panel_known = true;
+    ESP_LOGI(TAG, "Restored frame %u (CRC %08x)", (unsigned) s_frame.generation, (unsigned) s_frame.crc);
+}
+
+/* What the panel shows, if it's known */
+static const uint8_t *panel_frame(void)
+{
+    return s_panel_known ? s_hl.back_fb : NULL;
+}
+
+static void run_refresh(const panel_refresh_plan_t *plan)
+{
+    panel_refresh_run(&s_hl, plan, s_temperature, s_precleared);
+    if (plan->decision.mode == REFRESH_FULL) {
+        s_panel_known = true;
+    }
+}
+
+/* Put back what the panel shows */
+static void restore_area(EpdRect area)
+{
+    for (int y = area.y; y < area.y + area.height; y++) {
+        for (int x = area.x; x < area.x + area.width; x++) {
+            int shift = x % 2 ? 4 : 0;
+            uint8_t *front = &s_hl.front_fb[y * FB_STRIDE + x / 2];
+            uint8_t back = s_hl.back_fb[y * FB_STRIDE + x / 2];
+            *front = (*front & ~(0x0F << shift)) | (back & (0x0F << shift));
+        }
+    }
+}
+#endif // CONFIG_APP_DISPLAY_SINGLE_FB
+
+/*
+ * Show the front buffer. If the panel content is known, the refresh policy usually
+ * updates only the areas which changed, without flashing the panel. Otherwise, or
+ * when ghosting has to be cleaned up (or if asked to), the panel is cleared and the
+ * whole image is drawn. The waveform follows the content: DU for black and white,
+ * GC16 for photographs, GL16 for the rest.
+ */
+static void refresh_panel(bool full, refresh_content_t content)
+{
+    wait_prepared();
+    // After the background clear the panel is white, so everything has to be drawn
+    const uint8_t *panel = full || s_precleared ? NULL : panel_frame();
+    panel_refresh_plan_t plan;
+    panel_refresh_plan(&s_refresh_policy, s_fb, panel, s_fast_updates, content, &plan);
+    refresh_mode_t mode = plan.decision.mode;
+    ESP_LOGI(TAG, "Refresh: %s %s at %d C (%s, %u pixels changed, %u to gray, %u partial updates before)",
+             refresh_mode_name(mode), refresh_waveform_name(plan.decision.waveform), s_temperature,
+             refresh_content_name(content),
+             (unsigned) plan.changes.changed_pixels, (unsigned) plan.changes.changed_to_gray, (unsigned) s_fast_updates);
+
+    if (mode == REFRESH_SKIP) {
+        s_frame_changed = false;
+        s_widgets_drawn = false;
+        return;
+    }
+    run_refresh(&plan);
+    s_precleared = false;
+    if (mode == REFRESH_FULL) {
+        s_fast_updates = 0;
+    } else {
+        int lines = 0;
+        for (int i = 0; i < plan.area_count; i++) {
+            lines += plan.areas[i].height;
+        }
+        s_fast_updates++;
+        ESP_LOGI(TAG, "Partial refresh: %d areas, %d lines", plan.area_count, lines);
+    }
+    if (mode == REFRESH_PARTIAL && s_widgets_drawn && !s_frame_changed) {
+        // Saving every clock update would wear out the flash; the saved frame plus
+        // the widgets in RTC memory give what the panel shows
+        s_widgets_shown = s_widgets;
+        s_widgets_shown_valid = true;
+    } else {
+        save_panel();
+        s_widgets_shown_valid = false;
+    }
+    s_frame_changed = false;
+    s_widgets_drawn = false;
+}
+
+static esp_err_t init_epd(void)
 {
     epd_init(EPD_LUT_1K);
+#if CONFIG_APP_DISPLAY_SINGLE_FB
+    s_fb = heap_caps_malloc(FB_SIZE, MALLOC_CAP_SPIRAM);
+    ESP_RETURN_ON_FALSE(s_fb != NULL, ESP_ERR_NO_MEM, TAG, "Failed to allocate the framebuffer");
+    memset(s_fb, 0xFF, FB_SIZE);
+#else
     s_hl = epd_hl_init(EPD_BUILTIN_WAVEFORM);
+    s_fb = epd_hl_get_framebuffer(&s_hl);
+#endif
     epd_set_rotation(EPD_ROT_LANDSCAPE);
+    s_temperature = app_temperature_read();
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = fonts_init();
+    if (err != ESP_OK) {
+        // Images are still shown
+        ESP_LOGW(TAG, "No fonts (%s), text isn't drawn", esp_err_to_name(err));
+    } else {
+        // With CONFIG_APP_FONTS_PARTITION, mapping and checking the font pack
+        ESP_LOGI(TAG, "Fonts ready in %d us", (int) (esp_timer_get_time() - start));
+    }
+    restore_panel();
+    return ESP_OK;
 }
 
 static int app_display_vprintf(const char *fmt, va_list args)
 {
-    // print to console
-    int res = vprintf(fmt, args);
+    // Both consume the arguments
+    va_list ring_args;
+    va_copy(ring_args, args);
+    log_ring_vappend(fmt, ring_args);
+    va_end(ring_args);
 
-    // print to log file
-    vfprintf(s_log_file, fmt, args);
-
-    return res;
+    return vprintf(fmt, args);
 }
 
 void app_display_show_log(void)
 {
-    uint8_t *fb = epd_hl_get_framebuffer(&s_hl);
+    uint8_t *fb = s_fb;
+    if (fb == NULL) {
+        return;
+    }
+    char *log = malloc(LOG_RING_TEXT_SIZE);
+    if (log == NULL) {
+        return;
+    }
+    log_ring_copy(log, LOG_RING_TEXT_SIZE);
+
     int width = epd_rotated_display_width();
     int height = epd_rotated_display_height();
-    fflush(s_log_file);
-    epd_poweron();
-    epd_clear();
-    epd_hl_set_all_white(&s_hl);
+    memset(fb, 0xFF, FB_SIZE);
+    s_frame_changed = true;
     EpdRect border_rect = {
         .x = 20,
         .y = 20,
@@ -113,57 +609,32 @@ void app_display_show_log(void)
     };
     epd_draw_rect(border_rect, 0, fb);
 
-    // Print lines from s_log_str to screen, using strsep
-    char *line = s_log_str;
+    // The most recent lines which fit on the screen
+    int max_lines = (height - 50 - 60) / MAX(FiraSans_20.advance_y, 1) + 1;  // no fonts: advance_y is 0
+    int lines = 0;
+    for (const char *p = log; *p != '\0'; p++) {
+        // Ends of the non-empty lines; the empty ones aren't drawn
+        lines += *p != '\n' && (p[1] == '\n' || p[1] == '\0');
+    }
+    int skip = MAX(lines - max_lines, 0);
+
+    EpdFontProperties props = epd_font_properties_default();
+    char *line = log;
     char *next_line = NULL;
     int last_y = 60;
     while ((next_line = strsep(&line, "\n")) != NULL) {
-        if (strlen(next_line) == 0) {
+        if (strlen(next_line) == 0 || skip-- > 0) {
             continue;
         }
         int cursor_x = 50;
         int cursor_y = last_y;
-        epd_write_default(&FiraSans_20,
-                          next_line,
-                          &cursor_x, &cursor_y, fb);
+        text_write(&FiraSans_20, next_line, &cursor_x, &cursor_y, fb, &props);
         last_y = cursor_y;
         if (cursor_y >= height - 50) {
             break;
         }
     }
+    free(log);
 
-
-    epd_hl_update_screen(&s_hl, MODE_GC16, s_temperature);
-    epd_poweroff();
-}
-
-static void png_to_gray(uint8_t *buf, size_t buf_len, uint8_t **output, size_t *output_len)
-{
-    png_image image;
-    memset(&image, 0, (sizeof image));
-    image.version = PNG_IMAGE_VERSION;
-
-    if (png_image_begin_read_from_memory(&image, buf, buf_len)) {
-        png_bytep buffer;
-        image.format = PNG_FORMAT_GRAY;
-        int stride = PNG_IMAGE_ROW_STRIDE(image);
-        int buf_size = PNG_IMAGE_SIZE(image);
-
-        ESP_LOGD(TAG, "PNG size: %dx%d buf_size=%d stride=%d", image.width, image.height, buf_size, stride);
-        buffer = malloc(buf_size);
-
-        if (buffer != NULL &&
-                png_image_finish_read(&image, NULL, buffer, stride, NULL)) {
-            *output = buffer;
-            *output_len = PNG_IMAGE_SIZE(image);
-        } else {
-            if (buffer == NULL) {
-                png_image_free(&image);
-            } else {
-                free(buffer);
-            }
-            *output = NULL;
-            *output_len = 0;
-        }
-    }
+    refresh_panel(true, REFRESH_CONTENT_FEW_LEVELS);
 }
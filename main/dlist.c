@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "dlist.h"
+#include "text.h"
+
+#define DLIST_VERSION 1
+#define HEADER_SIZE 8
+#define BACKGROUND_KEEP 0xFF
+
+typedef enum {
+    OP_RECT = 0x01,
+    OP_FILL = 0x02,
+    OP_LINE = 0x03,
+    OP_TEXT = 0x04,
+    OP_BITMAP = 0x05,
+} dlist_op_t;
+
+static const char *TAG = "dlist";
+
+/* Reads arguments of the current operation; running out of data sets ok to false */
+typedef struct {
+    const uint8_t *p;
+    size_t left;
+    bool ok;
+} reader_t;
+
+static const uint8_t *take(reader_t *r, size_t len)
+{
+    if (!r->ok || r->left < len) {
+        r->ok = false;
+        return NULL;
+    }
+    const uint8_t *p = r->p;
+    r->p += len;
+    r->left -= len;
+    return p;
+}
+
+static uint8_t get_u8(reader_t *r)
+{
+    const uint8_t *p = take(r, 1);
+    return p != NULL ? p[0] : 0;
+}
+
+static uint16_t get_u16(reader_t *r)
+{
+    const uint8_t *p = take(r, 2);
+    return p != NULL ? p[0] | (p[1] << 8) : 0;
+}
+
+static int get_i16(reader_t *r)
+{
+    return (int16_t) get_u16(r);
+}
+
+static uint8_t get_level(reader_t *r)
+{
+    uint8_t level = get_u8(r);
+    r->ok = r->ok && level < 16;
+    return level;
+}
+
+static EpdRect clip(EpdRect rect, EpdRect to)
+{
+    int x0 = MAX(rect.x, to.x);
+    int y0 = MAX(rect.y, to.y);
+    int x1 = MIN(rect.x + rect.width, to.x + to.width);
+    int y1 = MIN(rect.y + rect.height, to.y + to.height);
+    return (EpdRect) {
+        .x = x0, .y = y0, .width = MAX(x1 - x0, 0), .height = MAX(y1 - y0, 0)
+    };
+}
+
+static bool inside(int x, int y, EpdRect area)
+{
+    return x >= area.x && x < area.x + area.width && y >= area.y && y < area.y + area.height;
+}
+
+/* Also on the right and bottom edges, where right-aligned text ends and a baseline may lie */
+static bool anchored(int x, int y, EpdRect area)
+{
+    return x >= area.x && x <= area.x + area.width && y >= area.y && y <= area.y + area.height;
+}
+
+static void fill_clipped(EpdRect rect, EpdRect area, uint8_t level, uint8_t *fb)
+{
+    rect = clip(rect, area);
+    if (rect.width > 0 && rect.height > 0) {
+        epd_fill_rect(rect, fb_level_color(level), fb);
+    }
+}
+
+static esp_err_t draw_rect(reader_t *r, const dlist_config_t *config, bool filled)
+{
+    EpdRect rect = {
+        .x = config->area.x + get_i16(r),
+        .y = config->area.y + get_i16(r),
+        .width = get_i16(r),
+        .height = get_i16(r),
+    };
+    uint8_t level = get_level(r);
+    ESP_RETURN_ON_FALSE(r->ok, ESP_ERR_INVALID_RESPONSE, TAG, "Invalid rectangle");
+    if (filled) {
+        fill_clipped(rect, config->area, level, config->fb);
+        return ESP_OK;
+    }
+    // The outline as four 1 pixel wide fills, so that each side is clipped
+    fill_clipped((EpdRect) {
+        rect.x, rect.y, rect.width, 1
+    }, config->area, level, config->fb);
+    fill_clipped((EpdRect) {
+        rect.x, rect.y + rect.height - 1, rect.width, 1
+    }, config->area, level, config->fb);
+    fill_clipped((EpdRect) {
+        rect.x, rect.y, 1, rect.height
+    }, config->area, level, config->fb);
+    fill_clipped((EpdRect) {
+        rect.x + rect.width - 1, rect.y, 1, rect.height
+    }, config->area, level, config->fb);
+    return ESP_OK;
+}
+
+static esp_err_t draw_line(reader_t *r, const dlist_config_t *config)
+{
+    int x0 = config->area.x + get_i16(r);
+    int y0 = config->area.y + get_i16(r);
+    int x1 = config->area.x + get_i16(r);
+    int y1 = config->area.y + get_i16(r);
+    uint8_t level = get_level(r);
+    ESP_RETURN_ON_FALSE(r->ok && inside(x0, y0, config->area) && inside(x1, y1, config->area),
+                        ESP_ERR_INVALID_RESPONSE, TAG, "Invalid line");
+    epd_draw_line(x0, y0, x1, y1, fb_level_color(level), config->fb);
+    return ESP_OK;
+}
+
+static esp_err_t draw_text(reader_t *r, const dlist_config_t *config)
+{
+    int x = config->area.x + get_i16(r);
+    int y = config->area.y + get_i16(r);
+    uint8_t font = get_u8(r);
+    uint8_t level = get_level(r);
+    uint8_t align = get_u8(r);
+    uint8_t length = get_u8(r);
+    const uint8_t *str = take(r, length);
+    ESP_RETURN_ON_FALSE(r->ok && font < config->font_count && align <= 2 && anchored(x, y, config->area),
+                        ESP_ERR_INVALID_RESPONSE, TAG, "Invalid text");
+
+    char text[256];
+    memcpy(text, str, length);
+    text[length] = '\0';
+    EpdFontProperties props = epd_font_properties_default();
+    props.fg_color = level;
+    props.flags = align == 1 ? EPD_DRAW_ALIGN_CENTER : align == 2 ? EPD_DRAW_ALIGN_RIGHT : EPD_DRAW_ALIGN_LEFT;
+    enum EpdDrawError err = text_write(config->fonts[font], text, &x, &y, config->fb, &props);
+    if (err != EPD_DRAW_SUCCESS) {
+        // Missing glyphs are drawn as the fallback glyph; nothing worth failing the update for
+        ESP_LOGW(TAG, "Text \"%s\": error 0x%x", text, err);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t draw_bitmap(reader_t *r, const dlist_config_t *config)
+{
+    EpdRect rect = {
+        .x = config->area.x + get_i16(r),
+        .y = config->area.y + get_i16(r),
+        .width = get_u16(r),
+        .height = get_u16(r),
+    };
+    int row_bytes = (rect.width + 1) / 2;
+    const uint8_t *data = take(r, (size_t) row_bytes * rect.height);
+    ESP_RETURN_ON_FALSE(r->ok, ESP_ERR_INVALID_RESPONSE, TAG, "Invalid bitmap");
+
+    EpdRect visible = clip(rect, config->area);
+    for (int y = visible.y; y < visible.y + visible.height; y++) {
+        const uint8_t *row = &data[(y - rect.y) * row_bytes];
+        for (int x = visible.x; x < visible.x + visible.width; x++) {
+            int i = x - rect.x;
+            uint8_t level = (row[i / 2] >> (i % 2 ? 4 : 0)) & 0x0F;
+            epd_draw_pixel(x, y, fb_level_color(level), config->fb);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t dlist_render(const uint8_t *data, size_t len, const dlist_config_t *config, row_pipeline_stats_t *out_tone)
+{
+    ESP_RETURN_ON_FALSE(len >= HEADER_SIZE && memcmp(data, DLIST_MAGIC, 4) == 0 && data[4] == DLIST_VERSION,
+                        ESP_ERR_INVALID_RESPONSE, TAG, "Not a version %d display list", DLIST_VERSION);
+    uint8_t background = data[5];
+    if (background != BACKGROUND_KEEP) {
+        ESP_RETURN_ON_FALSE(background < 16, ESP_ERR_INVALID_RESPONSE, TAG, "Invalid background level");
+        epd_fill_rect(config->area, fb_level_color(background), config->fb);
+    }
+
+    esp_err_t ret = ESP_OK;
+    int ops = 0;
+    reader_t r = {
+        .p = data + HEADER_SIZE,
+        .left = len - HEADER_SIZE,
+        .ok = true,
+    };
+    while (r.left > 0 && ret == ESP_OK) {
+        size_t offset = len - r.left;
+        uint8_t op = get_u8(&r);
+        switch (op) {
+        case OP_RECT:
+        case OP_FILL:
+            ret = draw_rect(&r, config, op == OP_FILL);
+            break;
+        case OP_LINE:
+            ret = draw_line(&r, config);
+            break;
+        case OP_TEXT:
+            ret = draw_text(&r, config);
+            break;
+        case OP_BITMAP:
+            ret = draw_bitmap(&r, config);
+            break;
+        default:
+            ESP_LOGE(TAG, "Unknown operation 0x%02x", op);
+            ret = ESP_ERR_INVALID_RESPONSE;
+            break;
+        }
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Display list error at offset %u", (unsigned) offset);
+        }
+        ops++;
+    }
+    ESP_LOGI(TAG, "%d operations, %u bytes", ops, (unsigned) len);
+    if (out_tone != NULL) {
+        *out_tone = (row_pipeline_stats_t) {
+            0
+        };
+        row_pipeline_count_levels(config->area, config->fb, out_tone);
+    }
+    return ret;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "epd_driver.h"
+#include "row_pipeline.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A display list: drawing operations sent by the server instead of a raster image, for
+ * dashboards made of text, numbers and boxes. All numbers are little endian.
+ *
+ * Header, 8 bytes:
+ *   0  "EPDL"
+ *   4  u8   version, 1
+ *   5  u8   background level the area is filled with first; 0xFF keeps the framebuffer content
+ *   6  u16  reserved, 0
+ * Then operations, each an opcode byte followed by its arguments. Coordinates are i16,
+ * relative to the top left corner of the target area; levels are u8, 0 (black) to 15 (white).
+ *   0x01 rect    x, y, width, height, level           1 pixel outline
+ *   0x02 fill    x, y, width, height, level
+ *   0x03 line    x0, y0, x1, y1, level
+ *   0x04 text    x, y, u8 font, level, u8 align, u8 length, length bytes of UTF-8
+ *                y is the baseline; align 0 left, 1 center, 2 right of x
+ *   0x05 bitmap  x, y, u16 width, u16 height, then height rows of (width + 1) / 2 bytes,
+ *                two 4-bit levels per byte, the left pixel in the low nibble
+ *
+ * Rectangles and bitmaps are clipped to the target area. Lines must lie inside it, and
+ * the x, y of text inside it or on its edges; glyphs which extend past the area aren't clipped.
+ */
+
+#define DLIST_MAGIC "EPDL"
+
+typedef struct {
+    EpdRect area;               /*!< Target area, in rotated display coordinates */
+    uint8_t *fb;                /*!< 4bpp framebuffer to draw into */
+    const EpdFont *const *fonts; /*!< Fonts, by the index used in text operations */
+    int font_count;
+} dlist_config_t;
+
+/**
+ * @brief Draw a display list into the framebuffer
+ *
+ * @param data  The display list, header included
+ * @param len  Its length
+ * @param config  Where to draw
+ * @param[out] out_tone  Levels in the target area after drawing (optional)
+ * @return ESP_ERR_INVALID_RESPONSE if the display list is malformed; the operations
+ *         before the malformed one have been drawn
+ */
+esp_err_t dlist_render(const uint8_t *data, size_t len, const dlist_config_t *config, row_pipeline_stats_t *out_tone);
+
+#ifdef __cplusplus
+}
+#endif
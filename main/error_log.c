@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "sdkconfig.h"
+#include "log_ring.h"
+#include "error_log.h"
+#include "time_util.h"
+
+/* Room for one failure, header included */
+#define RECORD_MAX (CONFIG_APP_ERROR_LOG_SIZE / CONFIG_APP_ERROR_LOG_CYCLES)
+/* Longest header line of a failure in the text */
+#define TITLE_MAX 80
+
+/* Precedes the packed messages of each failure in s_records */
+typedef struct {
+    int64_t when;
+    int32_t error;
+    uint16_t len;               // bytes of packed messages which follow
+} record_header_t;
+
+static const char *TAG = "error_log";
+
+/* Failures one after another, oldest first */
+RTC_DATA_ATTR static uint8_t s_records[CONFIG_APP_ERROR_LOG_SIZE];
+RTC_DATA_ATTR static size_t s_used;
+RTC_DATA_ATTR static int s_count;
+
+static record_header_t read_header(size_t offset)
+{
+    record_header_t header;
+    memcpy(&header, &s_records[offset], sizeof(header));
+    return header;
+}
+
+static void drop_oldest(void)
+{
+    size_t len = sizeof(record_header_t) + read_header(0).len;
+    memmove(s_records, &s_records[len], s_used - len);
+    s_used -= len;
+    s_count--;
+}
+
+void error_log_save(esp_err_t error, time_t when)
+{
+    while (s_count > 0 && (s_count >= CONFIG_APP_ERROR_LOG_CYCLES || s_used + RECORD_MAX > sizeof(s_records))) {
+        drop_oldest();
+    }
+    uint8_t *record = &s_records[s_used];
+    record_header_t header = {
+        .when = when,
+        .error = error,
+        .len = log_ring_pack(record + sizeof(header), RECORD_MAX - sizeof(header)),
+    };
+    memcpy(record, &header, sizeof(header));
+    s_used += sizeof(header) + header.len;
+    s_count++;
+    ESP_LOGI(TAG, "Kept %u bytes of log, %d failed wake-ups in total", (unsigned) header.len, s_count);
+}
+
+int error_log_count(void)
+{
+    return s_count;
+}
+
+char *error_log_text(size_t *out_len)
+{
+    // A failure's packed messages are at most all of the log ring's
+    size_t size = s_count * (TITLE_MAX + LOG_RING_TEXT_SIZE);
+    char *text = malloc(size);
+    if (text == NULL) {
+        return NULL;
+    }
+    size_t len = 0;
+    size_t offset = 0;
+    for (int i = 0; i < s_count; i++) {
+        record_header_t header = read_header(offset);
+        time_t when = header.when;
+        char when_str[32] = "time not set";
+        if (time_is_valid(when)) {
+            struct tm tm;
+            localtime_r(&when, &tm);
+            strftime(when_str, sizeof(when_str), "%Y-%m-%d %H:%M:%S", &tm);
+        }
+        int title_len = snprintf(&text[len], TITLE_MAX, "=== Failed at %s: %s\n", when_str, esp_err_to_name(header.error));
+        len += MIN(title_len, TITLE_MAX - 1);
+        offset += sizeof(header);
+        len += log_ring_format_packed(&s_records[offset], header.len, &text[len], size - len);
+        offset += header.len;
+    }
+    *out_len = len;
+    return text;
+}
+
+void error_log_clear(void)
+{
+    s_used = 0;
+    s_count = 0;
+}
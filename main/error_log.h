@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Logs of the last failed wake-ups, kept in RTC memory through deep sleep until a later
+ * wake-up with a working connection uploads them. Each failure keeps the most recent log
+ * messages, unformatted, as packed by log_ring_pack; the oldest failure is dropped to make
+ * room for a new one.
+ */
+
+/**
+ * @brief Keep the log of this wake-up, which failed with error
+ */
+void error_log_save(esp_err_t error, time_t when);
+
+/**
+ * @brief Number of failed wake-ups kept
+ */
+int error_log_count(void);
+
+/**
+ * @brief Format the kept logs, oldest first, each after a line with its time and error
+ *
+ * @param[out] out_len  Length of the text
+ * @return The text, to be freed by the caller; NULL if out of memory
+ */
+char *error_log_text(size_t *out_len);
+
+/**
+ * @brief Forget the kept logs, once they are uploaded
+ */
+void error_log_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,135 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "fb_store.h"
+
+#define FB_STORE_LABEL "fbstore"
+#define FB_STORE_MAGIC 0x46425331   // "FBS1"
+#define SECTOR_SIZE 4096
+#define DATA_OFFSET SECTOR_SIZE
+
+static const char *TAG = "fb_store";
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t size;          // framebuffer size in bytes
+    uint32_t data_crc;
+    uint32_t record_crc;    // of the fields above, catches partially written records
+    uint32_t reserved[3];
+} fb_record_t;
+
+#define RECORDS_PER_SECTOR (SECTOR_SIZE / sizeof(fb_record_t))
+
+_Static_assert(sizeof(fb_record_t) == 32, "record size must divide the sector size");
+
+static uint32_t record_crc(const fb_record_t *record)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *) record, offsetof(fb_record_t, record_crc));
+}
+
+/* Returns the valid record with the highest generation (or NULL), and the first unused slot */
+static const fb_record_t *find_latest(const fb_record_t *records, int *out_next_slot)
+{
+    const fb_record_t *latest = NULL;
+    int slot = 0;
+    for (; slot < (int) RECORDS_PER_SECTOR && records[slot].magic != UINT32_MAX; slot++) {
+        const fb_record_t *r = &records[slot];
+        if (r->magic == FB_STORE_MAGIC && r->record_crc == record_crc(r) &&
+                (latest == NULL || r->generation > latest->generation)) {
+            latest = r;
+        }
+    }
+    *out_next_slot = slot;
+    return latest;
+}
+
+static esp_err_t map_partition(const esp_partition_t **out_part, const uint8_t **out_ptr,
+                               esp_partition_mmap_handle_t *out_handle)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FB_STORE_LABEL);
+    ESP_RETURN_ON_FALSE(part != NULL, ESP_ERR_NOT_FOUND, TAG, "No '%s' partition", FB_STORE_LABEL);
+    ESP_RETURN_ON_ERROR(esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, (const void **) out_ptr, out_handle),
+                        TAG, "Failed to map the partition");
+    *out_part = part;
+    return ESP_OK;
+}
+
+esp_err_t fb_store_load(uint8_t *fb, size_t size, fb_store_frame_t *out_frame)
+{
+    const esp_partition_t *part;
+    const uint8_t *ptr;
+    esp_partition_mmap_handle_t handle;
+    ESP_RETURN_ON_ERROR(map_partition(&part, &ptr, &handle), TAG, "Failed to open the store");
+
+    esp_err_t ret = ESP_OK;
+    int next_slot;
+    const fb_record_t *latest = find_latest((const fb_record_t *) ptr, &next_slot);
+    const uint8_t *data = ptr + DATA_OFFSET;
+    ESP_GOTO_ON_FALSE(latest != NULL && latest->size == size && DATA_OFFSET + size <= part->size,
+                      ESP_ERR_NOT_FOUND, out, TAG, "No saved framebuffer");
+    ESP_GOTO_ON_FALSE(esp_rom_crc32_le(0, data, size) == latest->data_crc,
+                      ESP_ERR_INVALID_CRC, out, TAG, "Saved framebuffer is damaged");
+    memcpy(fb, data, size);
+    *out_frame = (fb_store_frame_t) {
+        .generation = latest->generation,
+        .crc = latest->data_crc,
+    };
+out:
+    esp_partition_munmap(handle);
+    return ret;
+}
+
+esp_err_t fb_store_save(const uint8_t *fb, size_t size, fb_store_frame_t *out_frame)
+{
+    const esp_partition_t *part;
+    const uint8_t *ptr;
+    esp_partition_mmap_handle_t handle;
+    ESP_RETURN_ON_ERROR(map_partition(&part, &ptr, &handle), TAG, "Failed to open the store");
+
+    esp_err_t ret = ESP_OK;
+    int next_slot;
+    const fb_record_t *latest = find_latest((const fb_record_t *) ptr, &next_slot);
+    fb_record_t record = {
+        .magic = FB_STORE_MAGIC,
+        .generation = latest != NULL ? latest->generation + 1 : 1,
+        .size = size,
+        .data_crc = esp_rom_crc32_le(0, fb, size),
+    };
+    record.record_crc = record_crc(&record);
+    ESP_GOTO_ON_FALSE(DATA_OFFSET + size <= part->size, ESP_ERR_INVALID_SIZE, out, TAG, "Partition too small");
+
+    int rewritten = 0;
+    const uint8_t *data = ptr + DATA_OFFSET;
+    for (size_t offset = 0; offset < size; offset += SECTOR_SIZE) {
+        size_t len = MIN(SECTOR_SIZE, size - offset);
+        if (memcmp(data + offset, fb + offset, len) == 0) {
+            continue;
+        }
+        ESP_GOTO_ON_ERROR(esp_partition_erase_range(part, DATA_OFFSET + offset, SECTOR_SIZE), out, TAG, "Failed to erase");
+        ESP_GOTO_ON_ERROR(esp_partition_write(part, DATA_OFFSET + offset, fb + offset, len), out, TAG, "Failed to write");
+        rewritten++;
+    }
+
+    if (next_slot == (int) RECORDS_PER_SECTOR) {
+        ESP_GOTO_ON_ERROR(esp_partition_erase_range(part, 0, SECTOR_SIZE), out, TAG, "Failed to erase records");
+        next_slot = 0;
+    }
+    ESP_GOTO_ON_ERROR(esp_partition_write(part, next_slot * sizeof(record), &record, sizeof(record)), out, TAG, "Failed to write record");
+    ESP_LOGI(TAG, "Saved generation %u, %d sectors rewritten", (unsigned) record.generation, rewritten);
+    if (out_frame != NULL) {
+        *out_frame = (fb_store_frame_t) {
+            .generation = record.generation,
+            .crc = record.data_crc,
+        };
+    }
+out:
+    esp_partition_munmap(handle);
+    return ret;
+}
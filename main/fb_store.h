@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Keeps a copy of the framebuffer shown on the panel in the "fbstore" flash partition,
+ * so that the next wake-up can update the panel differentially.
+ *
+ * Partition layout: one 4 kB sector of 32-byte records, followed by the framebuffer data.
+ * Each save appends a record with an incremented generation and the CRC of the data;
+ * the record sector is only erased when it's full. Only the data sectors which changed
+ * are rewritten. If a save is interrupted, the data no longer matches the CRC of the
+ * latest record, and the next load fails rather than returning a mix of two frames.
+ */
+
+/**
+ * @brief Identifies a saved frame
+ */
+typedef struct {
+    uint32_t generation;    /*!< Incremented on each save */
+    uint32_t crc;           /*!< esp_rom_crc32_le(0, fb, size) of the frame */
+} fb_store_frame_t;
+
+/**
+ * @brief Load the last saved framebuffer
+ *
+ * @param fb  Buffer to copy the framebuffer into
+ * @param size  Framebuffer size; a saved frame of a different size is ignored
+ * @param[out] out_frame  Generation and CRC of the loaded frame
+ * @return ESP_ERR_NOT_FOUND if nothing was saved, ESP_ERR_INVALID_CRC if the data is damaged
+ */
+esp_err_t fb_store_load(uint8_t *fb, size_t size, fb_store_frame_t *out_frame);
+
+/**
+ * @brief Save the framebuffer, rewriting only the flash sectors which differ
+ *
+ * @param fb  Framebuffer
+ * @param size  Framebuffer size
+ * @param[out] out_frame  Generation and CRC of the saved frame (optional)
+ */
+esp_err_t fb_store_save(const uint8_t *fb, size_t size, fb_store_frame_t *out_frame);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "sdkconfig.h"
+#include "epd_driver.h"
+#include "fonts.h"
+
+#define MAX_FONTS 8
+
+/* EpdFont only has a compressed flag, so the encodings are kept here */
+static struct {
+    const EpdFont *font;
+    font_encoding_t encoding;
+} s_encodings[MAX_FONTS];
+static int s_encoding_count;
+
+font_encoding_t fonts_encoding(const EpdFont *font)
+{
+    for (int i = 0; i < s_encoding_count; i++) {
+        if (s_encodings[i].font == font) {
+            return s_encodings[i].encoding;
+        }
+    }
+    return font->compressed ? FONT_ENCODING_ZLIB : FONT_ENCODING_RAW;
+}
+
+void fonts_set_encoding(const EpdFont *font, font_encoding_t encoding)
+{
+    int i = 0;
+    while (i < s_encoding_count && s_encodings[i].font != font) {
+        i++;
+    }
+    if (i == MAX_FONTS) {
+        return;
+    }
+    s_encodings[i].font = font;
+    s_encodings[i].encoding = encoding;
+    s_encoding_count = MAX(s_encoding_count, i + 1);
+}
+
+#if CONFIG_APP_FONTS_PARTITION
+
+#include "esp_partition.h"
+
+#define FONTS_LABEL "fonts"
+#define PACK_MAGIC "EPFP"
+#define PACK_VERSION 2
+#define NAME_SIZE 24
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t font_count;
+    uint32_t size;
+    uint32_t reserved;
+} pack_header_t;
+
+typedef struct {
+    char name[NAME_SIZE];
+    uint32_t glyph_offset;
+    uint32_t glyph_count;
+    uint32_t interval_offset;
+    uint32_t interval_count;
+    uint32_t bitmap_offset;
+    uint8_t encoding;           // font_encoding_t
+    uint8_t reserved;
+    uint16_t advance_y;
+    int16_t ascender;
+    int16_t descender;
+    uint32_t bitmap_size;
+} pack_font_t;
+
+_Static_assert(sizeof(pack_header_t) == 16 && sizeof(pack_font_t) == 56, "font pack layout");
+/* The glyphs and intervals are used in place, so the pack has them as epdiy lays them out */
+_Static_assert(sizeof(EpdGlyph) == 16 && offsetof(EpdGlyph, left) == 4 && offsetof(EpdGlyph, data_offset) == 12,
+               "EpdGlyph layout");
+_Static_assert(sizeof(EpdUnicodeInterval) == 12, "EpdUnicodeInterval layout");
+
+static const char *TAG = "fonts";
+
+EpdFont FiraSans_12;
+EpdFont FiraSans_20;
+
+static const struct {
+    const char *name;
+    EpdFont *font;
+} s_fonts[] = {
+    { "FiraSans_12", &FiraSans_12 },
+    { "FiraSans_20", &FiraSans_20 },
+};
+
+static bool in_pack(uint32_t offset, uint32_t count, size_t item_size, size_t pack_size)
+{
+    return offset % 4 == 0 && offset <= pack_size && count <= (pack_size - offset) / item_size;
+}
+
+/* Point font into the pack, once everything it refers to is known to lie inside the pack */
+static esp_err_t load_font(const uint8_t *pack, size_t size, const char *name, EpdFont *font)
+{
+    const pack_header_t *header = (const pack_header_t *) pack;
+    const pack_font_t *entries = (const pack_font_t *) (pack + sizeof(*header));
+    for (int i = 0; i < header->font_count; i++) {
+        const pack_font_t *entry = &entries[i];
+        if (strncmp(entry->name, name, NAME_SIZE) != 0) {
+            continue;
+        }
+        ESP_RETURN_ON_FALSE(in_pack(entry->glyph_offset, entry->glyph_count, sizeof(EpdGlyph), size) &&
+                            in_pack(entry->interval_offset, entry->interval_count, sizeof(EpdUnicodeInterval), size) &&
+                            in_pack(entry->bitmap_offset, entry->bitmap_size, 1, size),
+                            ESP_ERR_INVALID_SIZE, TAG, "%s: data outside of the pack", name);
+        ESP_RETURN_ON_FALSE(entry->encoding <= FONT_ENCODING_RLE, ESP_ERR_NOT_SUPPORTED, TAG,
+                            "%s: unknown encoding %d", name, entry->encoding);
+        const EpdGlyph *glyphs = (const EpdGlyph *) (pack + entry->glyph_offset);
+        const EpdUnicodeInterval *intervals = (const EpdUnicodeInterval *) (pack + entry->interval_offset);
+        for (uint32_t j = 0; j < entry->interval_count; j++) {
+            const EpdUnicodeInterval *interval = &intervals[j];
+            // Compared without sums, which a crafted pack could make wrap around
+            ESP_RETURN_ON_FALSE(interval->last >= interval->first && interval->offset < entry->glyph_count &&
+                                interval->last - interval->first < entry->glyph_count - interval->offset,
+                                ESP_ERR_INVALID_SIZE, TAG, "%s: invalid interval", name);
+        }
+        for (uint32_t j = 0; j < entry->glyph_count; j++) {
+            const EpdGlyph *glyph = &glyphs[j];
+            // Raw bitmaps are read without a size
+            uint32_t min_size = entry->encoding == FONT_ENCODING_RAW ? (glyph->width + 1) / 2 * glyph->height : 0;
+            ESP_RETURN_ON_FALSE(glyph->data_offset <= entry->bitmap_size &&
+                                glyph->compressed_size <= entry->bitmap_size - glyph->data_offset &&
+                                glyph->compressed_size >= min_size,
+                                ESP_ERR_INVALID_SIZE, TAG, "%s: glyph %" PRIu32 " data outside of the bitmaps", name, j);
+        }
+        *font = (EpdFont) {
+            .bitmap = pack + entry->bitmap_offset,
+            .glyph = glyphs,
+            .intervals = intervals,
+            .interval_count = entry->interval_count,
+            .compressed = entry->encoding != FONT_ENCODING_RAW,
+            .advance_y = entry->advance_y,
+            .ascender = entry->ascender,
+            .descender = entry->descender,
+        };
+        fonts_set_encoding(font, entry->encoding);
+        return ESP_OK;
+    }
+    ESP_LOGE(TAG, "%s not in the font pack", name);
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t fonts_init(void)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FONTS_LABEL);
+    ESP_RETURN_ON_FALSE(part != NULL, ESP_ERR_NOT_FOUND, TAG, "No '%s' partition", FONTS_LABEL);
+    const uint8_t *pack;
+    esp_partition_mmap_handle_t handle;
+    // Mapped for as long as the app runs; the glyphs are read through the flash cache
+    ESP_RETURN_ON_ERROR(esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, (const void **) &pack, &handle),
+                        TAG, "Failed to map the partition");
+    esp_err_t ret = ESP_OK;
+    const pack_header_t *header = (const pack_header_t *) pack;
+    ESP_GOTO_ON_FALSE(memcmp(header->magic, PACK_MAGIC, 4) == 0 && header->version == PACK_VERSION &&
+                      header->size >= sizeof(*header) && header->size <= part->size &&
+                      header->font_count <= (header->size - sizeof(*header)) / sizeof(pack_font_t),
+                      ESP_ERR_INVALID_VERSION, err, TAG, "No version %d font pack in the '%s' partition", PACK_VERSION, FONTS_LABEL);
+    // The fonts which did load stay usable if another one fails
+    for (int i = 0; i < sizeof(s_fonts) / sizeof(s_fonts[0]); i++) {
+        esp_err_t err = load_font(pack, header->size, s_fonts[i].name, s_fonts[i].font);
+        ret = ret == ESP_OK ? err : ret;
+    }
+    return ret;
+
+err:
+    esp_partition_munmap(handle);
+    return ret;
+}
+
+#else
+
+/*
+ * The font headers define the font data, so they are included in this file only. They are
+ * generated at build time from firasans_*.h with the code points of
+ * CONFIG_APP_FONT_CODE_POINTS and the configured encodings, see tools/font_subset.py.
+ */
+#include "firasans_12_subset.h"
+#include "firasans_20_subset.h"
+
+esp_err_t fonts_init(void)
+{
+    fonts_set_encoding(&FiraSans_12, FiraSans_12_ENCODING);
+    fonts_set_encoding(&FiraSans_20, FiraSans_20_ENCODING);
+    return ESP_OK;
+}
+
+#endif // CONFIG_APP_FONTS_PARTITION
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "epd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * With CONFIG_APP_FONTS_PARTITION, the fonts are read from a font pack in the "fonts"
+ * partition (written by tools/font_pack.py), mapped into memory and used in place.
+ * Otherwise they are compiled into the app. All numbers are little endian.
+ *
+ * Header, 16 bytes:
+ *   0   "EPFP"
+ *   4   u16  version, 2 (in version 1, byte 44 of an entry was a compressed flag)
+ *   6   u16  number of fonts
+ *   8   u32  size of the pack
+ *   12  u32  reserved
+ * Then an entry for each font, 56 bytes:
+ *   0   char[24]  name, NUL terminated, like "FiraSans_20"
+ *   24  u32  offset of the glyphs
+ *   28  u32  number of glyphs
+ *   32  u32  offset of the code point intervals
+ *   36  u32  number of intervals
+ *   40  u32  offset of the bitmaps
+ *   44  u8   encoding of the bitmaps, font_encoding_t
+ *   45  u8   reserved
+ *   46  u16  line height
+ *   48  i16  ascender
+ *   50  i16  descender
+ *   52  u32  size of the bitmaps
+ * Offsets are from the start of the pack, and multiples of 4. The glyphs and intervals are
+ * laid out like epdiy's EpdGlyph and EpdUnicodeInterval on the ESP32:
+ *   glyph, 16 bytes: u8 width, u8 height, u8 advance_x, u8 reserved, i16 left, i16 top,
+ *                    u32 size of the bitmap, u32 offset of the bitmap in the font's bitmaps
+ *   interval, 12 bytes: u32 first code point, u32 last code point, u32 index of the glyph
+ *                       of the first code point
+ *
+ * The glyph bitmaps are encoded as chosen per font at build time (see tools/font_subset.py):
+ *   raw   4 bits per pixel, rows of (width + 1) / 2 bytes, the left pixel in the low nibble
+ *   zlib  the raw bitmap deflated, as epdiy's fontconvert.py writes it
+ *   RLE   one byte per run of pixels of the same level: (byte >> 4) + 1 pixels of level
+ *         byte & 0x0F, left to right and top to bottom; runs continue across rows
+ * epdiy's own text functions only draw raw and zlib fonts, text_write draws all of them.
+ */
+
+typedef enum {
+    FONT_ENCODING_RAW = 0,
+    FONT_ENCODING_ZLIB = 1,
+    FONT_ENCODING_RLE = 2,
+} font_encoding_t;
+
+#if CONFIG_APP_FONTS_PARTITION
+/* Filled in by fonts_init; without a valid font pack, they have no glyphs */
+extern EpdFont FiraSans_12;
+extern EpdFont FiraSans_20;
+#else
+extern const EpdFont FiraSans_12;
+extern const EpdFont FiraSans_20;
+#endif
+
+/**
+ * @brief Map the font pack, if the fonts aren't compiled in
+ *
+ * @return ESP_ERR_NOT_FOUND if there is no fonts partition or a font is missing from it,
+ *         ESP_ERR_INVALID_VERSION if the partition holds no valid font pack
+ */
+esp_err_t fonts_init(void);
+
+/**
+ * @brief Encoding of the glyph bitmaps of a font
+ *
+ * EpdFont only says whether a font is compressed, so the encodings of the app's fonts are
+ * kept by fonts_init. Other fonts are taken as zlib if compressed, raw otherwise.
+ */
+font_encoding_t fonts_encoding(const EpdFont *font);
+
+/**
+ * @brief Set the encoding of the glyph bitmaps of a font which fonts_init doesn't know about
+ */
+void fonts_set_encoding(const EpdFont *font, font_encoding_t encoding);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include "epd_driver.h"
+#include "row_pipeline.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Configuration shared by the image decoders
+ */
+typedef struct {
+    EpdRect dst;                /*!< Target rectangle, in rotated display coordinates */
+    row_pipeline_scale_t scale; /*!< How to fit the image into dst */
+    uint8_t *fb;                /*!< 4bpp framebuffer to draw into */
+    int task_core;              /*!< Core on which the decoder's own task runs */
+} image_decoder_config_t;
+
+/**
+ * @brief Timing of one decode
+ */
+typedef struct {
+    int64_t decode_us;          /*!< CPU time spent decoding, summed over all tasks involved; excludes waiting for data */
+    int64_t finish_wait_us;     /*!< Time the finish call waited for the decoder to catch up with the input */
+    row_pipeline_stats_t tone;  /*!< Levels written into the framebuffer */
+} image_decoder_stats_t;
+
+#ifdef __cplusplus
+}
+#endif
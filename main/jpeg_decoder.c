@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+#include "rom/tjpgd.h"
+#include "jpeg_decoder.h"
+#include "row_pipeline.h"
+#include "tone.h"
+
+#define INPUT_BUFFER_SIZE 4096
+/* Work area needed by the ROM decoder for baseline images */
+#define WORK_BUFFER_SIZE 3100
+#define DECODE_TASK_STACK 4096
+#define DECODE_TASK_PRIORITY 2
+/* How often the decoder task checks for the end of the input while the ringbuffer is empty */
+#define INPUT_POLL_MS 10
+
+static const char *TAG = "jpeg_decoder";
+
+struct jpeg_decoder {
+    image_decoder_config_t config;
+    RingbufHandle_t input;
+    SemaphoreHandle_t task_done;
+    bool task_running;
+    volatile bool input_ended;  // set by jpeg_decoder_finish, no more data will be written
+    volatile esp_err_t error;   // set by the decoder task
+    JDEC jdec;
+    row_pipeline_t *pipeline;
+    uint8_t *strip;             // one row of MCUs as gray, image width x strip_height
+    int strip_height;
+    int64_t input_wait_us;      // time the decoder task spent waiting for data
+    int64_t decode_us;
+    uint8_t work[WORK_BUFFER_SIZE];
+};
+
+static void decode_task(void *arg);
+
+esp_err_t jpeg_decoder_create(const image_decoder_config_t *config, jpeg_decoder_t **out_decoder)
+{
+    jpeg_decoder_t *dec = calloc(1, sizeof(*dec));
+    ESP_RETURN_ON_FALSE(dec != NULL, ESP_ERR_NO_MEM, TAG, "Failed to allocate decoder");
+    dec->config = *config;
+
+    dec->input = xRingbufferCreate(INPUT_BUFFER_SIZE, RINGBUF_TYPE_BYTEBUF);
+    dec->task_done = xSemaphoreCreateBinary();
+    if (dec->input == NULL || dec->task_done == NULL ||
+            xTaskCreatePinnedToCore(&decode_task, "jpeg_decode", DECODE_TASK_STACK, dec, DECODE_TASK_PRIORITY,
+                                    NULL, dec->config.task_core) != pdPASS) {
+        jpeg_decoder_delete(dec);
+        ESP_LOGE(TAG, "Failed to start the decoder task");
+        return ESP_ERR_NO_MEM;
+    }
+    dec->task_running = true;
+    *out_decoder = dec;
+    return ESP_OK;
+}
+
+esp_err_t jpeg_decoder_write(jpeg_decoder_t *dec, const void *data, size_t len)
+{
+    // The decoder task keeps draining the input after a failure, so this can't block forever
+    const uint8_t *p = (const uint8_t *) data;
+    while (len > 0 && dec->error == ESP_OK) {
+        size_t chunk = MIN(len, INPUT_BUFFER_SIZE / 2);
+        xRingbufferSend(dec->input, p, chunk, portMAX_DELAY);
+        p += chunk;
+        len -= chunk;
+    }
+    return dec->error;
+}
+
+static void stop_task(jpeg_decoder_t *dec)
+{
+    if (!dec->task_running) {
+        return;
+    }
+    dec->input_ended = true;
+    xSemaphoreTake(dec->task_done, portMAX_DELAY);
+    dec->task_running = false;
+}
+
+esp_err_t jpeg_decoder_finish(jpeg_decoder_t *dec, image_decoder_stats_t *out_stats)
+{
+    int64_t start = esp_timer_get_time();
+    stop_task(dec);
+    if (out_stats != NULL) {
+        out_stats->decode_us = dec->decode_us;
+        out_stats->finish_wait_us = esp_timer_get_time() - start;
+        if (dec->pipeline != NULL) {
+            row_pipeline_get_stats(dec->pipeline, &out_stats->tone);
+        }
+    }
+    return dec->error;
+}
+
+void jpeg_decoder_delete(jpeg_decoder_t *dec)
+{
+    stop_task(dec);
+    if (dec->input != NULL) {
+        vRingbufferDelete(dec->input);
+    }
+    if (dec->task_done != NULL) {
+        vSemaphoreDelete(dec->task_done);
+    }
+    if (dec->pipeline != NULL) {
+        row_pipeline_delete(dec->pipeline);
+    }
+    free(dec->strip);
+    free(dec);
+}
+
+/* Copy (or skip, if buf is NULL) up to len bytes of input; returns less only at the end of the input */
+static size_t read_input(jpeg_decoder_t *dec, uint8_t *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        // Sample the flag first: if it was set and the ringbuffer is still empty, there is no more data
+        bool ended = dec->input_ended;
+        size_t size = 0;
+        int64_t start = esp_timer_get_time();
+        uint8_t *item = xRingbufferReceiveUpTo(dec->input, &size, pdMS_TO_TICKS(INPUT_POLL_MS), len - done);
+        dec->input_wait_us += esp_timer_get_time() - start;
+        if (item == NULL) {
+            if (ended) {
+                break;
+            }
+            continue;
+        }
+        if (buf != NULL) {
+            memcpy(buf + done, item, size);
+        }
+        done += size;
+        vRingbufferReturnItem(dec->input, item);
+    }
+    return done;
+}
+
+static uint32_t jpeg_input(JDEC *jd, uint8_t *buf, uint32_t len)
+{
+    return read_input((jpeg_decoder_t *) jd->device, buf, len);
+}
+
+/* Called with each decoded MCU (RGB888), left to right, top to bottom */
+static uint32_t jpeg_output(JDEC *jd, void *bitmap, JRECT *rect)
+{
+    jpeg_decoder_t *dec = (jpeg_decoder_t *) jd->device;
+    const uint8_t *rgb = (const uint8_t *) bitmap;
+    const int width = jd->width;
+    const int strip_top = rect->top - rect->top % dec->strip_height;
+
+    for (int y = rect->top; y <= rect->bottom; y++) {
+        uint8_t *dst = dec->strip + (y - strip_top) * width + rect->left;
+        for (int x = rect->left; x <= rect->right; x++, rgb += 3) {
+            *dst++ = app_luma(rgb[0], rgb[1], rgb[2]);
+        }
+    }
+    if (rect->right == width - 1) {
+        // Last MCU in this row, the strip is complete
+        for (int y = strip_top; y <= rect->bottom; y++) {
+            row_pipeline_push(dec->pipeline, dec->strip + (y - strip_top) * width);
+        }
+    }
+    return 1;
+}
+
+static esp_err_t start_pipeline(jpeg_decoder_t *dec)
+{
+    JDEC *jd = &dec->jdec;
+    ESP_LOGD(TAG, "%dx%d, MCU %dx%d", (int) jd->width, (int) jd->height, jd->msx * 8, jd->msy * 8);
+    dec->strip_height = jd->msy * 8;
+    dec->strip = malloc(jd->width * dec->strip_height);
+    ESP_RETURN_ON_FALSE(dec->strip != NULL, ESP_ERR_NO_MEM, TAG, "Failed to allocate MCU row");
+
+    row_pipeline_config_t pipeline_config = {
+        .src_width = jd->width,
+        .src_height = jd->height,
+        .dst = dec->config.dst,
+        .scale = dec->config.scale,
+        .fb = dec->config.fb,
+    };
+    return row_pipeline_create(&pipeline_config, &dec->pipeline);
+}
+
+static esp_err_t jresult_to_err(JRESULT res)
+{
+    switch (res) {
+    case JDR_OK:
+        return ESP_OK;
+    case JDR_INP:
+        return ESP_ERR_INVALID_SIZE;
+    case JDR_MEM1:
+    case JDR_MEM2:
+        return ESP_ERR_NO_MEM;
+    case JDR_FMT3:
+        return ESP_ERR_NOT_SUPPORTED;
+    default:
+        return ESP_FAIL;
+    }
+}
+
+static void decode_task(void *arg)
+{
+    jpeg_decoder_t *dec = (jpeg_decoder_t *) arg;
+    int64_t start = esp_timer_get_time();
+
+    esp_err_t err = ESP_OK;
+    JRESULT res = jd_prepare(&dec->jdec, &jpeg_input, dec->work, sizeof(dec->work), dec);
+    if (res == JDR_OK) {
+        err = start_pipeline(dec);
+        if (err == ESP_OK) {
+            res = jd_decomp(&dec->jdec, &jpeg_output, 0);
+        }
+    }
+    if (err == ESP_OK && res != JDR_OK) {
+        ESP_LOGE(TAG, "Failed to decode JPEG (%d)", res);
+        err = jresult_to_err(res);
+    }
+    dec->error = err;
+    dec->decode_us = esp_timer_get_time() - start - dec->input_wait_us;
+
+    // Consume whatever follows, so that jpeg_decoder_write never blocks on a full ringbuffer
+    while (read_input(dec, NULL, INPUT_BUFFER_SIZE) > 0) {
+    }
+    xSemaphoreGive(dec->task_done);
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "image_decoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jpeg_decoder jpeg_decoder_t;
+
+/**
+ * @brief Create a streaming JPEG decoder
+ *
+ * Decoding runs in a task on config->task_core, which pulls data from an input ringbuffer.
+ * It converts one row of MCUs at a time to gray and passes the rows to a row pipeline,
+ * so memory use doesn't depend on the image height.
+ *
+ * Only baseline YCbCr JPEGs are supported (as by the ROM decoder); progressive and
+ * single-component files are rejected.
+ */
+esp_err_t jpeg_decoder_create(const image_decoder_config_t *config, jpeg_decoder_t **out_decoder);
+
+/**
+ * @brief Feed the next chunk of JPEG data
+ *
+ * Blocks while the input ringbuffer is full. After an error, all further calls return the same error.
+ */
+esp_err_t jpeg_decoder_write(jpeg_decoder_t *decoder, const void *data, size_t len);
+
+/**
+ * @brief Signal the end of the data and wait until the decoder task is done
+ *
+ * @return ESP_OK if the complete image was decoded
+ */
+esp_err_t jpeg_decoder_finish(jpeg_decoder_t *decoder, image_decoder_stats_t *out_stats);
+
+/**
+ * @brief Stop the decoder task (if still running) and free the decoder
+ */
+void jpeg_decoder_delete(jpeg_decoder_t *decoder);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "layout.h"
+
+typedef struct {
+    bool valid;
+    uint32_t key;
+    int64_t fetched_s;
+    char etag[LAYOUT_ETAG_MAX];
+    char last_modified[LAYOUT_LAST_MODIFIED_MAX];
+} region_state_t;
+
+static const char *TAG = "layout";
+RTC_DATA_ATTR static region_state_t s_state[LAYOUT_MAX_REGIONS];
+
+static esp_err_t parse_region(char *str, layout_region_t *region)
+{
+    int x, y, width, height;
+    unsigned minutes;
+    int url_offset = 0;
+    ESP_RETURN_ON_FALSE(sscanf(str, "%d,%d,%d,%d,%u,%n", &x, &y, &width, &height, &minutes, &url_offset) == 5 &&
+                        url_offset > 0 && str[url_offset] != '\0',
+                        ESP_ERR_INVALID_ARG, TAG, "Expected x,y,width,height,minutes,url: %s", str);
+    ESP_RETURN_ON_FALSE(x >= 0 && y >= 0 && width > 0 && height > 0 &&
+                        x + width <= epd_rotated_display_width() && y + height <= epd_rotated_display_height(),
+                        ESP_ERR_INVALID_ARG, TAG, "Region outside of the screen: %s", str);
+    *region = (layout_region_t) {
+        .area = {
+            .x = x, .y = y, .width = width, .height = height
+        },
+        .refresh_s = minutes * 60,
+        .url = str + url_offset,
+        .key = esp_rom_crc32_le(0, (const uint8_t *) str, strlen(str)),
+    };
+    return ESP_OK;
+}
+
+esp_err_t layout_parse(const char *str, layout_t *out_layout)
+{
+    *out_layout = (layout_t) {
+        0
+    };
+    out_layout->strings = strdup(str);
+    ESP_RETURN_ON_FALSE(out_layout->strings != NULL, ESP_ERR_NO_MEM, TAG, "Failed to copy the layout");
+
+    esp_err_t ret = ESP_OK;
+    char *rest = out_layout->strings;
+    char *token;
+    while ((token = strsep(&rest, ";")) != NULL) {
+        if (strlen(token) == 0) {
+            continue;
+        }
+        ESP_GOTO_ON_FALSE(out_layout->count < LAYOUT_MAX_REGIONS, ESP_ERR_INVALID_ARG, err, TAG,
+                          "More than %d regions", LAYOUT_MAX_REGIONS);
+        ESP_GOTO_ON_ERROR(parse_region(token, &out_layout->regions[out_layout->count]), err, TAG, "Invalid region");
+        out_layout->count++;
+    }
+    ESP_GOTO_ON_FALSE(out_layout->count > 0, ESP_ERR_INVALID_ARG, err, TAG, "No regions");
+    return ESP_OK;
+
+err:
+    layout_free(out_layout);
+    return ret;
+}
+
+void layout_free(layout_t *layout)
+{
+    free(layout->strings);
+    layout->strings = NULL;
+    layout->count = 0;
+}
+
+static const region_state_t *region_state(const layout_t *layout, int index)
+{
+    const region_state_t *state = &s_state[index];
+    return state->valid && state->key == layout->regions[index].key ? state : NULL;
+}
+
+bool layout_region_due(const layout_t *layout, int index, int64_t now_s)
+{
+    const region_state_t *state = region_state(layout, index);
+    if (state == NULL) {
+        return true;
+    }
+    int64_t elapsed = now_s - state->fetched_s;
+    return elapsed < 0 || elapsed >= layout->regions[index].refresh_s;
+}
+
+const char *layout_region_etag(const layout_t *layout, int index)
+{
+    const region_state_t *state = region_state(layout, index);
+    return state != NULL && state->etag[0] != '\0' ? state->etag : NULL;
+}
+
+const char *layout_region_last_modified(const layout_t *layout, int index)
+{
+    const region_state_t *state = region_state(layout, index);
+    return state != NULL && state->last_modified[0] != '\0' ? state->last_modified : NULL;
+}
+
+void layout_copy_validator(char *dst, size_t size, const char *value)
+{
+    if (value == dst) {
+        return;
+    }
+    if (value == NULL || strlen(value) >= size) {
+        dst[0] = '\0';
+        return;
+    }
+    strcpy(dst, value);
+}
+
+void layout_region_fetched(const layout_t *layout, int index, int64_t now_s, const char *etag, const char *last_modified)
+{
+    region_state_t *state = &s_state[index];
+    state->valid = true;
+    state->key = layout->regions[index].key;
+    state->fetched_s = now_s;
+    layout_copy_validator(state->etag, sizeof(state->etag), etag);
+    layout_copy_validator(state->last_modified, sizeof(state->last_modified), last_modified);
+}
+
+void layout_forget(void)
+{
+    memset(s_state, 0, sizeof(s_state));
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "epd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A screen made of rectangular regions, each showing its own image with its own refresh
+ * interval. The layout comes from a string of regions separated by ";", each written as
+ * "x,y,width,height,minutes,url" in screen coordinates.
+ *
+ * When each region was fetched, and the validators of the response (ETag, Last-Modified),
+ * are kept in RTC memory, so they survive deep sleep. Changing a region's definition
+ * makes it due immediately.
+ */
+
+#define LAYOUT_MAX_REGIONS 8
+#define LAYOUT_ETAG_MAX 64
+#define LAYOUT_LAST_MODIFIED_MAX 32
+
+typedef struct {
+    EpdRect area;
+    uint32_t refresh_s;     /*!< Refresh interval */
+    const char *url;
+    uint32_t key;           /*!< Identifies the region definition */
+} layout_region_t;
+
+typedef struct {
+    layout_region_t regions[LAYOUT_MAX_REGIONS];
+    int count;
+    char *strings;          /*!< Holds the URLs */
+} layout_t;
+
+/**
+ * @brief Parse a layout string
+ *
+ * @return ESP_ERR_INVALID_ARG if a region is malformed or outside of the screen
+ */
+esp_err_t layout_parse(const char *str, layout_t *out_layout);
+
+void layout_free(layout_t *layout);
+
+/* Whether the region has to be fetched at time now_s (seconds, as from time()) */
+bool layout_region_due(const layout_t *layout, int index, int64_t now_s);
+
+/* Validators of the last response for the region, or NULL */
+const char *layout_region_etag(const layout_t *layout, int index);
+const char *layout_region_last_modified(const layout_t *layout, int index);
+
+/* Record a successful fetch; validators may be NULL or empty if the server sent none */
+void layout_region_fetched(const layout_t *layout, int index, int64_t now_s, const char *etag, const char *last_modified);
+
+/* Copy a validator into dst, or make dst empty if it doesn't fit; a truncated one would never match */
+void layout_copy_validator(char *dst, size_t size, const char *value);
+
+/* Forget all fetches, e.g. when the panel content is unknown and every region has to be drawn */
+void layout_forget(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,543 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/param.h>
+#include "sdkconfig.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_memory_utils.h"
+#endif
+#include "log_ring.h"
+
+#define ENTRY_COUNT CONFIG_APP_LOG_LINES
+/* Longest conversion specification kept, like "%-08.3lld" */
+#define SPEC_MAX 16
+
+/* Bytes of message data in one entry */
+#define ENTRY_DATA_SIZE (LOG_RING_ENTRY_SIZE - sizeof(atomic_uint) - sizeof(const char *) - 2)
+#define MAX_PARTS ((LOG_RING_LINE_MAX + ENTRY_DATA_SIZE - 1) / ENTRY_DATA_SIZE)
+
+/*
+ * A message is kept as its format string (in flash, so the pointer stays valid) and the
+ * arguments as they were passed, in the order of the conversions. Strings in flash are
+ * kept as pointers, others are copied as a length byte and the characters.
+ * Messages whose format isn't in flash, or whose arguments don't fit into
+ * LOG_RING_LINE_MAX bytes, are kept as text. Data longer than one entry continues in
+ * the following ones.
+ */
+typedef struct {
+    atomic_uint seq;            // number of the entry + 1 once written, 0 while being written
+    const char *fmt;            // NULL if the data is the formatted text
+    uint8_t len;                // bytes of data of the whole message; 0 in continuation entries
+    uint8_t parts;              // entries the message takes; 0 in continuation entries
+    uint8_t data[ENTRY_DATA_SIZE];
+} log_entry_t;
+
+/* An argument of any of the recorded types */
+typedef union {
+    int i;
+    long l;
+    long long ll;
+    size_t z;
+    void *p;
+    double d;
+} arg_value_t;
+
+typedef enum {
+    ARG_NONE,                   // "%%"
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_PTR,
+    ARG_DOUBLE,
+    ARG_STR,
+    ARG_UNSUPPORTED,            // %n, long double
+} arg_type_t;
+
+typedef enum {
+    STR_POINTER,
+    STR_INLINE,
+} str_kind_t;
+
+/* One conversion specification of a format string */
+typedef struct {
+    const char *start;          // the '%'
+    size_t len;
+    int stars;                  // '*' width and precision, each an int argument before the value
+    arg_type_t type;
+} conversion_t;
+
+static log_entry_t s_entries[ENTRY_COUNT];
+static atomic_uint s_next;      // number of the next message
+
+static bool is_constant(const void *p)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    // Only the host benchmark runs there, with literal formats and strings
+    return true;
+#else
+    return esp_ptr_in_drom(p);
+#endif
+}
+
+/* Find the next conversion in fmt; false at the end of the string */
+static bool next_conversion(const char *fmt, conversion_t *conv)
+{
+    const char *p = strchr(fmt, '%');
+    if (p == NULL) {
+        return false;
+    }
+    *conv = (conversion_t) {
+        .start = p,
+    };
+    p++;
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+        p++;
+    }
+    for (int part = 0; part < 2; part++) {
+        // Width, then precision
+        if (part == 1) {
+            if (*p != '.') {
+                break;
+            }
+            p++;
+        }
+        if (*p == '*') {
+            conv->stars++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    int longs = 0;
+    bool size = false;
+    bool long_double = false;
+    for (;; p++) {
+        if (*p == 'l') {
+            longs++;
+        } else if (*p == 'z' || *p == 'j' || *p == 't') {
+            size = true;
+        } else if (*p == 'L') {
+            long_double = true;
+        } else if (*p != 'h') {
+            break;
+        }
+    }
+    char c = *p;
+    if (c != '\0') {
+        p++;
+    }
+    conv->len = p - conv->start;
+    switch (c) {
+    case '%':
+        conv->type = ARG_NONE;
+        break;
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+        conv->type = size ? ARG_SIZE : longs >= 2 ? ARG_LLONG : longs == 1 ? ARG_LONG : ARG_INT;
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        conv->type = long_double ? ARG_UNSUPPORTED : ARG_DOUBLE;
+        break;
+    case 's':
+        conv->type = ARG_STR;
+        break;
+    case 'p':
+        conv->type = ARG_PTR;
+        break;
+    default:
+        conv->type = ARG_UNSUPPORTED;
+        break;
+    }
+    if (conv->len >= SPEC_MAX) {
+        conv->type = ARG_UNSUPPORTED;
+    }
+    return true;
+}
+
+/* Appends to the entry data; false if it doesn't fit */
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+} writer_t;
+
+static bool put(writer_t *w, const void *value, size_t len)
+{
+    if (w->len + len > w->size) {
+        return false;
+    }
+    memcpy(&w->data[w->len], value, len);
+    w->len += len;
+    return true;
+}
+
+static bool put_str(writer_t *w, const char *str)
+{
+    if (str != NULL && is_constant(str)) {
+        uint8_t kind = STR_POINTER;
+        return put(w, &kind, 1) && put(w, &str, sizeof(str));
+    }
+    if (str == NULL) {
+        str = "(null)";
+    }
+    uint8_t header[2] = { STR_INLINE, MIN(strlen(str), UINT8_MAX) };
+    return put(w, header, 2) && put(w, str, header[1]);
+}
+
+/* Record the arguments; false if the message has to be kept as text */
+static bool capture(const char *fmt, va_list args, writer_t *w)
+{
+    conversion_t conv;
+    while (next_conversion(fmt, &conv)) {
+        fmt = conv.start + conv.len;
+        for (int i = 0; i < conv.stars; i++) {
+            int star = va_arg(args, int);
+            if (!put(w, &star, sizeof(star))) {
+                return false;
+            }
+        }
+        arg_value_t v;
+        size_t len;
+        switch (conv.type) {
+        case ARG_NONE:
+            continue;
+        case ARG_INT:
+            v.i = va_arg(args, int);
+            len = sizeof(v.i);
+            break;
+        case ARG_LONG:
+            v.l = va_arg(args, long);
+            len = sizeof(v.l);
+            break;
+        case ARG_LLONG:
+            v.ll = va_arg(args, long long);
+            len = sizeof(v.ll);
+            break;
+        case ARG_SIZE:
+            v.z = va_arg(args, size_t);
+            len = sizeof(v.z);
+            break;
+        case ARG_PTR:
+            v.p = va_arg(args, void *);
+            len = sizeof(v.p);
+            break;
+        case ARG_DOUBLE:
+            v.d = va_arg(args, double);
+            len = sizeof(v.d);
+            break;
+        case ARG_STR:
+            if (!put_str(w, va_arg(args, const char *))) {
+                return false;
+            }
+            continue;
+        default:
+            return false;
+        }
+        if (!put(w, &v, len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void log_ring_vappend(const char *fmt, va_list args)
+{
+    uint8_t data[LOG_RING_LINE_MAX];
+    writer_t w = {
+        .data = data,
+        .size = sizeof(data),
+    };
+    va_list capture_args;
+    va_copy(capture_args, args);
+    bool captured = is_constant(fmt) && capture(fmt, capture_args, &w);
+    va_end(capture_args);
+    if (!captured) {
+        // Formatting now is the fallback
+        int len = vsnprintf((char *) data, sizeof(data), fmt, args);
+        w.len = MIN(MAX(len, 0), (int) sizeof(data) - 1);
+        if (len >= (int) sizeof(data)) {
+            // Cut off, along with its line end
+            data[w.len - 1] = '\n';
+        }
+        fmt = NULL;
+    }
+
+    int parts = MAX((w.len + ENTRY_DATA_SIZE - 1) / ENTRY_DATA_SIZE, 1);
+    unsigned n = atomic_fetch_add_explicit(&s_next, parts, memory_order_relaxed);
+    for (int i = 0; i < parts; i++) {
+        log_entry_t *entry = &s_entries[(n + i) % ENTRY_COUNT];
+        atomic_store_explicit(&entry->seq, 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        entry->fmt = i == 0 ? fmt : NULL;
+        entry->len = i == 0 ? w.len : 0;
+        entry->parts = i == 0 ? parts : 0;
+        size_t offset = i * ENTRY_DATA_SIZE;
+        memcpy(entry->data, &data[offset], MIN(w.len - offset, ENTRY_DATA_SIZE));
+        atomic_store_explicit(&entry->seq, n + i + 1, memory_order_release);
+    }
+}
+
+/* Reads the arguments back from the entry data */
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+} reader_t;
+
+static bool get(reader_t *r, void *value, size_t len)
+{
+    if (r->pos + len > r->len) {
+        return false;
+    }
+    memcpy(value, &r->data[r->pos], len);
+    r->pos += len;
+    return true;
+}
+
+/*
+ * Format one conversion with its recorded argument into out, up to size characters
+ * (out has room for the terminating NUL after them). Returns the length, or -1.
+ */
+static int format_conversion(const conversion_t *conv, reader_t *r, char *out, size_t size)
+{
+    // The '*' arguments go into the specification, so the value is the only argument
+    char spec[SPEC_MAX + 2 * 12];
+    size_t spec_len = 0;
+    for (size_t i = 0; i < conv->len; i++) {
+        char c = conv->start[i];
+        if (c == '*') {
+            int star;
+            if (!get(r, &star, sizeof(star))) {
+                return -1;
+            }
+            spec_len += snprintf(&spec[spec_len], sizeof(spec) - spec_len, "%d", star);
+        } else {
+            spec[spec_len++] = c;
+        }
+    }
+    spec[spec_len] = '\0';
+
+    arg_value_t v;
+    int len = -1;
+    switch (conv->type) {
+    case ARG_NONE:
+        len = snprintf(out, size + 1, "%%");
+        break;
+    case ARG_INT:
+        len = get(r, &v.i, sizeof(v.i)) ? snprintf(out, size + 1, spec, v.i) : -1;
+        break;
+    case ARG_LONG:
+        len = get(r, &v.l, sizeof(v.l)) ? snprintf(out, size + 1, spec, v.l) : -1;
+        break;
+    case ARG_LLONG:
+        len = get(r, &v.ll, sizeof(v.ll)) ? snprintf(out, size + 1, spec, v.ll) : -1;
+        break;
+    case ARG_SIZE:
+        len = get(r, &v.z, sizeof(v.z)) ? snprintf(out, size + 1, spec, v.z) : -1;
+        break;
+    case ARG_PTR:
+        len = get(r, &v.p, sizeof(v.p)) ? snprintf(out, size + 1, spec, v.p) : -1;
+        break;
+    case ARG_DOUBLE:
+        len = get(r, &v.d, sizeof(v.d)) ? snprintf(out, size + 1, spec, v.d) : -1;
+        break;
+    case ARG_STR: {
+        uint8_t kind;
+        if (!get(r, &kind, 1)) {
+            break;
+        }
+        if (kind == STR_POINTER) {
+            const char *str;
+            len = get(r, &str, sizeof(str)) ? snprintf(out, size + 1, spec, str) : -1;
+        } else {
+            uint8_t str_len;
+            char str[UINT8_MAX + 1];
+            if (get(r, &str_len, 1) && get(r, str, str_len)) {
+                str[str_len] = '\0';
+                len = snprintf(out, size + 1, spec, str);
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return len < 0 ? -1 : MIN(len, (int) size);
+}
+
+/* Format a recorded message into out, up to size characters (plus the NUL); returns the length */
+static size_t format_message(const char *fmt, const uint8_t *data, size_t data_len, char *out, size_t size)
+{
+    if (fmt == NULL) {
+        size_t len = MIN(data_len, size);
+        memcpy(out, data, len);
+        return len;
+    }
+    reader_t r = {
+        .data = data,
+        .len = data_len,
+    };
+    size_t len = 0;
+    conversion_t conv;
+    while (len < size) {
+        bool more = next_conversion(fmt, &conv);
+        size_t literal = more ? (size_t) (conv.start - fmt) : strlen(fmt);
+        literal = MIN(literal, size - len);
+        memcpy(&out[len], fmt, literal);
+        len += literal;
+        if (!more) {
+            break;
+        }
+        int value_len = format_conversion(&conv, &r, &out[len], size - len);
+        if (value_len < 0) {
+            break;
+        }
+        len += value_len;
+        fmt = conv.start + conv.len;
+    }
+    return len;
+}
+
+/* A complete message read out of the entries */
+typedef struct {
+    const char *fmt;
+    size_t len;
+    uint8_t data[LOG_RING_LINE_MAX];
+} message_t;
+
+/*
+ * Read the message starting at entry n into msg; false if it isn't one (being written, or
+ * the rest of a message whose start was overwritten). *parts is set to the entries it takes.
+ */
+static bool read_message(unsigned n, unsigned end, message_t *msg, int *parts)
+{
+    const log_entry_t *entry = &s_entries[n % ENTRY_COUNT];
+    if (atomic_load_explicit(&entry->seq, memory_order_acquire) != n + 1 || entry->parts == 0) {
+        return false;
+    }
+    msg->fmt = entry->fmt;
+    msg->len = MIN(entry->len, LOG_RING_LINE_MAX);
+    *parts = entry->parts;
+    bool complete = n + *parts <= end && *parts <= MAX_PARTS;
+    for (int i = 0; i < *parts && complete; i++) {
+        const log_entry_t *part = &s_entries[(n + i) % ENTRY_COUNT];
+        size_t offset = i * ENTRY_DATA_SIZE;
+        if (offset < msg->len) {
+            memcpy(&msg->data[offset], part->data, MIN(msg->len - offset, ENTRY_DATA_SIZE));
+        }
+        // Overwritten while copying
+        atomic_thread_fence(memory_order_acquire);
+        complete = atomic_load_explicit(&part->seq, memory_order_relaxed) == n + i + 1;
+    }
+    return complete;
+}
+
+/* Format a message at the end of the text in buf, cutting it off at LOG_RING_LINE_MAX */
+static size_t append_message(const char *fmt, const uint8_t *data, size_t data_len, char *buf, size_t len, size_t size)
+{
+    size_t max_len = MIN(size - 1 - len, LOG_RING_LINE_MAX);
+    size_t message_len = format_message(fmt, data, data_len, &buf[len], max_len);
+    if (message_len == LOG_RING_LINE_MAX) {
+        // Cut off, along with its line end
+        buf[len + message_len - 1] = '\n';
+    }
+    return len + message_len;
+}
+
+size_t log_ring_copy(char *buf, size_t size)
+{
+    if (size == 0) {
+        return 0;
+    }
+    size_t len = 0;
+    unsigned end = atomic_load_explicit(&s_next, memory_order_relaxed);
+    unsigned start = end > ENTRY_COUNT ? end - ENTRY_COUNT : 0;
+    message_t msg;
+    int parts;
+    for (unsigned n = start; n != end; n++) {
+        if (!read_message(n, end, &msg, &parts)) {
+            continue;
+        }
+        n += parts - 1;
+        len = append_message(msg.fmt, msg.data, msg.len, buf, len, size);
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/* A packed message: the format pointer, a length byte and the data */
+#define PACKED_HEADER_SIZE (sizeof(const char *) + 1)
+
+size_t log_ring_pack(uint8_t *buf, size_t size)
+{
+    unsigned end = atomic_load_explicit(&s_next, memory_order_relaxed);
+    unsigned start = end > ENTRY_COUNT ? end - ENTRY_COUNT : 0;
+    // Measure all the messages, then leave out the oldest until the rest fit
+    unsigned first = start;
+    size_t total = 0;
+    message_t msg;
+    int parts;
+    for (unsigned n = start; n != end; n++) {
+        if (!read_message(n, end, &msg, &parts)) {
+            continue;
+        }
+        n += parts - 1;
+        total += PACKED_HEADER_SIZE + msg.len;
+    }
+    for (unsigned n = start; n != end && total > size; n++) {
+        if (!read_message(n, end, &msg, &parts)) {
+            continue;
+        }
+        n += parts - 1;
+        total -= PACKED_HEADER_SIZE + msg.len;
+        first = n + 1;
+    }
+
+    size_t len = 0;
+    for (unsigned n = first; n != end; n++) {
+        if (!read_message(n, end, &msg, &parts)) {
+            continue;
+        }
+        n += parts - 1;
+        if (len + PACKED_HEADER_SIZE + msg.len > size) {
+            // Changed since it was measured, by messages logged meanwhile
+            break;
+        }
+        memcpy(&buf[len], &msg.fmt, sizeof(msg.fmt));
+        buf[len + sizeof(msg.fmt)] = msg.len;
+        memcpy(&buf[len + PACKED_HEADER_SIZE], msg.data, msg.len);
+        len += PACKED_HEADER_SIZE + msg.len;
+    }
+    return len;
+}
+
+size_t log_ring_format_packed(const uint8_t *packed, size_t packed_len, char *buf, size_t size)
+{
+    if (size == 0) {
+        return 0;
+    }
+    size_t len = 0;
+    size_t offset = 0;
+    while (offset + PACKED_HEADER_SIZE <= packed_len) {
+        const char *fmt;
+        memcpy(&fmt, &packed[offset], sizeof(fmt));
+        size_t data_len = packed[offset + sizeof(fmt)];
+        offset += PACKED_HEADER_SIZE;
+        if (offset + data_len > packed_len) {
+            break;
+        }
+        len = append_message(fmt, &packed[offset], data_len, buf, len, size);
+        offset += data_len;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+size_t log_ring_memory(void)
+{
+    return sizeof(s_entries);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The last log messages of the wake-up, shown on the panel if it fails. A fixed array of
+ * entries which is written from any task without a lock: each message claims the next
+ * entry with an atomic increment, overwriting the oldest one.
+ *
+ * Messages are recorded unformatted, as the format string pointer and the arguments;
+ * the text is only produced by log_ring_copy, which a successful wake-up never calls.
+ */
+
+/* Size of one entry; arguments which don't fit are formatted into it instead, truncated */
+#define LOG_RING_ENTRY_SIZE 64
+/* Formatted messages are cut off at this length */
+#define LOG_RING_LINE_MAX 128
+/* Enough for log_ring_copy to fit all the messages */
+#define LOG_RING_TEXT_SIZE (CONFIG_APP_LOG_LINES * LOG_RING_LINE_MAX + 1)
+
+/**
+ * @brief Record a log message in the next entry
+ */
+void log_ring_vappend(const char *fmt, va_list args);
+
+/**
+ * @brief Format the kept messages, oldest first, into buf
+ *
+ * Entries which are being written at the same time are left out.
+ *
+ * @return Length of the text, without the terminating NUL
+ */
+size_t log_ring_copy(char *buf, size_t size);
+
+/**
+ * @brief Pack the most recent messages, unformatted, to be kept until a later wake-up
+ *
+ * The oldest messages are left out if they don't all fit. The packed messages refer to
+ * format strings and strings in flash, so they can only be formatted by the same firmware.
+ *
+ * @return Bytes used in buf
+ */
+size_t log_ring_pack(uint8_t *buf, size_t size);
+
+/**
+ * @brief Format messages packed by log_ring_pack into buf, like log_ring_copy
+ *
+ * @return Length of the text, without the terminating NUL
+ */
+size_t log_ring_format_packed(const uint8_t *packed, size_t packed_len, char *buf, size_t size);
+
+/**
+ * @brief Memory used by the entries, in bytes
+ */
+size_t log_ring_memory(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,7 +1,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
+#include <sys/param.h>
+#include <time.h>
+#include <sys/time.h>
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_sleep.h"
@@ -14,12 +18,49 @@
 #include "nvs_dotenv.h"
 #include "sdkconfig.h"
 #include "app.h"
+#include "layout.h"
+#include "log_ring.h"
+#include "error_log.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_attr.h"
+
+/* How long to wait for SNTP after the download, before turning Wi-Fi off */
+#define TIME_SYNC_WAIT_MS 2000
+
+/* One image download; the user_data of the download callbacks */
+typedef struct {
+    app_display_image_t *image;
+    const char *etag;               // validators of the copy on the screen, or NULL
+    const char *last_modified;
+    bool send_frame_crc;            // offer the server to send a patch against this frame
+    uint32_t frame_crc;
+    char new_etag[LAYOUT_ETAG_MAX]; // validators of the response
+    char new_last_modified[LAYOUT_LAST_MODIFIED_MAX];
+    int http_status;
+} image_request_t;
 
 static esp_err_t set_headers(void *user_data, esp_http_client_handle_t client);
+static esp_err_t write_image_data(void *user_data, const void *data, size_t len);
+static void image_header(void *user_data, const char *key, const char *value);
+static esp_err_t download_image(const char *url, const EpdRect *area, esp_http_client_handle_t client, image_request_t *request);
+static esp_err_t update_image(app_stats_t *stats, int *out_drawn);
+static esp_err_t update_layout(const char *layout_str, app_stats_t *stats, int *out_drawn);
+static void stop_network(esp_http_client_handle_t client, bool upload_logs);
+static esp_err_t upload_error_log(esp_http_client_handle_t client);
+static int env_int(const char *name, int default_value);
+static bool widget_area(EpdRect *out_area);
+static uint64_t sleep_time_us(void);
 static void power_off(void);
+static void log_timeline(const app_timeline_t *timeline);
+static void log_psram(const char *phase);
 
 static const char *TAG = "main";
+static bool s_widgets;          // WIDGET_AREA is set
+static EpdRect s_widget_area;
+static bool s_time_sync;        // SNTP is running
+RTC_DATA_ATTR static time_t s_last_fetch;       // last fetch attempt
+RTC_DATA_ATTR static time_t s_last_success;     // last successful fetch, shown by the status widget
 
 void app_main()
 {
@@ -27,6 +68,8 @@ void app_main()
     int64_t end;
     int64_t connect_start = 0;
     int64_t connect_end = 0;
+    bool widgets_only = false;
+    app_stats_t stats = { 0 };
 
     esp_log_level_set("*", ESP_LOG_WARN);
     esp_log_level_set("wifi", ESP_LOG_NONE);
@@ -34,7 +77,19 @@ void app_main()
     esp_log_level_set("phy_init", ESP_LOG_NONE);
     esp_log_level_set(TAG, ESP_LOG_INFO);
     esp_log_level_set("connect", ESP_LOG_INFO);
+    // Inflate and pack times, and where libpng's memory went
+    esp_log_level_set("png_decoder", ESP_LOG_INFO);
+    // Image format, size and decode time; refresh mode; frame save and restore
+    esp_log_level_set("display", ESP_LOG_INFO);
+    // Frame store writes, patch and display list sizes, sensor readings, kept error logs
+    esp_log_level_set("fb_store", ESP_LOG_INFO);
+    esp_log_level_set("delta_decoder", ESP_LOG_INFO);
+    esp_log_level_set("dlist", ESP_LOG_INFO);
+    esp_log_level_set("temperature", ESP_LOG_INFO);
+    esp_log_level_set("battery", ESP_LOG_INFO);
+    esp_log_level_set("error_log", ESP_LOG_INFO);
     app_display_init_log();
+    ESP_LOGI(TAG, "Log buffer: %d messages, %u bytes", CONFIG_APP_LOG_LINES, (unsigned) log_ring_memory());
 
     // Initialize NVS and networking
     ESP_GOTO_ON_ERROR(esp_netif_init(), end, TAG, "Failed to init netif");
@@ -48,69 +103,153 @@ void app_main()
     ESP_GOTO_ON_ERROR(ret, end, TAG, "Failed to init NVS (2)");
 
     ESP_GOTO_ON_ERROR(nvs_dotenv_load(), end, TAG, "Failed to init nvs-dotenv");
+    tzset();    // TZ may be set in .env
 
-    connect_start = esp_timer_get_time();
-    connect_end = connect_start;
-    ESP_GOTO_ON_ERROR(app_wifi_connect_start(), end, TAG, "Failed to start WiFi connection");
+    // Between fetches, the device only wakes up to update the widgets, without Wi-Fi
+    s_widgets = widget_area(&s_widget_area);
+    time_t now = time(NULL);
+    int fetch_interval_s = env_int("REFRESH_INTERVAL_MIN", 30) * 60;
+    int widget_interval_s = env_int("WIDGET_INTERVAL_MIN", 1) * 60;
+    // Wake-ups are aligned to the widget interval; a fetch which is almost due is done now
+    bool fetch = !s_widgets || s_last_fetch == 0 || now < s_last_fetch ||
+                 now - s_last_fetch > fetch_interval_s - widget_interval_s / 2;
+    if (fetch) {
+        connect_start = esp_timer_get_time();
+        connect_end = connect_start;
+        ESP_GOTO_ON_ERROR(app_wifi_connect_start(), end, TAG, "Failed to start WiFi connection");
+    }
 
-    // Initialize the screen
-    app_display_init();
+    // Initialize the screen; a clear, if needed, overlaps with the connection and the download
+    ESP_GOTO_ON_ERROR(app_display_init(), end, TAG, "Failed to init the display");
+    app_display_prepare();
+    log_psram("display init");
 
     app_stats_t old_stats;
     app_get_stats(&old_stats);
-    ESP_LOGI(TAG, "S: %d F: %d Act: %ds Conn: %ds",
+    ESP_LOGI(TAG, "S: %d F: %d Act: %ds W: %d Act: %ds Conn: %ds",
              old_stats.success_count,
              old_stats.fail_count,
              old_stats.awake_time_ms / 1000,
+             old_stats.widget_count,
+             old_stats.widget_awake_time_ms / 1000,
              old_stats.connecting_time_ms / 1000);
+    static const char *band_names[APP_TEMPERATURE_BANDS] = { "<10C", "10-19C", "20-29C", ">=30C" };
+    for (int i = 0; i < APP_TEMPERATURE_BANDS; i++) {
+        if (old_stats.refreshes_by_band[i] > 0) {
+            ESP_LOGI(TAG, "Refresh %s: %u x %u ms", band_names[i], old_stats.refreshes_by_band[i],
+                     old_stats.refresh_ms_by_band[i] / old_stats.refreshes_by_band[i]);
+        }
+    }
+
+    if (!fetch && !app_display_frame_known()) {
+        // The widgets can't be drawn over a frame which isn't known
+        ESP_LOGI(TAG, "No saved frame, fetching it");
+        fetch = true;
+        connect_start = esp_timer_get_time();
+        connect_end = connect_start;
+        ESP_GOTO_ON_ERROR(app_wifi_connect_start(), end, TAG, "Failed to start WiFi connection");
+    }
+    if (!fetch) {
+        ESP_LOGI(TAG, "Updating the widgets");
+        bool stale = s_last_success == 0 || now - s_last_success > 2 * fetch_interval_s;
+        app_display_widgets(&s_widget_area, s_last_success, stale);
+        app_display_refresh(&stats);
+        widgets_only = true;
+        ret = ESP_OK;
+        goto end;
+    }
+    s_last_fetch = now;
 
     // Wait for WiFi connection
     ESP_GOTO_ON_ERROR(app_wifi_wait_for_connection(), end, TAG, "Failed to connect to WiFi");
     connect_end = esp_timer_get_time();
+    if (s_widgets) {
+        // The clock is set while the image downloads
+        s_time_sync = app_time_sync_start() == ESP_OK;
+    }
 
-    // Download and display the PNG
-    ESP_LOGI(TAG, "Downloading...");
-    char *png_buf;
-    size_t png_len;
-    FILE *f = open_memstream(&png_buf, &png_len);
-    download_file_config_t download_config = DOWNLOAD_FILE_CONFIG_DEFAULT();
-    download_config.http_client_post_init_cb = &set_headers;
-    const char *png_url = getenv("PNG_URL");
-    ESP_GOTO_ON_FALSE(png_url != NULL, ESP_ERR_NOT_FOUND, end, TAG, "PNG_URL not set in .env");
-    ESP_GOTO_ON_ERROR(download_file(png_url, f, &download_config), end, TAG, "Failed to download file");
-    fflush(f);
-    app_wifi_stop();
-
-    ESP_GOTO_ON_FALSE(png_len > 0, ESP_ERR_INVALID_SIZE, end, TAG, "PNG file is empty");
-
-    ESP_LOGI(TAG, "Rendering...");
-    app_display_png((const uint8_t *) png_buf, png_len);
+    // With a layout, regions of the screen are fetched separately
+    int drawn = 0;
+    const char *layout_str = getenv("LAYOUT");
+    if (layout_str != NULL && strlen(layout_str) > 0) {
+        ret = update_layout(layout_str, &stats, &drawn);
+    } else {
+        ret = update_image(&stats, &drawn);
+    }
+    // The clock may have been set meanwhile
+    s_last_fetch = time(NULL);
+    if (ret == ESP_OK) {
+        s_last_success = s_last_fetch;
+        if (s_widgets) {
+            app_display_widgets(&s_widget_area, s_last_success, false);
+            drawn++;
+        }
+    }
+    if (drawn > 0) {
+        ESP_LOGI(TAG, "Rendering...");
+        app_display_refresh(&stats);
+        log_psram("refresh");
+    }
 
 end:
     end = esp_timer_get_time();
-    app_stats_t stats = {
-        .success_count = ret == ESP_OK,
-        .fail_count = ret != ESP_OK,
-        .connecting_time_ms = (connect_end - connect_start) / 1000,
-        .awake_time_ms = end / 1000,
-
-    };
-    ESP_LOGI(TAG, "S%d/F%d A%ds C%ds D%ds\n",
+    // Wake-ups which only updated the widgets are counted apart, so that the counts and times are per fetch
+    if (widgets_only) {
+        stats.widget_count = 1;
+        stats.widget_awake_time_ms = end / 1000;
+    } else {
+        stats.success_count = ret == ESP_OK;
+        stats.fail_count = ret != ESP_OK;
+        stats.awake_time_ms = end / 1000;
+    }
+    stats.connecting_time_ms = (connect_end - connect_start) / 1000;
+    stats.timeline.connect_start = connect_start;
+    stats.timeline.connect_end = connect_end;
+    log_timeline(&stats.timeline);
+    ESP_LOGI(TAG, "S%d/F%d/W%d A%ds C%ds D%ds %dB Dec%dms (%dms hidden)\n",
              stats.success_count,
              stats.fail_count,
-             stats.awake_time_ms / 1000,
+             stats.widget_count,
+             (stats.awake_time_ms + stats.widget_awake_time_ms) / 1000,
              stats.connecting_time_ms / 1000,
-             stats.display_on_time_ms / 1000);
+             stats.display_on_time_ms / 1000,
+             stats.image_bytes,
+             stats.decode_time_ms,
+             stats.decode_hidden_ms);
     app_update_stats(&stats);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Error: %s", esp_err_to_name(ret));
+        error_log_save(ret, time(NULL));
         app_display_show_log();
     }
     power_off();
 }
 
+static esp_err_t set_request_headers(const image_request_t *request, esp_http_client_handle_t http_client)
+{
+    // A reused client still has the headers of the previous request
+    esp_http_client_delete_header(http_client, "If-None-Match");
+    esp_http_client_delete_header(http_client, "If-Modified-Since");
+    esp_http_client_delete_header(http_client, "X-Frame-CRC");
+    esp_http_client_delete_header(http_client, "Accept");
+    if (request->etag != NULL) {
+        ESP_RETURN_ON_ERROR(esp_http_client_set_header(http_client, "If-None-Match", request->etag), TAG, "Failed to set header");
+    }
+    if (request->last_modified != NULL) {
+        ESP_RETURN_ON_ERROR(esp_http_client_set_header(http_client, "If-Modified-Since", request->last_modified), TAG, "Failed to set header");
+    }
+    if (request->send_frame_crc) {
+        char crc_str[9];
+        snprintf(crc_str, sizeof(crc_str), "%08" PRIx32, request->frame_crc);
+        ESP_RETURN_ON_ERROR(esp_http_client_set_header(http_client, "X-Frame-CRC", crc_str), TAG, "Failed to set header");
+        ESP_RETURN_ON_ERROR(esp_http_client_set_header(http_client, "Accept", "application/x-epd-delta, image/png, image/jpeg"), TAG, "Failed to set header");
+    }
+    return ESP_OK;
+}
+
 static esp_err_t set_headers(void *user_data, esp_http_client_handle_t http_client)
 {
+    ESP_RETURN_ON_ERROR(set_request_headers((const image_request_t *) user_data, http_client), TAG, "Failed to set headers");
     const char *headers = getenv("HTTP_HEADERS");
     if (headers == NULL || strlen(headers) == 0) {
         ESP_LOGI(TAG, "HTTP_HEADERS not set in .env");
@@ -138,16 +277,278 @@ out:
     return ret;
 }
 
-static void power_off(void)
+static esp_err_t write_image_data(void *user_data, const void *data, size_t len)
 {
-    app_display_poweroff();
+    return app_display_image_write(((image_request_t *) user_data)->image, data, len);
+}
 
-    int refresh_interval_min = 30;
-    const char *refresh_interval_min_str = getenv("REFRESH_INTERVAL_MIN");
-    if (refresh_interval_min_str != NULL) {
-        refresh_interval_min = atoi(refresh_interval_min_str);
+/*
+ * Download an image and decode it into area of the framebuffer, or the whole screen if area is NULL.
+ * Unless the server answered 304 Not Modified, request->image is left for app_display_image_end.
+ */
+static esp_err_t download_image(const char *url, const EpdRect *area, esp_http_client_handle_t client, image_request_t *request)
+{
+    ESP_RETURN_ON_ERROR(app_display_image_begin(area, &request->image), TAG, "Failed to start decoding");
+    download_file_config_t download_config = DOWNLOAD_FILE_CONFIG_DEFAULT();
+    download_config.http_client_post_init_cb = &set_headers;
+    download_config.data_cb = &write_image_data;
+    download_config.header_cb = &image_header;
+    download_config.user_data = request;
+    download_config.download_task_stack = 8192;    // libpng runs in the download task
+    download_config.client = client;
+    download_config.http_status = &request->http_status;
+    esp_err_t ret = download_file(url, NULL, &download_config);
+    if (ret != ESP_OK || request->http_status == HttpStatus_NotModified) {
+        app_display_image_abort(request->image);
+        request->image = NULL;
+    }
+    return ret;
+}
+
+/* Download the image (PNG_URL), decoding it into the framebuffer while the data arrives */
+static esp_err_t update_image(app_stats_t *stats, int *out_drawn)
+{
+    ESP_LOGI(TAG, "Downloading...");
+    const char *png_url = getenv("PNG_URL");
+    ESP_RETURN_ON_FALSE(png_url != NULL, ESP_ERR_NOT_FOUND, TAG, "PNG_URL not set in .env");
+    image_request_t request = { 0 };
+    // The server can't know the widgets, so a patch would never apply to a frame with them
+    request.send_frame_crc = !s_widgets && app_display_frame_crc(&request.frame_crc);
+    // One client for the download and the error log upload, which then share the connection
+    esp_http_client_handle_t client = NULL;
+    download_file_config_t client_config = DOWNLOAD_FILE_CONFIG_DEFAULT();
+    stats->timeline.download_start = esp_timer_get_time();
+    esp_err_t ret = download_file_client_create(png_url, &client_config, &client);
+    if (ret == ESP_OK) {
+        ret = download_image(png_url, NULL, client, &request);
+    }
+    if (ret == ESP_ERR_INVALID_VERSION) {
+        ESP_LOGW(TAG, "The patch is for another frame, downloading the full image");
+        request = (image_request_t) {
+            0
+        };
+        ret = download_image(png_url, NULL, client, &request);
     }
-    uint64_t wakeup_interval_us = refresh_interval_min * (60ULL * 1000 * 1000);
-    esp_sleep_enable_timer_wakeup(wakeup_interval_us);
+    stats->timeline.download_end = esp_timer_get_time();
+    log_psram("download");
+    stop_network(client, ret == ESP_OK);
+    if (client != NULL) {
+        esp_http_client_cleanup(client);
+    }
+    ESP_RETURN_ON_ERROR(ret, TAG, "Failed to download file");
+    if (request.image == NULL) {
+        // 304: the frame on the panel is current
+        ESP_LOGI(TAG, "Image not modified");
+        *out_drawn = 0;
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(app_display_image_end(request.image, stats), TAG, "Failed to display image");
+    *out_drawn = 1;
+    return ESP_OK;
+}
+
+/*
+ * Fetch the regions which are due, one after another over one connection, each decoded
+ * into its area of the framebuffer, so that one refresh shows all of them.
+ * A region whose image didn't change costs a 304 response.
+ */
+static esp_err_t update_layout(const char *layout_str, app_stats_t *stats, int *out_drawn)
+{
+    layout_t layout;
+    ESP_RETURN_ON_ERROR(layout_parse(layout_str, &layout), TAG, "Invalid LAYOUT in .env");
+    if (!app_display_frame_known()) {
+        // The screen will be redrawn from scratch, every region is needed
+        layout_forget();
+    }
+
+    esp_err_t ret = ESP_OK;
+    esp_http_client_handle_t client = NULL;
+    int64_t now = time(NULL);
+    int updated = 0;
+    stats->timeline.download_start = esp_timer_get_time();
+    for (int i = 0; i < layout.count; i++) {
+        const layout_region_t *region = &layout.regions[i];
+        if (!layout_region_due(&layout, i, now)) {
+            continue;
+        }
+        if (client == NULL) {
+            download_file_config_t client_config = DOWNLOAD_FILE_CONFIG_DEFAULT();
+            ESP_GOTO_ON_ERROR(download_file_client_create(region->url, &client_config, &client), out, TAG, "Failed to create HTTP client");
+        }
+        image_request_t request = {
+            .etag = layout_region_etag(&layout, i),
+            .last_modified = layout_region_last_modified(&layout, i),
+        };
+        esp_err_t err = download_image(region->url, &region->area, client, &request);
+        if (err == ESP_OK && request.image != NULL) {
+            err = app_display_image_end(request.image, stats);
+            updated += err == ESP_OK;
+        }
+        if (err != ESP_OK) {
+            // The other regions are still worth updating
+            ESP_LOGE(TAG, "Region %d: %s", i, esp_err_to_name(err));
+            ret = ret == ESP_OK ? err : ret;
+            continue;
+        }
+        bool not_modified = request.http_status == HttpStatus_NotModified;
+        ESP_LOGI(TAG, "Region %d: %s", i, not_modified ? "not modified" : "updated");
+        // A 304 response may leave the validators out; they stay the same then
+        layout_region_fetched(&layout, i, now,
+                              not_modified && request.new_etag[0] == '\0' ? request.etag : request.new_etag,
+                              not_modified && request.new_last_modified[0] == '\0' ? request.last_modified : request.new_last_modified);
+    }
+
+out:
+    stats->timeline.download_end = esp_timer_get_time();
+    log_psram("download");
+    stop_network(client, ret == ESP_OK);
+    if (client != NULL) {
+        esp_http_client_cleanup(client);
+    }
+    layout_free(&layout);
+    *out_drawn = updated;
+    return ret;
+}
+
+/*
+ * Turn Wi-Fi off, giving SNTP a moment to set the clock first if it hasn't yet.
+ * If the downloads went well, the logs of earlier failed wake-ups are uploaded before,
+ * over the client of the downloads (which may be NULL).
+ */
+static void stop_network(esp_http_client_handle_t client, bool upload_logs)
+{
+    if (upload_logs && error_log_count() > 0) {
+        upload_error_log(client);
+    }
+    if (s_time_sync) {
+        app_time_sync_finish(TIME_SYNC_WAIT_MS);
+        s_time_sync = false;
+    }
+    app_wifi_stop();
+}
+
+/* POST the kept error logs to ERROR_LOG_URL as text, one after another */
+static esp_err_t upload_error_log(esp_http_client_handle_t client)
+{
+    const char *url = getenv("ERROR_LOG_URL");
+    if (url == NULL || strlen(url) == 0) {
+        ESP_LOGI(TAG, "ERROR_LOG_URL not set in .env, keeping %d error logs", error_log_count());
+        return ESP_OK;
+    }
+    esp_err_t ret = ESP_OK;
+    esp_http_client_handle_t own_client = NULL;
+    image_request_t no_request = { 0 };
+    size_t len;
+    char *text = error_log_text(&len);
+    ESP_GOTO_ON_FALSE(text != NULL, ESP_ERR_NO_MEM, out, TAG, "No memory for the error logs");
+    if (client == NULL) {
+        // Nothing was downloaded
+        download_file_config_t client_config = DOWNLOAD_FILE_CONFIG_DEFAULT();
+        ESP_GOTO_ON_ERROR(download_file_client_create(url, &client_config, &own_client), out, TAG, "Failed to create HTTP client");
+        client = own_client;
+        ESP_GOTO_ON_ERROR(set_headers(&no_request, client), out, TAG, "Failed to set headers");
+    } else {
+        // Still has the headers of the downloads, HTTP_HEADERS included
+        ESP_GOTO_ON_ERROR(set_request_headers(&no_request, client), out, TAG, "Failed to set headers");
+    }
+    ESP_GOTO_ON_ERROR(download_file_post(client, url, "text/plain", text, len, NULL), out, TAG, "Failed to upload the error logs");
+    ESP_LOGI(TAG, "Uploaded %d error logs, %u bytes", error_log_count(), (unsigned) len);
+    error_log_clear();
+
+out:
+    free(text);
+    if (own_client != NULL) {
+        esp_http_client_cleanup(own_client);
+    }
+    return ret;
+}
+
+/* Overlap of [a_start, a_end) and [b_start, b_end), in ms */
+static int overlap_ms(int64_t a_start, int64_t a_end, int64_t b_start, int64_t b_end)
+{
+    int64_t overlap = MIN(a_end, b_end) - MAX(a_start, b_start);
+    return overlap > 0 ? (int) (overlap / 1000) : 0;
+}
+
+static void log_timeline(const app_timeline_t *t)
+{
+    ESP_LOGI(TAG, "Timeline (ms): connect %d-%d, download %d-%d, panel prep %d-%d, refresh %d-%d",
+             (int) (t->connect_start / 1000), (int) (t->connect_end / 1000),
+             (int) (t->download_start / 1000), (int) (t->download_end / 1000),
+             (int) (t->panel_prep_start / 1000), (int) (t->panel_prep_end / 1000),
+             (int) (t->refresh_start / 1000), (int) (t->refresh_end / 1000));
+    if (t->panel_prep_end > t->panel_prep_start) {
+        ESP_LOGI(TAG, "Panel prep overlapped connect by %d ms, download by %d ms",
+                 overlap_ms(t->panel_prep_start, t->panel_prep_end, t->connect_start, t->connect_end),
+                 overlap_ms(t->panel_prep_start, t->panel_prep_end, t->download_start, t->download_end));
+    }
+}
+
+/*
+ * PSRAM use at the end of a phase. The peak is the high-water mark since boot:
+ * if it grew, this phase set it. The largest free block shows fragmentation.
+ */
+static void log_psram(const char *phase)
+{
+    size_t total = heap_caps_get_total_size(MALLOC_CAP_SPIRAM);
+    ESP_LOGI(TAG, "PSRAM after %s: %u kB used, %u kB peak, %u kB largest free block", phase,
+             (unsigned) ((total - heap_caps_get_free_size(MALLOC_CAP_SPIRAM)) / 1024),
+             (unsigned) ((total - heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM)) / 1024),
+             (unsigned) (heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) / 1024));
+}
+
+static void image_header(void *user_data, const char *key, const char *value)
+{
+    image_request_t *request = (image_request_t *) user_data;
+    if (strcasecmp(key, "Content-Type") == 0) {
+        app_display_image_set_content_type(request->image, value);
+    } else if (strcasecmp(key, "ETag") == 0) {
+        layout_copy_validator(request->new_etag, sizeof(request->new_etag), value);
+    } else if (strcasecmp(key, "Last-Modified") == 0) {
+        layout_copy_validator(request->new_last_modified, sizeof(request->new_last_modified), value);
+    }
+}
+
+static int env_int(const char *name, int default_value)
+{
+    const char *str = getenv(name);
+    return str != NULL && strlen(str) > 0 ? atoi(str) : default_value;
+}
+
+/* WIDGET_AREA from .env, "x,y,width,height" */
+static bool widget_area(EpdRect *out_area)
+{
+    const char *str = getenv("WIDGET_AREA");
+    if (str == NULL || strlen(str) == 0) {
+        return false;
+    }
+    EpdRect area;
+    if (sscanf(str, "%d,%d,%d,%d", &area.x, &area.y, &area.width, &area.height) != 4 ||
+            area.x < 0 || area.y < 0 || area.width <= 0 || area.height <= 0 ||
+            area.x + area.width > EPD_WIDTH || area.y + area.height > EPD_HEIGHT) {
+        ESP_LOGE(TAG, "Invalid WIDGET_AREA in .env: %s", str);
+        return false;
+    }
+    *out_area = area;
+    return true;
+}
+
+static uint64_t sleep_time_us(void)
+{
+    if (!s_widgets) {
+        return env_int("REFRESH_INTERVAL_MIN", 30) * (60ULL * 1000 * 1000);
+    }
+    // Wake up at the start of the next interval, so that the clock is right for all of it
+    int interval_s = MAX(env_int("WIDGET_INTERVAL_MIN", 1), 1) * 60;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t into_interval_us = (int64_t) (tv.tv_sec % interval_s) * 1000000 + tv.tv_usec;
+    return interval_s * 1000000ULL - into_interval_us;
+}
+
+static void power_off(void)
+{
+    app_display_poweroff();
+    esp_sleep_enable_timer_wakeup(sleep_time_us());
     esp_deep_sleep_start();
 }
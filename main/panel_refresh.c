@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "panel_refresh.h"
+#include "row_pipeline.h"
+
+enum EpdDrawMode panel_refresh_epd_mode(refresh_waveform_t waveform)
+{
+    switch (waveform) {
+    case REFRESH_WAVEFORM_DU:
+        return MODE_DU;
+    case REFRESH_WAVEFORM_GL16:
+        return MODE_GL16;
+    default:
+        return MODE_GC16;
+    }
+}
+
+void panel_refresh_plan(const refresh_policy_config_t *config, const uint8_t *fb, const uint8_t *panel,
+                        uint32_t fast_updates, refresh_content_t content, panel_refresh_plan_t *out_plan)
+{
+    *out_plan = (panel_refresh_plan_t) {
+        0
+    };
+    if (panel != NULL) {
+        out_plan->area_count = dirty_rects_find(fb, panel, EPD_WIDTH, EPD_HEIGHT, out_plan->areas,
+                                                PANEL_REFRESH_MAX_AREAS, &out_plan->changes);
+    }
+    refresh_policy_input_t input = {
+        .panel_known = panel != NULL,
+        .total_pixels = EPD_WIDTH * EPD_HEIGHT,
+        .changed_pixels = out_plan->changes.changed_pixels,
+        .changed_to_gray = out_plan->changes.changed_to_gray,
+        .fast_updates = fast_updates,
+        .content = content,
+    };
+    out_plan->decision = refresh_policy_choose(config, &input);
+    out_plan->epd_mode = panel_refresh_epd_mode(out_plan->decision.waveform);
+}
+
+void panel_refresh_run(EpdiyHighlevelState *hl, const panel_refresh_plan_t *plan, int temperature, bool cleared)
+{
+    epd_poweron();
+    if (plan->decision.mode == REFRESH_FULL) {
+        if (!cleared) {
+            epd_clear();
+        }
+        // The panel is white now, every pixel which isn't has to be drawn
+        memset(hl->back_fb, 0xFF, FB_SIZE);
+        epd_hl_update_screen(hl, plan->epd_mode, temperature);
+    } else {
+        for (int i = 0; i < plan->area_count; i++) {
+            epd_hl_update_area(hl, plan->epd_mode, temperature, plan->areas[i]);
+        }
+    }
+    epd_poweroff();
+}
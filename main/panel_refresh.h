@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "epd_driver.h"
+#include "epd_highlevel.h"
+#include "dirty_rect.h"
+#include "refresh_policy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The refresh of the panel from the two buffers of epdiy's highlevel state: what changed,
+ * what the refresh policy makes of it, and the epdiy calls which carry it out. Shared by
+ * display.c and the host benchmark, which replays it against the simulated panel.
+ */
+
+/* Changed areas are merged down to this many */
+#define PANEL_REFRESH_MAX_AREAS 8
+
+typedef struct {
+    refresh_decision_t decision;
+    enum EpdDrawMode epd_mode;  /*!< The waveform of the decision */
+    EpdRect areas[PANEL_REFRESH_MAX_AREAS];  /*!< To update in a partial refresh */
+    int area_count;
+    dirty_stats_t changes;
+} panel_refresh_plan_t;
+
+/**
+ * @brief The epdiy draw mode of a waveform
+ */
+enum EpdDrawMode panel_refresh_epd_mode(refresh_waveform_t waveform);
+
+/**
+ * @brief Find what changed and choose how to refresh
+ *
+ * @param config  Policy thresholds
+ * @param fb  The new frame
+ * @param panel  What the panel shows, NULL if that isn't known; the refresh is a full one then
+ * @param fast_updates  Partial updates since the last full refresh
+ * @param content  Class of the new frame, see refresh_policy_classify
+ * @param[out] out_plan  The decision and the areas to update
+ */
+void panel_refresh_plan(const refresh_policy_config_t *config, const uint8_t *fb, const uint8_t *panel,
+                        uint32_t fast_updates, refresh_content_t content, panel_refresh_plan_t *out_plan);
+
+/**
+ * @brief Carry out a plan which isn't REFRESH_SKIP, powering the panel on and off
+ *
+ * After a full refresh the back buffer matches the panel.
+ *
+ * @param cleared  The panel has been cleared already, a full refresh draws on it right away
+ */
+void panel_refresh_run(EpdiyHighlevelState *hl, const panel_refresh_plan_t *plan, int temperature, bool cleared);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,390 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "png.h"
+#include "png_decoder.h"
+#include "row_pipeline.h"
+#include "tone.h"
+
+/* Number of decoded rows which can be waiting for the pack task */
+#define ROW_QUEUE_LEN 8
+#define PACK_TASK_STACK 3072
+#define PACK_TASK_PRIORITY 2
+
+#if CONFIG_APP_PNG_HEAP_INTERNAL
+#define INTERNAL_BUDGET (CONFIG_APP_PNG_INTERNAL_BUDGET_KB * 1024)
+#else
+#define INTERNAL_BUDGET 0
+#endif
+
+static const char *TAG = "png_decoder";
+
+struct png_decoder {
+    image_decoder_config_t config;
+    png_structp png;
+    png_infop info;
+    esp_err_t error;            // first error, returned from all later calls
+    png_uint_32 width;
+    png_uint_32 height;
+    int channels;               // bytes per pixel after libpng transforms
+    size_t row_bytes;
+    uint8_t palette_gray[256];  // palette index -> gray, built per image
+    row_pipeline_t *pipeline;
+    uint8_t *image;             // whole image, for interlaced PNGs only
+    uint8_t *row_pool;          // ROW_QUEUE_LEN row buffers
+    QueueHandle_t free_rows;
+    QueueHandle_t full_rows;
+    SemaphoreHandle_t pack_done;
+    bool pack_running;
+    bool complete;              // the end of the image was decoded
+    int64_t queue_wait_us;      // time the writer spent blocked on the row queue
+    int64_t inflate_us;         // time spent in libpng (inflate and unfiltering), in the writing task
+    int64_t pack_us;            // time spent converting, resampling and packing rows, in the pack task
+    size_t heap_internal;       // libpng memory currently allocated in internal RAM
+    size_t heap_external;       // ... and in PSRAM
+    size_t heap_internal_peak;
+    size_t heap_external_peak;
+};
+
+static void png_info_cb(png_structp png, png_infop info);
+static void png_row_cb(png_structp png, png_bytep new_row, png_uint_32 row_num, int pass);
+static void png_end_cb(png_structp png, png_infop info);
+static void pack_task(void *arg);
+
+static void png_log_error(png_structp png, png_const_charp msg)
+{
+    ESP_LOGE(TAG, "libpng: %s", msg);
+    png_longjmp(png, 1);
+}
+
+static void png_log_warning(png_structp png, png_const_charp msg)
+{
+    ESP_LOGW(TAG, "libpng: %s", msg);
+}
+
+static void account_heap(png_decoder_t *dec, void *ptr, bool alloc)
+{
+    size_t size = heap_caps_get_allocated_size(ptr);
+    size_t *used = esp_ptr_internal(ptr) ? &dec->heap_internal : &dec->heap_external;
+    size_t *peak = esp_ptr_internal(ptr) ? &dec->heap_internal_peak : &dec->heap_external_peak;
+    *used = alloc ? *used + size : *used - size;
+    *peak = MAX(*peak, *used);
+}
+
+/* libpng allocates the zlib state and window and its row buffers through these */
+static png_voidp png_malloc_cb(png_structp png, png_alloc_size_t size)
+{
+    png_decoder_t *dec = (png_decoder_t *) png_get_mem_ptr(png);
+    void *ptr = NULL;
+    if (dec->heap_internal + size <= INTERNAL_BUDGET) {
+        ptr = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+#if CONFIG_APP_PNG_HEAP_PSRAM
+    if (ptr == NULL) {
+        ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+#endif
+    if (ptr == NULL) {
+        ptr = malloc(size);
+    }
+    if (ptr != NULL) {
+        account_heap(dec, ptr, true);
+    }
+    return ptr;
+}
+
+static void png_free_cb(png_structp png, png_voidp ptr)
+{
+    if (ptr != NULL) {
+        account_heap((png_decoder_t *) png_get_mem_ptr(png), ptr, false);
+        free(ptr);
+    }
+}
+
+/* Buffers holding the whole image are only touched once per pixel, they belong in PSRAM */
+static void *bulk_calloc(size_t n, size_t size)
+{
+#if CONFIG_SPIRAM
+    void *ptr = heap_caps_calloc(n, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (ptr != NULL) {
+        return ptr;
+    }
+#endif
+    return calloc(n, size);
+}
+
+esp_err_t png_decoder_create(const image_decoder_config_t *config, png_decoder_t **out_decoder)
+{
+    png_decoder_t *dec = calloc(1, sizeof(*dec));
+    ESP_RETURN_ON_FALSE(dec != NULL, ESP_ERR_NO_MEM, TAG, "Failed to allocate decoder");
+    dec->config = *config;
+
+    dec->png = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, dec, &png_log_error, &png_log_warning,
+                                        dec, &png_malloc_cb, &png_free_cb);
+    if (dec->png != NULL) {
+        dec->info = png_create_info_struct(dec->png);
+    }
+    if (dec->info == NULL) {
+        png_decoder_delete(dec);
+        ESP_LOGE(TAG, "Failed to create PNG read struct");
+        return ESP_ERR_NO_MEM;
+    }
+    png_set_progressive_read_fn(dec->png, dec, &png_info_cb, &png_row_cb, &png_end_cb);
+    *out_decoder = dec;
+    return ESP_OK;
+}
+
+esp_err_t png_decoder_write(png_decoder_t *dec, const void *data, size_t len)
+{
+    if (dec->error != ESP_OK) {
+        return dec->error;
+    }
+    int64_t start = esp_timer_get_time();
+    dec->queue_wait_us = 0;
+    if (setjmp(png_jmpbuf(dec->png))) {
+        if (dec->error == ESP_OK) {
+            dec->error = ESP_FAIL;
+        }
+        return dec->error;
+    }
+    png_process_data(dec->png, dec->info, (png_bytep) data, len);
+    dec->inflate_us += esp_timer_get_time() - start - dec->queue_wait_us;
+    return ESP_OK;
+}
+
+static void stop_pack_task(png_decoder_t *dec)
+{
+    if (!dec->pack_running) {
+        return;
+    }
+    uint8_t *end_marker = NULL;
+    xQueueSend(dec->full_rows, &end_marker, portMAX_DELAY);
+    xSemaphoreTake(dec->pack_done, portMAX_DELAY);
+    dec->pack_running = false;
+}
+
+esp_err_t png_decoder_finish(png_decoder_t *dec, image_decoder_stats_t *out_stats)
+{
+    int64_t start = esp_timer_get_time();
+    stop_pack_task(dec);
+    int64_t finish_wait_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "inflate %d ms, pack %d ms; libpng heap peak %u B internal, %u B PSRAM",
+             (int) (dec->inflate_us / 1000), (int) (dec->pack_us / 1000),
+             (unsigned) dec->heap_internal_peak, (unsigned) dec->heap_external_peak);
+    if (out_stats != NULL) {
+        out_stats->decode_us = dec->inflate_us + dec->pack_us;
+        out_stats->finish_wait_us = finish_wait_us;
+        if (dec->pipeline != NULL) {
+            row_pipeline_get_stats(dec->pipeline, &out_stats->tone);
+        }
+    }
+    if (dec->error != ESP_OK) {
+        return dec->error;
+    }
+    ESP_RETURN_ON_FALSE(dec->complete, ESP_ERR_INVALID_SIZE, TAG, "PNG data ended before the end of the image");
+    return ESP_OK;
+}
+
+void png_decoder_delete(png_decoder_t *dec)
+{
+    stop_pack_task(dec);
+    if (dec->png != NULL) {
+        png_destroy_read_struct(&dec->png, dec->info ? &dec->info : NULL, NULL);
+    }
+    if (dec->pipeline != NULL) {
+        row_pipeline_delete(dec->pipeline);
+    }
+    if (dec->free_rows != NULL) {
+        vQueueDelete(dec->free_rows);
+    }
+    if (dec->full_rows != NULL) {
+        vQueueDelete(dec->full_rows);
+    }
+    if (dec->pack_done != NULL) {
+        vSemaphoreDelete(dec->pack_done);
+    }
+    free(dec->row_pool);
+    free(dec->image);
+    free(dec);
+}
+
+static inline uint8_t blend_on_white(uint8_t gray, uint8_t alpha)
+{
+    return 255 - ((255 - gray) * alpha + 127) / 255;
+}
+
+/* Build the palette index -> gray table, compositing transparent entries onto white */
+static void build_palette_lut(png_decoder_t *dec)
+{
+    png_colorp palette = NULL;
+    int num_palette = 0;
+    png_bytep trans_alpha = NULL;
+    int num_trans = 0;
+
+    png_get_PLTE(dec->png, dec->info, &palette, &num_palette);
+    if (png_get_valid(dec->png, dec->info, PNG_INFO_tRNS)) {
+        png_get_tRNS(dec->png, dec->info, &trans_alpha, &num_trans, NULL);
+    }
+    memset(dec->palette_gray, 255, sizeof(dec->palette_gray));
+    for (int i = 0; i < num_palette; i++) {
+        uint8_t gray = app_luma(palette[i].red, palette[i].green, palette[i].blue);
+        if (i < num_trans) {
+            gray = blend_on_white(gray, trans_alpha[i]);
+        }
+        dec->palette_gray[i] = gray;
+    }
+}
+
+/* Reduce one decoded row to one byte per pixel (gray, or palette index), in place */
+static void row_to_gray(int channels, uint8_t *row, int width)
+{
+    const uint8_t *src = row;
+    switch (channels) {
+    case 2:
+        for (int x = 0; x < width; x++, src += 2) {
+            row[x] = blend_on_white(src[0], src[1]);
+        }
+        break;
+    case 3:
+        for (int x = 0; x < width; x++, src += 3) {
+            row[x] = app_luma(src[0], src[1], src[2]);
+        }
+        break;
+    case 4:
+        for (int x = 0; x < width; x++, src += 4) {
+            row[x] = blend_on_white(app_luma(src[0], src[1], src[2]), src[3]);
+        }
+        break;
+    }
+}
+
+static void fail(png_decoder_t *dec, esp_err_t err, const char *msg)
+{
+    dec->error = err;
+    png_error(dec->png, msg);
+}
+
+static void png_info_cb(png_structp png, png_infop info)
+{
+    png_decoder_t *dec = (png_decoder_t *) png_get_progressive_ptr(png);
+    int bit_depth, color_type;
+    png_get_IHDR(png, info, &dec->width, &dec->height, &bit_depth, &color_type, NULL, NULL, NULL);
+
+    row_pipeline_config_t pipeline_config = {
+        .src_width = dec->width,
+        .src_height = dec->height,
+        .dst = dec->config.dst,
+        .scale = dec->config.scale,
+        .fb = dec->config.fb,
+    };
+    if (bit_depth == 16) {
+        png_set_strip_16(png);
+    }
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        // Keep the indices: one byte per pixel, mapped through the per-image table
+        png_set_packing(png);
+        build_palette_lut(dec);
+        pipeline_config.value_to_gray = dec->palette_gray;
+    } else {
+        if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
+            png_set_expand_gray_1_2_4_to_8(png);
+        }
+        if (png_get_valid(png, info, PNG_INFO_tRNS)) {
+            png_set_tRNS_to_alpha(png);
+        }
+    }
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+    dec->channels = png_get_channels(png, info);
+    dec->row_bytes = png_get_rowbytes(png, info);
+
+    ESP_LOGD(TAG, "PNG size: %" PRIu32 "x%" PRIu32 " color_type=%d channels=%d passes=%d",
+             dec->width, dec->height, color_type, dec->channels, passes);
+
+    if (row_pipeline_create(&pipeline_config, &dec->pipeline) != ESP_OK) {
+        fail(dec, ESP_ERR_INVALID_SIZE, "unsupported image size");
+    }
+    // Interlaced images are only complete after the last pass, so keep all rows until then
+    if (passes > 1) {
+        dec->image = bulk_calloc(dec->height, dec->row_bytes);
+    }
+    dec->row_pool = malloc(ROW_QUEUE_LEN * dec->row_bytes);
+    dec->free_rows = xQueueCreate(ROW_QUEUE_LEN, sizeof(uint8_t *));
+    dec->full_rows = xQueueCreate(ROW_QUEUE_LEN, sizeof(uint8_t *));
+    dec->pack_done = xSemaphoreCreateBinary();
+    if ((passes > 1 && dec->image == NULL) || dec->row_pool == NULL ||
+            dec->free_rows == NULL || dec->full_rows == NULL || dec->pack_done == NULL) {
+        fail(dec, ESP_ERR_NO_MEM, "out of memory");
+    }
+    for (int i = 0; i < ROW_QUEUE_LEN; i++) {
+        uint8_t *row = dec->row_pool + i * dec->row_bytes;
+        xQueueSend(dec->free_rows, &row, 0);
+    }
+    if (xTaskCreatePinnedToCore(&pack_task, "png_pack", PACK_TASK_STACK, dec, PACK_TASK_PRIORITY,
+                                NULL, dec->config.task_core) != pdPASS) {
+        fail(dec, ESP_ERR_NO_MEM, "failed to create pack task");
+    }
+    dec->pack_running = true;
+}
+
+static void send_row(png_decoder_t *dec, const uint8_t *row)
+{
+    uint8_t *buf;
+    int64_t start = esp_timer_get_time();
+    xQueueReceive(dec->free_rows, &buf, portMAX_DELAY);
+    dec->queue_wait_us += esp_timer_get_time() - start;
+    memcpy(buf, row, dec->row_bytes);
+    xQueueSend(dec->full_rows, &buf, portMAX_DELAY);
+}
+
+static void png_row_cb(png_structp png, png_bytep new_row, png_uint_32 row_num, int pass)
+{
+    png_decoder_t *dec = (png_decoder_t *) png_get_progressive_ptr(png);
+    if (new_row == NULL) {
+        return;
+    }
+    if (dec->image != NULL) {
+        png_progressive_combine_row(png, dec->image + row_num * dec->row_bytes, new_row);
+        return;
+    }
+    send_row(dec, new_row);
+}
+
+static void png_end_cb(png_structp png, png_infop info)
+{
+    png_decoder_t *dec = (png_decoder_t *) png_get_progressive_ptr(png);
+    if (dec->image != NULL) {
+        for (png_uint_32 y = 0; y < dec->height; y++) {
+            send_row(dec, dec->image + y * dec->row_bytes);
+        }
+    }
+    dec->complete = true;
+}
+
+static void pack_task(void *arg)
+{
+    png_decoder_t *dec = (png_decoder_t *) arg;
+    uint8_t *row;
+    while (xQueueReceive(dec->full_rows, &row, portMAX_DELAY) == pdTRUE && row != NULL) {
+        int64_t start = esp_timer_get_time();
+        row_to_gray(dec->channels, row, dec->width);
+        row_pipeline_push(dec->pipeline, row);
+        dec->pack_us += esp_timer_get_time() - start;
+        xQueueSend(dec->free_rows, &row, portMAX_DELAY);
+    }
+    xSemaphoreGive(dec->pack_done);
+    vTaskDelete(NULL);
+}
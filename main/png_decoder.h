@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "image_decoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct png_decoder png_decoder_t;
+
+/**
+ * @brief Create a streaming PNG decoder
+ *
+ * Data is inflated and unfiltered in the task calling png_decoder_write, as it arrives.
+ * Finished rows are passed through a bounded queue to a pack task running on
+ * config->task_core, which converts them to panel levels and writes them into the framebuffer.
+ */
+esp_err_t png_decoder_create(const image_decoder_config_t *config, png_decoder_t **out_decoder);
+
+/**
+ * @brief Feed the next chunk of PNG data
+ *
+ * Blocks if the row queue is full. After an error, all further calls return the same error.
+ */
+esp_err_t png_decoder_write(png_decoder_t *decoder, const void *data, size_t len);
+
+/**
+ * @brief Wait until all rows are in the framebuffer
+ *
+ * @return ESP_OK if the complete image was decoded
+ */
+esp_err_t png_decoder_finish(png_decoder_t *decoder, image_decoder_stats_t *out_stats);
+
+/**
+ * @brief Stop the pack task (if still running) and free the decoder
+ */
+void png_decoder_delete(png_decoder_t *decoder);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,280 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "epd_driver.h"
+#include "row_pipeline.h"
+#include "tone.h"
+
+/*
+ * Source pixels are resampled with a box filter. With the scale factor num / den,
+ * source pixel i covers [i * num, (i + 1) * num) and output pixel j covers
+ * [j * den, (j + 1) * den) on a common integer axis, so the weight of a source
+ * pixel in an output pixel is the length of the overlap of these two spans.
+ * Rows are filtered horizontally as they arrive and accumulated vertically in a
+ * single row, which is emitted as soon as the output row is fully covered.
+ */
+
+#define MAX_SOURCE_SIZE 4096
+
+static const char *TAG = "row_pipeline";
+
+struct row_pipeline {
+    row_pipeline_config_t config;
+    uint32_t num;           // scale factor numerator
+    uint32_t den;           // scale factor denominator
+    int crop_x;             // first visible column of the scaled image
+    int crop_y;             // first visible row of the scaled image
+    int out_x;              // where the visible part lands on the display
+    int out_y;
+    int out_width;          // size of the visible part
+    int out_height;
+    int src_y;              // index of the next source row
+    bool direct;            // no scaling, source values map straight to levels
+    bool landscape;         // framebuffer can be written without rotation
+    uint8_t gray_lut[256];  // source value -> 8-bit gray
+    uint8_t level_lut[256]; // source value -> panel level
+    uint8_t *hrow;          // horizontally filtered row, out_width entries
+    uint32_t *acc;          // vertical accumulator, out_width entries
+    uint8_t *levels;        // output row, out_width entries
+    row_pipeline_stats_t stats;
+};
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Histogram and transitions are gathered here, while the row is in cache anyway */
+static void count_levels(row_pipeline_t *p, int count)
+{
+    const uint8_t *levels = p->levels;
+    uint32_t *histogram = p->stats.histogram;
+    uint32_t transitions = 0;
+    histogram[levels[0]]++;
+    for (int i = 1; i < count; i++) {
+        histogram[levels[i]]++;
+        transitions += levels[i] != levels[i - 1];
+    }
+    p->stats.transitions += transitions;
+}
+
+void row_pipeline_count_levels(EpdRect area, const uint8_t *fb, row_pipeline_stats_t *stats)
+{
+    for (int y = area.y; y < area.y + area.height; y++) {
+        const uint8_t *line = &fb[y * FB_STRIDE];
+        int prev = -1;
+        for (int x = area.x; x < area.x + area.width; x++) {
+            int level = (line[x / 2] >> (x % 2 ? 4 : 0)) & 0x0F;
+            stats->histogram[level]++;
+            stats->transitions += prev >= 0 && level != prev;
+            prev = level;
+        }
+    }
+}
+
+static void pack_levels(row_pipeline_t *p, int x, int y, int count)
+{
+    const uint8_t *levels = p->levels;
+    uint8_t *fb = p->config.fb;
+    count_levels(p, count);
+    if (!p->landscape) {
+        for (int i = 0; i < count; i++) {
+            epd_draw_pixel(x + i, y, fb_level_color(levels[i]), fb);
+        }
+        return;
+    }
+    uint8_t *dst = fb + y * FB_STRIDE + x / 2;
+    int i = 0;
+    if (x & 1) {
+        *dst = (*dst & 0x0F) | (levels[0] << 4);
+        dst++;
+        i = 1;
+    }
+    for (; i + 1 < count; i += 2) {
+        *dst++ = levels[i] | (levels[i + 1] << 4);
+    }
+    if (i < count) {
+        *dst = (*dst & 0xF0) | levels[i];
+    }
+}
+
+static void fill_white(uint8_t *fb, int x, int y, int width, int height)
+{
+    if (width > 0 && height > 0) {
+        EpdRect rect = { .x = x, .y = y, .width = width, .height = height };
+        epd_fill_rect(rect, 0xFF, fb);
+    }
+}
+
+esp_err_t row_pipeline_create(const row_pipeline_config_t *config, row_pipeline_t **out_pipeline)
+{
+    int src_w = config->src_width;
+    int src_h = config->src_height;
+    EpdRect dst = config->dst;
+    ESP_RETURN_ON_FALSE(src_w > 0 && src_h > 0 && src_w <= MAX_SOURCE_SIZE && src_h <= MAX_SOURCE_SIZE,
+                        ESP_ERR_INVALID_SIZE, TAG, "Unsupported image size %dx%d", src_w, src_h);
+
+    // Clip the target to the display
+    int disp_w = epd_rotated_display_width();
+    int disp_h = epd_rotated_display_height();
+    int x0 = MAX(dst.x, 0);
+    int y0 = MAX(dst.y, 0);
+    dst.width = MIN(dst.x + dst.width, disp_w) - x0;
+    dst.height = MIN(dst.y + dst.height, disp_h) - y0;
+    dst.x = x0;
+    dst.y = y0;
+    ESP_RETURN_ON_FALSE(dst.width > 0 && dst.height > 0, ESP_ERR_INVALID_ARG, TAG, "Target rectangle is off screen");
+
+    uint32_t num = 1;
+    uint32_t den = 1;
+    // dst.width / src_w < dst.height / src_h means the width is the limiting side when fitting
+    bool width_limited = (int64_t) dst.width * src_h <= (int64_t) dst.height * src_w;
+    if (config->scale == ROW_PIPELINE_SCALE_FIT || config->scale == ROW_PIPELINE_SCALE_FILL) {
+        bool use_width = (config->scale == ROW_PIPELINE_SCALE_FIT) == width_limited;
+        num = use_width ? dst.width : dst.height;
+        den = use_width ? src_w : src_h;
+        uint32_t d = gcd(num, den);
+        num /= d;
+        den /= d;
+    }
+    int scaled_w = MAX((int) ((uint64_t) src_w * num / den), 1);
+    int scaled_h = MAX((int) ((uint64_t) src_h * num / den), 1);
+    int out_w = MIN(scaled_w, dst.width);
+    int out_h = MIN(scaled_h, dst.height);
+
+    row_pipeline_t *p = calloc(1, sizeof(*p) + out_w * (sizeof(uint32_t) + 2));
+    ESP_RETURN_ON_FALSE(p != NULL, ESP_ERR_NO_MEM, TAG, "Failed to allocate row pipeline");
+    p->config = *config;
+    p->config.dst = dst;
+    p->num = num;
+    p->den = den;
+    p->direct = num == den;
+    p->landscape = epd_get_rotation() == EPD_ROT_LANDSCAPE;
+    p->out_width = out_w;
+    p->out_height = out_h;
+    p->crop_x = (scaled_w - out_w) / 2;
+    p->crop_y = (scaled_h - out_h) / 2;
+    p->out_x = dst.x + (dst.width - out_w) / 2;
+    p->out_y = dst.y + (dst.height - out_h) / 2;
+    p->acc = (uint32_t *) (p + 1);
+    p->hrow = (uint8_t *) (p->acc + out_w);
+    p->levels = p->hrow + out_w;
+
+    // One table per image: source value -> gray -> panel level
+    for (int i = 0; i < 256; i++) {
+        p->gray_lut[i] = config->value_to_gray ? config->value_to_gray[i] : i;
+        p->level_lut[i] = app_tone_lut.level[p->gray_lut[i]];
+    }
+
+    // Letterbox margins
+    p->stats.histogram[15] = dst.width * dst.height - out_w * out_h;
+    uint8_t *fb = config->fb;
+    fill_white(fb, dst.x, dst.y, dst.width, p->out_y - dst.y);
+    fill_white(fb, dst.x, p->out_y + out_h, dst.width, dst.y + dst.height - (p->out_y + out_h));
+    fill_white(fb, dst.x, p->out_y, p->out_x - dst.x, out_h);
+    fill_white(fb, p->out_x + out_w, p->out_y, dst.x + dst.width - (p->out_x + out_w), out_h);
+
+    ESP_LOGD(TAG, "%dx%d -> %dx%d (scale %" PRIu32 "/%" PRIu32 "), visible %dx%d at %d,%d",
+             src_w, src_h, scaled_w, scaled_h, num, den, out_w, out_h, p->out_x, p->out_y);
+    *out_pipeline = p;
+    return ESP_OK;
+}
+
+/* Box-filter one source row into out_width columns, normalized back to 8 bits */
+static void filter_row(row_pipeline_t *p, const uint8_t *row)
+{
+    const uint32_t num = p->num;
+    const uint32_t den = p->den;
+    const uint8_t *gray = p->gray_lut;
+    for (int k = 0; k < p->out_width; k++) {
+        uint32_t j = p->crop_x + k;
+        uint32_t start = j * den;
+        uint32_t end = start + den;
+        uint32_t sum = 0;
+        for (uint32_t i = start / num; i * num < end; i++) {
+            uint32_t overlap = MIN((i + 1) * num, end) - MAX(i * num, start);
+            sum += gray[row[i]] * overlap;
+        }
+        p->hrow[k] = (sum + den / 2) / den;
+    }
+}
+
+void row_pipeline_push(row_pipeline_t *p, const uint8_t *row)
+{
+    if (p->src_y >= p->config.src_height) {
+        return;
+    }
+    int src_y = p->src_y++;
+
+    if (p->direct) {
+        int y = src_y - p->crop_y;
+        if (y < 0 || y >= p->out_height) {
+            return;
+        }
+        const uint8_t *src = row + p->crop_x;
+        for (int k = 0; k < p->out_width; k++) {
+            p->levels[k] = p->level_lut[src[k]];
+        }
+        pack_levels(p, p->out_x, p->out_y + y, p->out_width);
+        return;
+    }
+
+    // Output rows overlapping this source row, limited to the visible ones
+    uint32_t in_start = src_y * p->num;
+    uint32_t in_end = in_start + p->num;
+    int first = MAX((int) (in_start / p->den), p->crop_y);
+    int last = MIN((int) ((in_end - 1) / p->den), p->crop_y + p->out_height - 1);
+    if (first > last) {
+        return;
+    }
+    filter_row(p, row);
+    for (int y = first; y <= last; y++) {
+        uint32_t out_start = y * p->den;
+        uint32_t out_end = out_start + p->den;
+        uint32_t overlap = MIN(in_end, out_end) - MAX(in_start, out_start);
+        for (int k = 0; k < p->out_width; k++) {
+            p->acc[k] += p->hrow[k] * overlap;
+        }
+        if (out_end > in_end) {
+            // continues in the next source row
+            break;
+        }
+        for (int k = 0; k < p->out_width; k++) {
+            p->levels[k] = app_tone_lut.level[(p->acc[k] + p->den / 2) / p->den];
+            p->acc[k] = 0;
+        }
+        pack_levels(p, p->out_x, p->out_y + y - p->crop_y, p->out_width);
+    }
+}
+
+void row_pipeline_get_stats(const row_pipeline_t *pipeline, row_pipeline_stats_t *out_stats)
+{
+    *out_stats = pipeline->stats;
+}
+
+void row_pipeline_delete(row_pipeline_t *pipeline)
+{
+    free(pipeline);
+}
+
+row_pipeline_scale_t row_pipeline_scale_from_str(const char *str)
+{
+    if (str != NULL && strcasecmp(str, "fill") == 0) {
+        return ROW_PIPELINE_SCALE_FILL;
+    }
+    if (str != NULL && strcasecmp(str, "none") == 0) {
+        return ROW_PIPELINE_SCALE_NONE;
+    }
+    return ROW_PIPELINE_SCALE_FIT;
+}
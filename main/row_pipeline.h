@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "epd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The 4bpp framebuffer in landscape: rows of EPD_WIDTH pixels, the left one of each pair in the low nibble */
+#define FB_STRIDE (EPD_WIDTH / 2)
+#define FB_SIZE (FB_STRIDE * EPD_HEIGHT)
+
+/**
+ * @brief The 8-bit epdiy color of a panel level; epdiy takes 8-bit colors and keeps the upper 4 bits
+ */
+static inline uint8_t fb_level_color(uint8_t level)
+{
+    return level << 4 | level;
+}
+
+/**
+ * @brief How a source image is fitted into the target rectangle
+ */
+typedef enum {
+    ROW_PIPELINE_SCALE_FIT,     /*!< Scale to fit inside the target, letterbox the rest with white */
+    ROW_PIPELINE_SCALE_FILL,    /*!< Scale to cover the whole target, crop what doesn't fit */
+    ROW_PIPELINE_SCALE_NONE,    /*!< Keep the source size, center it and crop or letterbox */
+} row_pipeline_scale_t;
+
+/**
+ * @brief Configuration of a row pipeline
+ */
+typedef struct {
+    int src_width;              /*!< Width of the source image */
+    int src_height;             /*!< Height of the source image */
+    const uint8_t *value_to_gray; /*!< Maps source values (e.g. palette indices) to 8-bit gray; NULL if the source is gray */
+    EpdRect dst;                /*!< Target rectangle, in rotated display coordinates */
+    row_pipeline_scale_t scale; /*!< Scaling mode */
+    uint8_t *fb;                /*!< 4bpp framebuffer to draw into */
+} row_pipeline_config_t;
+
+/**
+ * @brief Tone statistics of everything the pipeline wrote, letterbox margins included
+ */
+typedef struct {
+    uint32_t histogram[16];     /*!< Pixels per panel level */
+    uint32_t transitions;       /*!< Horizontally adjacent pixels with different levels */
+} row_pipeline_stats_t;
+
+typedef struct row_pipeline row_pipeline_t;
+
+/**
+ * @brief Create a pipeline which resamples source rows and packs them into the framebuffer
+ *
+ * Memory use is bounded by a few rows of the target width, regardless of the source size.
+ * Letterbox margins inside the target rectangle are filled with white immediately.
+ */
+esp_err_t row_pipeline_create(const row_pipeline_config_t *config, row_pipeline_t **out_pipeline);
+
+/**
+ * @brief Feed the next source row (src_width bytes, one value per pixel), top to bottom
+ */
+void row_pipeline_push(row_pipeline_t *pipeline, const uint8_t *row);
+
+void row_pipeline_get_stats(const row_pipeline_t *pipeline, row_pipeline_stats_t *out_stats);
+
+/**
+ * @brief Add the levels of an area of a landscape framebuffer to stats
+ *
+ * For content drawn into the framebuffer by other means than a pipeline.
+ */
+void row_pipeline_count_levels(EpdRect area, const uint8_t *fb, row_pipeline_stats_t *stats);
+
+void row_pipeline_delete(row_pipeline_t *pipeline);
+
+/**
+ * @brief Parse a scaling mode name ("fit", "fill" or "none"); NULL or unknown names give "fit"
+ */
+row_pipeline_scale_t row_pipeline_scale_from_str(const char *str);
+
+#ifdef __cplusplus
+}
+#endif
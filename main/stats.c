@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include "esp_err.h"
 #include "esp_check.h"
 #include "nvs.h"
@@ -13,8 +14,19 @@ void app_update_stats(const app_stats_t *stats)
     old_stats.success_count += stats->success_count;
     old_stats.fail_count += stats->fail_count;
     old_stats.awake_time_ms += stats->awake_time_ms;
+    old_stats.widget_count += stats->widget_count;
+    old_stats.widget_awake_time_ms += stats->widget_awake_time_ms;
     old_stats.connecting_time_ms += stats->connecting_time_ms;
     old_stats.display_on_time_ms += stats->display_on_time_ms;
+    old_stats.decode_time_ms += stats->decode_time_ms;
+    old_stats.decode_hidden_ms += stats->decode_hidden_ms;
+    old_stats.image_bytes += stats->image_bytes;
+    old_stats.panel_prep_ms += stats->panel_prep_ms;
+    old_stats.panel_prep_hidden_ms += stats->panel_prep_hidden_ms;
+    for (int i = 0; i < APP_TEMPERATURE_BANDS; i++) {
+        old_stats.refresh_ms_by_band[i] += stats->refresh_ms_by_band[i];
+        old_stats.refreshes_by_band[i] += stats->refreshes_by_band[i];
+    }
 
     nvs_handle_t nvs_handle;
     ESP_ERROR_CHECK(nvs_open("app_stats", NVS_READWRITE, &nvs_handle));
@@ -22,8 +34,22 @@ void app_update_stats(const app_stats_t *stats)
     ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "success", old_stats.success_count));
     ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "fail", old_stats.fail_count));
     ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "awake", old_stats.awake_time_ms));
+    ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "widget", old_stats.widget_count));
+    ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "widget_awake", old_stats.widget_awake_time_ms));
     ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "connecting", old_stats.connecting_time_ms));
     ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "display", old_stats.display_on_time_ms));
+    ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "decode", old_stats.decode_time_ms));
+    ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "decode_hidden", old_stats.decode_hidden_ms));
+    ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "image_bytes", old_stats.image_bytes));
+    ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "prep", old_stats.panel_prep_ms));
+    ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, "prep_hidden", old_stats.panel_prep_hidden_ms));
+    for (int i = 0; i < APP_TEMPERATURE_BANDS; i++) {
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        snprintf(key, sizeof(key), "refresh_ms%d", i);
+        ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, key, old_stats.refresh_ms_by_band[i]));
+        snprintf(key, sizeof(key), "refreshes%d", i);
+        ESP_ERROR_CHECK(nvs_set_u32(nvs_handle, key, old_stats.refreshes_by_band[i]));
+    }
 
     nvs_commit(nvs_handle);
     nvs_close(nvs_handle);
@@ -53,6 +79,16 @@ void app_get_stats(app_stats_t *stats)
         printf("read awake_time_ms failed: 0x%x\n", err);
     }
 
+    err = nvs_get_u32(nvs_handle, "widget", (uint32_t *) &stats->widget_count);
+    if (err != ESP_OK) {
+        printf("read widget_count failed: 0x%x\n", err);
+    }
+
+    err = nvs_get_u32(nvs_handle, "widget_awake", (uint32_t *) &stats->widget_awake_time_ms);
+    if (err != ESP_OK) {
+        printf("read widget_awake_time_ms failed: 0x%x\n", err);
+    }
+
     err = nvs_get_u32(nvs_handle, "connecting", (uint32_t *) &stats->connecting_time_ms);
     if (err != ESP_OK) {
         printf("read connecting_time_ms failed: 0x%x\n", err);
@@ -63,5 +99,44 @@ void app_get_stats(app_stats_t *stats)
         printf("read display_on_time_ms failed: 0x%x\n", err);
     }
 
+    err = nvs_get_u32(nvs_handle, "decode", (uint32_t *) &stats->decode_time_ms);
+    if (err != ESP_OK) {
+        printf("read decode_time_ms failed: 0x%x\n", err);
+    }
+
+    err = nvs_get_u32(nvs_handle, "decode_hidden", (uint32_t *) &stats->decode_hidden_ms);
+    if (err != ESP_OK) {
+        printf("read decode_hidden_ms failed: 0x%x\n", err);
+    }
+
+    err = nvs_get_u32(nvs_handle, "image_bytes", (uint32_t *) &stats->image_bytes);
+    if (err != ESP_OK) {
+        printf("read image_bytes failed: 0x%x\n", err);
+    }
+
+    err = nvs_get_u32(nvs_handle, "prep", (uint32_t *) &stats->panel_prep_ms);
+    if (err != ESP_OK) {
+        printf("read panel_prep_ms failed: 0x%x\n", err);
+    }
+
+    err = nvs_get_u32(nvs_handle, "prep_hidden", (uint32_t *) &stats->panel_prep_hidden_ms);
+    if (err != ESP_OK) {
+        printf("read panel_prep_hidden_ms failed: 0x%x\n", err);
+    }
+
+    for (int i = 0; i < APP_TEMPERATURE_BANDS; i++) {
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        snprintf(key, sizeof(key), "refresh_ms%d", i);
+        err = nvs_get_u32(nvs_handle, key, (uint32_t *) &stats->refresh_ms_by_band[i]);
+        if (err != ESP_OK) {
+            printf("read %s failed: 0x%x\n", key, err);
+        }
+        snprintf(key, sizeof(key), "refreshes%d", i);
+        err = nvs_get_u32(nvs_handle, key, (uint32_t *) &stats->refreshes_by_band[i]);
+        if (err != ESP_OK) {
+            printf("read %s failed: 0x%x\n", key, err);
+        }
+    }
+
     nvs_close(nvs_handle);
 }
@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_attr.h"
+#include "sdkconfig.h"
+#include "epd_driver.h"
+#include "temperature.h"
+#include "adc.h"
+
+/* Readings outside of this range are treated as sensor errors */
+#define MIN_PLAUSIBLE (-20)
+#define MAX_PLAUSIBLE 70
+
+static const char *TAG = "temperature";
+
+RTC_DATA_ATTR static bool s_cached_valid;
+RTC_DATA_ATTR static int s_cached;
+
+#if CONFIG_APP_TEMPERATURE_BOARD
+
+static esp_err_t read_sensor(float *out_celsius)
+{
+    // Boards without a sensor report 0
+    float t = epd_ambient_temperature();
+    if (t == 0.0f) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    *out_celsius = t;
+    return ESP_OK;
+}
+
+#elif CONFIG_APP_TEMPERATURE_NTC
+
+#define NTC_SAMPLES 8
+#define NTC_SUPPLY_MV 3300
+
+/* NTC from the ADC input to ground, series resistor from the input to 3.3 V */
+static esp_err_t read_sensor(float *out_celsius)
+{
+    int mv;
+    ESP_RETURN_ON_ERROR(app_adc_read_mv(CONFIG_APP_TEMPERATURE_NTC_ADC_CHANNEL, NTC_SAMPLES, &mv), TAG, "Failed to read NTC");
+    ESP_RETURN_ON_FALSE(mv > 0 && mv < NTC_SUPPLY_MV, ESP_ERR_INVALID_RESPONSE, TAG, "NTC open or shorted (%d mV)", mv);
+
+    float r = (float) CONFIG_APP_TEMPERATURE_NTC_SERIES_OHM * mv / (NTC_SUPPLY_MV - mv);
+    float inv_t = 1.0f / 298.15f + logf(r / CONFIG_APP_TEMPERATURE_NTC_R25_OHM) / CONFIG_APP_TEMPERATURE_NTC_BETA;
+    *out_celsius = 1.0f / inv_t - 273.15f;
+    return ESP_OK;
+}
+
+#else
+
+static esp_err_t read_sensor(float *out_celsius)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
+
+int app_temperature_read(void)
+{
+    float t;
+    if (read_sensor(&t) == ESP_OK && t >= MIN_PLAUSIBLE && t <= MAX_PLAUSIBLE) {
+        s_cached = (int) lroundf(t);
+        s_cached_valid = true;
+        ESP_LOGI(TAG, "Panel temperature %d C", s_cached);
+        return s_cached;
+    }
+    if (s_cached_valid) {
+        ESP_LOGI(TAG, "Using the last reading, %d C", s_cached);
+        return s_cached;
+    }
+    return CONFIG_APP_TEMPERATURE_DEFAULT;
+}
+
+int app_temperature_band(int celsius)
+{
+    if (celsius < 10) {
+        return 0;
+    }
+    if (celsius >= 30) {
+        return APP_TEMPERATURE_BANDS - 1;
+    }
+    return celsius / 10;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Temperature bands used to report refresh durations: below 10, 10-19, 20-29, 30 °C and above */
+#define APP_TEMPERATURE_BANDS 4
+
+/**
+ * @brief Read the panel temperature, in °C
+ *
+ * Uses the source selected in menuconfig. If it gives no plausible value, the last good
+ * reading (kept in RTC memory through deep sleep) is used, or the configured default.
+ */
+int app_temperature_read(void);
+
+int app_temperature_band(int celsius);
+
+#ifdef __cplusplus
+}
+#endif
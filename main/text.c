@@ -0,0 +1,443 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <zlib.h>
+#include "sdkconfig.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+#include "fonts.h"
+#include "text.h"
+#include "row_pipeline.h"
+
+#define CACHE_SIZE (CONFIG_APP_GLYPH_CACHE_KB * 1024)
+#define CACHE_ENTRIES 256
+#define CACHE_BUCKETS 64
+/* Glyphs larger than this share of the cache are decoded each time instead */
+#define CACHE_MAX_GLYPH (CACHE_SIZE / 8)
+#define NONE (-1)
+
+/* A decoded glyph bitmap, (width + 1) / 2 bytes per row */
+typedef struct {
+    const EpdFont *font;
+    uint32_t code_point;
+    uint8_t *bitmap;            // NULL if the entry is free
+    uint32_t size;
+    int16_t newer;              // LRU list, most recently used first
+    int16_t older;
+    int16_t next;               // in the hash bucket, or in the list of free entries
+} cache_entry_t;
+
+typedef struct {
+    cache_entry_t entries[CACHE_ENTRIES];
+    int16_t buckets[CACHE_BUCKETS];
+    int16_t newest;
+    int16_t oldest;
+    int16_t free;
+} glyph_cache_t;
+
+/* Glyph pixel values mapped to the framebuffer, for the colors of a text_write call */
+typedef struct {
+    uint8_t lut[16];            // value -> 8-bit color, for epd_draw_pixel
+    uint8_t pixels[256];        // two values -> two levels, as a framebuffer byte
+    uint8_t mask[256];          // two values -> the nibbles which are drawn
+    bool landscape;             // framebuffer coordinates are screen coordinates
+} text_colors_t;
+
+static glyph_cache_t *s_cache;
+static bool s_cache_failed;     // no memory for it, glyphs are decoded each time
+static text_cache_stats_t s_stats;
+
+static void *cache_alloc(size_t size)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return malloc(size);
+#else
+    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#endif
+}
+
+static void cache_reset(glyph_cache_t *cache)
+{
+    for (int i = 0; i < CACHE_ENTRIES; i++) {
+        free(cache->entries[i].bitmap);
+        cache->entries[i] = (cache_entry_t) {
+            .next = i + 1 < CACHE_ENTRIES ? i + 1 : NONE,
+        };
+    }
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        cache->buckets[i] = NONE;
+    }
+    cache->newest = NONE;
+    cache->oldest = NONE;
+    cache->free = 0;
+    s_stats.bytes = 0;
+}
+
+static glyph_cache_t *get_cache(void)
+{
+    if (s_cache == NULL && !s_cache_failed && CACHE_SIZE > 0) {
+        s_cache = cache_alloc(sizeof(glyph_cache_t));
+        s_cache_failed = s_cache == NULL;
+        if (s_cache != NULL) {
+            memset(s_cache, 0, sizeof(*s_cache));
+            cache_reset(s_cache);
+        }
+    }
+    return s_cache;
+}
+
+static int bucket_of(const EpdFont *font, uint32_t code_point)
+{
+    uint32_t h = (uint32_t) (uintptr_t) font ^ (code_point * 2654435761u);
+    return (h ^ (h >> 16)) % CACHE_BUCKETS;
+}
+
+static void lru_unlink(glyph_cache_t *cache, int i)
+{
+    cache_entry_t *e = &cache->entries[i];
+    if (e->newer != NONE) {
+        cache->entries[e->newer].older = e->older;
+    } else {
+        cache->newest = e->older;
+    }
+    if (e->older != NONE) {
+        cache->entries[e->older].newer = e->newer;
+    } else {
+        cache->oldest = e->newer;
+    }
+}
+
+static void lru_push(glyph_cache_t *cache, int i)
+{
+    cache_entry_t *e = &cache->entries[i];
+    e->newer = NONE;
+    e->older = cache->newest;
+    if (cache->newest != NONE) {
+        cache->entries[cache->newest].newer = i;
+    }
+    cache->newest = i;
+    if (cache->oldest == NONE) {
+        cache->oldest = i;
+    }
+}
+
+static void evict_oldest(glyph_cache_t *cache)
+{
+    int i = cache->oldest;
+    cache_entry_t *e = &cache->entries[i];
+    lru_unlink(cache, i);
+    int16_t *link = &cache->buckets[bucket_of(e->font, e->code_point)];
+    while (*link != i) {
+        link = &cache->entries[*link].next;
+    }
+    *link = e->next;
+    free(e->bitmap);
+    s_stats.bytes -= e->size;
+    s_stats.evictions++;
+    *e = (cache_entry_t) {
+        .next = cache->free,
+    };
+    cache->free = i;
+}
+
+static const uint8_t *cache_find(glyph_cache_t *cache, const EpdFont *font, uint32_t code_point)
+{
+    for (int i = cache->buckets[bucket_of(font, code_point)]; i != NONE; i = cache->entries[i].next) {
+        cache_entry_t *e = &cache->entries[i];
+        if (e->font == font && e->code_point == code_point) {
+            lru_unlink(cache, i);
+            lru_push(cache, i);
+            return e->bitmap;
+        }
+    }
+    return NULL;
+}
+
+/* Take ownership of bitmap; false if it's too large to be cached */
+static bool cache_insert(glyph_cache_t *cache, const EpdFont *font, uint32_t code_point, uint8_t *bitmap, uint32_t size)
+{
+    if (size > CACHE_MAX_GLYPH) {
+        return false;
+    }
+    while (cache->free == NONE || s_stats.bytes + size > CACHE_SIZE) {
+        evict_oldest(cache);
+    }
+    int i = cache->free;
+    cache_entry_t *e = &cache->entries[i];
+    cache->free = e->next;
+    int bucket = bucket_of(font, code_point);
+    *e = (cache_entry_t) {
+        .font = font,
+        .code_point = code_point,
+        .bitmap = bitmap,
+        .size = size,
+        .next = cache->buckets[bucket],
+    };
+    cache->buckets[bucket] = i;
+    lru_push(cache, i);
+    s_stats.bytes += size;
+    return true;
+}
+
+/* Expand RLE runs (see fonts.h) into a 4bpp bitmap; false if they don't fill it exactly */
+static bool rle_decode(const uint8_t *src, uint32_t len, int width, int height, uint8_t *out)
+{
+    int byte_width = (width + 1) / 2;
+    memset(out, 0, byte_width * height);
+    int x = 0;
+    uint8_t *row = out;
+    uint8_t *end = out + byte_width * height;
+    for (const uint8_t *src_end = src + len; src < src_end; src++) {
+        int level = *src & 0x0F;
+        int run = (*src >> 4) + 1;
+        // Runs of the background level only move on
+        while (run > 0) {
+            if (row == end) {
+                return false;
+            }
+            int n = MIN(run, width - x);
+            if (level != 0) {
+                for (int i = x; i < x + n; i++) {
+                    row[i / 2] |= i % 2 ? level << 4 : level;
+                }
+            }
+            run -= n;
+            x += n;
+            if (x == width) {
+                x = 0;
+                row += byte_width;
+            }
+        }
+    }
+    return row == end && x == 0;
+}
+
+/*
+ * The 4bpp bitmap of a glyph. If it had to be decoded and couldn't be cached,
+ * *out_buffer is set to it, to be freed by the caller.
+ */
+static enum EpdDrawError glyph_bitmap(const EpdFont *font, uint32_t code_point, const EpdGlyph *glyph,
+                                      const uint8_t **out_bitmap, uint8_t **out_buffer)
+{
+    *out_buffer = NULL;
+    *out_bitmap = &font->bitmap[glyph->data_offset];
+    uLongf size = (glyph->width + 1) / 2 * glyph->height;
+    font_encoding_t encoding = fonts_encoding(font);
+    if (encoding == FONT_ENCODING_RAW || size == 0) {
+        return EPD_DRAW_SUCCESS;
+    }
+    glyph_cache_t *cache = get_cache();
+    if (cache != NULL) {
+        const uint8_t *cached = cache_find(cache, font, code_point);
+        if (cached != NULL) {
+            s_stats.hits++;
+            *out_bitmap = cached;
+            return EPD_DRAW_SUCCESS;
+        }
+    }
+
+    s_stats.misses++;
+    uint8_t *buffer = cache != NULL ? cache_alloc(size) : malloc(size);
+    if (buffer == NULL) {
+        return EPD_DRAW_FAILED_ALLOC;
+    }
+    bool ok;
+    if (encoding == FONT_ENCODING_RLE) {
+        ok = rle_decode(*out_bitmap, glyph->compressed_size, glyph->width, glyph->height, buffer);
+    } else {
+        uLongf out_size = size;
+        ok = uncompress(buffer, &out_size, *out_bitmap, glyph->compressed_size) == Z_OK && out_size == size;
+    }
+    if (!ok) {
+        free(buffer);
+        return EPD_DRAW_STRING_INVALID;
+    }
+    *out_bitmap = buffer;
+    if (cache == NULL || !cache_insert(cache, font, code_point, buffer, size)) {
+        *out_buffer = buffer;
+    }
+    return EPD_DRAW_SUCCESS;
+}
+
+static const EpdGlyph *find_glyph(const EpdFont *font, uint32_t *code_point, const EpdFontProperties *props)
+{
+    const EpdGlyph *glyph = epd_get_glyph(font, *code_point);
+    if (glyph == NULL) {
+        *code_point = props->fallback_glyph;
+        glyph = epd_get_glyph(font, *code_point);
+    }
+    return glyph;
+}
+
+/*
+ * Write one row of a glyph into the framebuffer at x, two pixels per byte. A source byte
+ * (or, at odd x, a pair of pixels straddling two source bytes) is mapped by the colors to
+ * the destination byte and the mask of its nibbles which are drawn.
+ */
+static void blit_row(const uint8_t *src, int width, int x, uint8_t *row, const text_colors_t *colors)
+{
+    uint8_t *dst = &row[x / 2];
+    int i = 0;
+    if (x % 2 && width > 0) {
+        // The first pixel goes into the high nibble, the low nibble isn't touched
+        uint8_t v = src[0] << 4;
+        uint8_t mask = colors->mask[v] & 0xF0;
+        *dst = (*dst & ~mask) | (colors->pixels[v] & mask);
+        dst++;
+        for (i = 1; i + 1 < width; i += 2, dst++) {
+            v = (src[i / 2] >> 4) | (src[i / 2 + 1] << 4);
+            *dst = (*dst & ~colors->mask[v]) | colors->pixels[v];
+        }
+    } else {
+        for (; i + 1 < width; i += 2, dst++) {
+            uint8_t v = src[i / 2];
+            *dst = (*dst & ~colors->mask[v]) | colors->pixels[v];
+        }
+    }
+    if (i < width) {
+        // The last pixel goes into the low nibble
+        uint8_t v = i % 2 ? src[i / 2] >> 4 : src[i / 2] & 0x0F;
+        uint8_t mask = colors->mask[v] & 0x0F;
+        *dst = (*dst & ~mask) | (colors->pixels[v] & mask);
+    }
+}
+
+static enum EpdDrawError draw_char(const EpdFont *font, uint32_t code_point, int *cursor_x, int cursor_y,
+                                   const text_colors_t *colors, uint8_t *fb, const EpdFontProperties *props)
+{
+    const EpdGlyph *glyph = find_glyph(font, &code_point, props);
+    if (glyph == NULL) {
+        return EPD_DRAW_GLYPH_FALLBACK_FAILED;
+    }
+    const uint8_t *bitmap;
+    uint8_t *buffer;
+    enum EpdDrawError err = glyph_bitmap(font, code_point, glyph, &bitmap, &buffer);
+    if (err != EPD_DRAW_SUCCESS) {
+        return err;
+    }
+
+    int byte_width = (glyph->width + 1) / 2;
+    int start_x = *cursor_x + glyph->left;
+    int start_y = cursor_y - glyph->top;
+    if (colors->landscape && start_x >= 0 && start_x + glyph->width <= EPD_WIDTH &&
+            start_y >= 0 && start_y + glyph->height <= EPD_HEIGHT) {
+        for (int y = 0; y < glyph->height; y++) {
+            blit_row(&bitmap[y * byte_width], glyph->width, start_x, &fb[(start_y + y) * FB_STRIDE], colors);
+        }
+    } else {
+        // Clipped by the edges of the screen, or rotated
+        bool background = props->flags & EPD_DRAW_BACKGROUND;
+        for (int y = 0; y < glyph->height; y++) {
+            const uint8_t *row = &bitmap[y * byte_width];
+            for (int x = 0; x < glyph->width; x++) {
+                uint8_t value = x % 2 ? row[x / 2] >> 4 : row[x / 2] & 0x0F;
+                if (background || value != 0) {
+                    epd_draw_pixel(start_x + x, start_y + y, colors->lut[value], fb);
+                }
+            }
+        }
+    }
+    free(buffer);
+    *cursor_x += glyph->advance_x;
+    return EPD_DRAW_SUCCESS;
+}
+
+/* Decode the next UTF-8 code point and advance *string past it; 0 at the end of the line */
+static uint32_t next_code_point(const uint8_t **string)
+{
+    const uint8_t *s = *string;
+    if (*s == 0 || *s == '\n') {
+        return 0;
+    }
+    uint32_t cp;
+    int extra;
+    if (*s < 0x80) {
+        cp = *s;
+        extra = 0;
+    } else if ((*s & 0xE0) == 0xC0) {
+        cp = *s & 0x1F;
+        extra = 1;
+    } else if ((*s & 0xF0) == 0xE0) {
+        cp = *s & 0x0F;
+        extra = 2;
+    } else {
+        cp = *s & 0x07;
+        extra = 3;
+    }
+    s++;
+    for (int i = 0; i < extra && (*s & 0xC0) == 0x80; i++) {
+        cp = (cp << 6) | (*s & 0x3F);
+        s++;
+    }
+    *string = s;
+    return cp;
+}
+
+static int line_width(const EpdFont *font, const uint8_t *line, const EpdFontProperties *props)
+{
+    int width = 0;
+    uint32_t cp;
+    while ((cp = next_code_point(&line)) != 0) {
+        const EpdGlyph *glyph = find_glyph(font, &cp, props);
+        width += glyph != NULL ? glyph->advance_x : 0;
+    }
+    return width;
+}
+
+enum EpdDrawError text_write(const EpdFont *font, const char *string, int *cursor_x, int *cursor_y,
+                             uint8_t *fb, const EpdFontProperties *props)
+{
+    if (string == NULL) {
+        return EPD_DRAW_STRING_INVALID;
+    }
+    text_colors_t colors;
+    int color_difference = (int) props->fg_color - (int) props->bg_color;
+    for (int c = 0; c < 16; c++) {
+        colors.lut[c] = fb_level_color(MAX(0, MIN(15, props->bg_color + c * color_difference / 15)));
+    }
+    bool background = props->flags & EPD_DRAW_BACKGROUND;
+    for (int v = 0; v < 256; v++) {
+        int low = v & 0x0F;
+        int high = v >> 4;
+        colors.pixels[v] = (colors.lut[low] & 0x0F) | (colors.lut[high] & 0xF0);
+        colors.mask[v] = (background || low != 0 ? 0x0F : 0) | (background || high != 0 ? 0xF0 : 0);
+        colors.pixels[v] &= colors.mask[v];
+    }
+    colors.landscape = epd_get_rotation() == EPD_ROT_LANDSCAPE;
+
+    enum EpdDrawError err = EPD_DRAW_SUCCESS;
+    int line_start = *cursor_x;
+    const uint8_t *s = (const uint8_t *) string;
+    for (;;) {
+        *cursor_x = line_start;
+        if (props->flags & (EPD_DRAW_ALIGN_RIGHT | EPD_DRAW_ALIGN_CENTER)) {
+            int width = line_width(font, s, props);
+            *cursor_x -= props->flags & EPD_DRAW_ALIGN_RIGHT ? width : width / 2;
+        }
+        uint32_t cp;
+        while ((cp = next_code_point(&s)) != 0) {
+            err |= draw_char(font, cp, cursor_x, *cursor_y, &colors, fb, props);
+        }
+        *cursor_y += font->advance_y;
+        if (*s != '\n') {
+            break;
+        }
+        s++;
+    }
+    return err;
+}
+
+void text_cache_get_stats(text_cache_stats_t *out_stats)
+{
+    *out_stats = s_stats;
+}
+
+void text_cache_clear(void)
+{
+    if (s_cache != NULL) {
+        cache_reset(s_cache);
+    }
+}
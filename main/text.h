@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include "epd_driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Text drawing with epdiy fonts. Glyphs are placed and colored like epd_write_string does,
+ * but the bitmaps of zlib and RLE fonts (see fonts.h) are kept decoded in a small LRU cache
+ * (in PSRAM, CONFIG_APP_GLYPH_CACHE_KB), so that a glyph which was drawn before isn't
+ * decoded again. In landscape, glyphs which lie entirely on the screen are written into the
+ * framebuffer a row at a time, two pixels per byte; others are drawn pixel by pixel.
+ *
+ * Not thread safe; text is only drawn from the main task.
+ */
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;            // glyphs decoded
+    uint32_t evictions;
+    uint32_t bytes;             // bitmaps in the cache
+} text_cache_stats_t;
+
+/**
+ * @brief Draw a string like epd_write_string
+ *
+ * Lines are separated by '\n'; each advances *cursor_y by the line height of the font.
+ */
+enum EpdDrawError text_write(const EpdFont *font, const char *string, int *cursor_x, int *cursor_y,
+                             uint8_t *fb, const EpdFontProperties *props);
+
+/**
+ * @brief Counters of the glyph cache since the start
+ */
+void text_cache_get_stats(text_cache_stats_t *out_stats);
+
+/**
+ * @brief Drop all cached glyphs
+ */
+void text_cache_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
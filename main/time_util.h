@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Times before this are the RTC counting from 1970 before it was ever set */
+#define TIME_VALID_AFTER 1577836800  // 2020-01-01
+
+/**
+ * @brief Whether t comes from a clock which was set, by SNTP or before deep sleep
+ */
+static inline bool time_is_valid(time_t t)
+{
+    return t >= TIME_VALID_AFTER;
+}
+
+#ifdef __cplusplus
+}
+#endif
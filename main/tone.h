@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Maps an 8-bit gray value to a panel level (0 is black, 15 is white),
+ * applying the gamma selected by CONFIG_APP_PANEL_GAMMA_X100.
+ */
+typedef struct {
+    uint8_t level[256];
+} app_tone_lut_t;
+
+/**
+ * @brief Per-channel luma contributions (BT.601 weights, scaled by 256).
+ * The 8-bit luma of an RGB pixel is (r[R] + g[G] + b[B]) >> 8.
+ */
+typedef struct {
+    uint16_t r[256];
+    uint16_t g[256];
+    uint16_t b[256];
+} app_luma_lut_t;
+
+extern const app_tone_lut_t app_tone_lut;
+extern const app_luma_lut_t app_luma_lut;
+
+static inline uint8_t app_luma(uint8_t r, uint8_t g, uint8_t b)
+{
+    return (app_luma_lut.r[r] + app_luma_lut.g[g] + app_luma_lut.b[b]) >> 8;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Lookup tables used when converting decoded images to panel levels.
+ * All of them are computed by the compiler and end up in flash (.rodata),
+ * so no per-pixel floating point math is done at run time.
+ */
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "tone.h"
+
+namespace {
+
+constexpr double LN2 = 0.69314718055994530942;
+
+/* exp(x) for x <= 0: halve the argument until the Taylor series converges fast, then square back */
+constexpr double const_exp(double x)
+{
+    int halvings = 0;
+    while (x < -0.5) {
+        x /= 2;
+        halvings++;
+    }
+    double sum = 1.0;
+    double term = 1.0;
+    for (int n = 1; n < 20; n++) {
+        term *= x / n;
+        sum += term;
+    }
+    for (int i = 0; i < halvings; i++) {
+        sum *= sum;
+    }
+    return sum;
+}
+
+/* ln(x) for 0 < x <= 1: scale into [0.5, 1) by powers of 2, then use the atanh series */
+constexpr double const_ln(double x)
+{
+    int exponent = 0;
+    while (x < 0.5) {
+        x *= 2;
+        exponent--;
+    }
+    double z = (x - 1) / (x + 1);
+    double z2 = z * z;
+    double sum = 0.0;
+    double term = z;
+    for (int n = 1; n < 40; n += 2) {
+        sum += term / n;
+        term *= z2;
+    }
+    return exponent * LN2 + 2 * sum;
+}
+
+constexpr double const_pow(double base, double exponent)
+{
+    return base <= 0.0 ? 0.0 : const_exp(exponent * const_ln(base));
+}
+
+constexpr app_tone_lut_t make_tone_lut(double gamma)
+{
+    app_tone_lut_t lut{};
+    for (int i = 0; i < 256; i++) {
+        lut.level[i] = static_cast<uint8_t>(15.0 * const_pow(i / 255.0, gamma) + 0.5);
+    }
+    return lut;
+}
+
+constexpr app_luma_lut_t make_luma_lut()
+{
+    app_luma_lut_t lut{};
+    for (int i = 0; i < 256; i++) {
+        lut.r[i] = static_cast<uint16_t>(77 * i);
+        lut.g[i] = static_cast<uint16_t>(150 * i);
+        lut.b[i] = static_cast<uint16_t>(29 * i);
+    }
+    return lut;
+}
+
+constexpr app_tone_lut_t s_tone_lut = make_tone_lut(CONFIG_APP_PANEL_GAMMA_X100 / 100.0);
+constexpr app_luma_lut_t s_luma_lut = make_luma_lut();
+
+static_assert(s_tone_lut.level[0] == 0 && s_tone_lut.level[255] == 15, "tone curve must keep black and white");
+static_assert((s_luma_lut.r[255] + s_luma_lut.g[255] + s_luma_lut.b[255]) >> 8 == 255, "luma weights must sum to 256");
+
+} // namespace
+
+extern "C" const app_tone_lut_t app_tone_lut = s_tone_lut;
+extern "C" const app_luma_lut_t app_luma_lut = s_luma_lut;
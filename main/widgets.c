@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include "esp_log.h"
+#include "fonts.h"
+#include "text.h"
+#include "widgets.h"
+#include "time_util.h"
+
+/* Linear charge estimate between these voltages; good enough for a rough percentage */
+#define BATTERY_EMPTY_MV 3300
+#define BATTERY_FULL_MV 4200
+#define MARGIN 8
+#define STATUS_LEVEL 6              // dark gray, black when stale
+
+static const char *TAG = "widgets";
+
+void widgets_format(widgets_t *widgets, EpdRect area, time_t now, time_t updated, bool stale, int battery_mv)
+{
+    memset(widgets, 0, sizeof(*widgets));
+    widgets->area = area;
+    widgets->stale = stale;
+
+    struct tm now_tm;
+    localtime_r(&now, &now_tm);
+    if (time_is_valid(now)) {
+        strftime(widgets->clock, sizeof(widgets->clock), "%H:%M", &now_tm);
+    } else {
+        strlcpy(widgets->clock, "--:--", sizeof(widgets->clock));
+    }
+
+    if (battery_mv > 0) {
+        int percent = (battery_mv - BATTERY_EMPTY_MV) * 100 / (BATTERY_FULL_MV - BATTERY_EMPTY_MV);
+        snprintf(widgets->battery, sizeof(widgets->battery), "%d%%", MAX(0, MIN(percent, 100)));
+    }
+
+    if (updated == 0) {
+        strlcpy(widgets->status, "Not updated yet", sizeof(widgets->status));
+        return;
+    }
+    struct tm updated_tm;
+    localtime_r(&updated, &updated_tm);
+    char when[16];
+    // Older than today: the date says more than the time
+    bool today = updated_tm.tm_yday == now_tm.tm_yday && updated_tm.tm_year == now_tm.tm_year;
+    strftime(when, sizeof(when), today ? "%H:%M" : "%d.%m. %H:%M", &updated_tm);
+    snprintf(widgets->status, sizeof(widgets->status), stale ? "No update since %s" : "Updated %s", when);
+}
+
+static void write_text(const EpdFont *font, const char *text, int x, int y, uint8_t level,
+                       enum EpdFontFlags align, uint8_t *fb)
+{
+    if (text[0] == '\0') {
+        return;
+    }
+    EpdFontProperties props = epd_font_properties_default();
+    props.fg_color = level;
+    props.flags = align;
+    enum EpdDrawError err = text_write(font, text, &x, &y, fb, &props);
+    if (err != EPD_DRAW_SUCCESS) {
+        ESP_LOGW(TAG, "Text \"%s\": error 0x%x", text, err);
+    }
+}
+
+void widgets_draw(const widgets_t *widgets, uint8_t *fb, row_pipeline_stats_t *out_tone)
+{
+    EpdRect area = widgets->area;
+    epd_fill_rect(area, 0xFF, fb);
+    // Texts sit on a common baseline, centered vertically in the area
+    int baseline = area.y + (area.height + FiraSans_20.ascender) / 2;
+    write_text(&FiraSans_20, widgets->clock, area.x + MARGIN, baseline, 0, EPD_DRAW_ALIGN_LEFT, fb);
+    write_text(&FiraSans_12, widgets->status, area.x + area.width / 2, baseline,
+               widgets->stale ? 0 : STATUS_LEVEL, EPD_DRAW_ALIGN_CENTER, fb);
+    write_text(&FiraSans_12, widgets->battery, area.x + area.width - MARGIN, baseline, 0, EPD_DRAW_ALIGN_RIGHT, fb);
+    if (out_tone != NULL) {
+        *out_tone = (row_pipeline_stats_t) {
+            0
+        };
+        row_pipeline_count_levels(area, fb, out_tone);
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "epd_driver.h"
+#include "row_pipeline.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Overlays drawn by the device into a reserved area of the screen: the time, the battery
+ * charge and when the content was last fetched. They are kept current on wake-ups which
+ * don't use the network.
+ *
+ * The drawing depends only on this struct, so the device can redraw what the panel shows
+ * from a copy kept in RTC memory instead of saving the framebuffer on every such wake-up.
+ */
+typedef struct {
+    EpdRect area;
+    char clock[8];              // "HH:MM", "--:--" until the time is set
+    char battery[8];            // "87%", empty without a reading
+    char status[32];            // when the content was fetched
+    bool stale;                 // the content is older than it should be
+} widgets_t;
+
+/**
+ * @brief Fill in the widget texts
+ *
+ * @param now  Current time; before 2020 it's taken as not set
+ * @param updated  Time of the last successful fetch, 0 if none
+ * @param stale  Show the content as out of date
+ * @param battery_mv  Battery voltage, 0 if unknown
+ */
+void widgets_format(widgets_t *widgets, EpdRect area, time_t now, time_t updated, bool stale, int battery_mv);
+
+/**
+ * @brief Draw the widgets into their area of the 4bpp framebuffer, replacing its content
+ *
+ * @param[out] out_tone  Levels in the area after drawing (optional)
+ */
+void widgets_draw(const widgets_t *widgets, uint8_t *fb, row_pipeline_stats_t *out_tone);
+
+#ifdef __cplusplus
+}
+#endif
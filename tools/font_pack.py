@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Writes epdiy font headers into a font pack, the image of the fonts partition, which the app
+# maps into memory and uses in place. The format is described in main/fonts.h.
+#
+# Usage: font_pack.py [--max-size <bytes>] <output.bin> <font.h>...
+
+import argparse
+import struct
+import sys
+
+from font_subset import parse_font
+
+MAGIC = b"EPFP"
+VERSION = 2
+HEADER = struct.Struct("<4sHHI4x")
+FONT_ENTRY = struct.Struct("<24sIIIIIBxHhhI")
+# As EpdGlyph and EpdUnicodeInterval are laid out in memory on the ESP32
+GLYPH = struct.Struct("<BBBxhhII")
+INTERVAL = struct.Struct("<III")
+
+
+def align(data, alignment=4):
+    data += bytes(-len(data) % alignment)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("output", help="font pack to write")
+    parser.add_argument("fonts", nargs="+", help="epdiy font headers")
+    parser.add_argument("--max-size", type=lambda s: int(s, 0), help="size of the partition the pack goes to")
+    args = parser.parse_args()
+
+    fonts = []
+    for path in args.fonts:
+        with open(path, encoding="utf-8") as f:
+            fonts.append(parse_font(f.read()))
+
+    data = bytearray(HEADER.size + FONT_ENTRY.size * len(fonts))
+    entries = []
+    for font in fonts:
+        if len(font.name.encode()) >= 24:
+            raise ValueError(f"Font name {font.name} is too long")
+        glyph_offset = len(data)
+        for glyph in font.glyphs:
+            data += GLYPH.pack(*glyph)
+        interval_offset = len(data)
+        for interval in font.intervals:
+            data += INTERVAL.pack(*interval)
+        bitmap_offset = len(data)
+        data += font.bitmap
+        align(data)
+        entries.append(FONT_ENTRY.pack(font.name.encode(), glyph_offset, len(font.glyphs), interval_offset,
+                                       len(font.intervals), bitmap_offset, font.encoding, font.advance_y,
+                                       font.ascender, font.descender, len(font.bitmap)))
+        print(f"{font.name}: {len(font.glyphs)} glyphs, {len(data) - glyph_offset} bytes")
+
+    data[:HEADER.size] = HEADER.pack(MAGIC, VERSION, len(fonts), len(data))
+    for i, entry in enumerate(entries):
+        offset = HEADER.size + i * FONT_ENTRY.size
+        data[offset:offset + FONT_ENTRY.size] = entry
+    if args.max_size is not None and len(data) > args.max_size:
+        sys.exit(f"Font pack is {len(data)} bytes, the partition only {args.max_size}")
+    with open(args.output, "wb") as f:
+        f.write(data)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
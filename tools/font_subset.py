@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Writes a copy of an epdiy font header (as generated by epdiy's fontconvert.py) with only
+# the glyphs of the given code point ranges, and the glyph bitmaps in the given encoding:
+#   zlib  each glyph deflated, as fontconvert.py does (the smallest)
+#   rle   runs of pixels of the same level, see main/fonts.h (faster to draw)
+#   raw   4 bits per pixel (the fastest to draw, the largest)
+#
+# Usage: font_subset.py [--encoding zlib|rle|raw] [--name <name>] <font.h> <output.h> <ranges>
+# where ranges is like "0x20-0x7E,0xA0-0xFF,0x2022".
+
+import argparse
+import collections
+import re
+import sys
+import zlib
+
+ARRAY_RE = r"const {type} (\w+)\[\d*\] = {{(.*?)\n}};"
+# Values of font_encoding_t in main/fonts.h
+ENCODINGS = {"raw": 0, "zlib": 1, "rle": 2}
+
+Font = collections.namedtuple("Font", "name bitmap glyphs intervals encoding advance_y ascender descender")
+
+
+def parse_ranges(text):
+    ranges = []
+    for part in text.replace(" ", "").split(","):
+        if not part:
+            continue
+        first, _, last = part.partition("-")
+        first = int(first, 0)
+        last = int(last, 0) if last else first
+        if last < first:
+            raise ValueError(f"Invalid range {part}")
+        ranges.append((first, last))
+    if not ranges:
+        raise ValueError("No code point ranges")
+    return ranges
+
+
+def array(source, type_name):
+    match = re.search(ARRAY_RE.format(type=type_name), source, re.S)
+    if match is None:
+        raise ValueError(f"No {type_name} array")
+    return match.group(1), match.group(2)
+
+
+def numbers(text):
+    return [int(n, 0) for n in re.findall(r"-?(?:0x[0-9A-Fa-f]+|\d+)", text)]
+
+
+def parse_font(source):
+    _, bitmap_text = array(source, "uint8_t")
+    bitmap = bytes(int(b, 16) for b in re.findall(r"0x[0-9A-Fa-f]{2}", bitmap_text))
+    _, glyph_text = array(source, "EpdGlyph")
+    # Each glyph is "{ width, height, advance_x, left, top, compressed_size, data_offset }, // char"
+    glyphs = [numbers(g) for g in re.findall(r"{([^}]*)}", glyph_text)]
+    _, interval_text = array(source, "EpdUnicodeInterval")
+    intervals = [numbers(i) for i in re.findall(r"{([^}]*)}", interval_text)]
+    match = re.search(r"const EpdFont (\w+) = {(.*?)\n};", source, re.S)
+    if match is None:
+        raise ValueError("No EpdFont")
+    name = match.group(1)
+    # bitmap, glyph, intervals, interval_count, compressed, advance_y, ascender, descender
+    fields = [f.strip() for f in match.group(2).split(",") if f.strip()]
+    compressed, advance_y, ascender, descender = (int(f, 0) for f in fields[4:8])
+    # Headers written by this script say how they are encoded, fontconvert.py's don't
+    match = re.search(r"#define \w+_ENCODING (\d+)", source)
+    encoding = int(match.group(1)) if match else ENCODINGS["zlib" if compressed else "raw"]
+    return Font(name, bitmap, glyphs, intervals, encoding, advance_y, ascender, descender)
+
+
+def decode(font, glyph):
+    """The bitmap of a glyph as 4bpp rows, (width + 1) / 2 bytes each, the left pixel in the low nibble"""
+    width, height, _, _, _, size, offset = glyph
+    data = font.bitmap[offset:offset + size]
+    if font.encoding == ENCODINGS["zlib"]:
+        return zlib.decompress(data) if width * height > 0 else b""
+    if font.encoding == ENCODINGS["rle"]:
+        return decode_rle(data, width, height)
+    return data
+
+
+def decode_rle(data, width, height):
+    byte_width = (width + 1) // 2
+    bitmap = bytearray(byte_width * height)
+    i = 0
+    for byte in data:
+        for _ in range((byte >> 4) + 1):
+            y, x = divmod(i, width)
+            bitmap[y * byte_width + x // 2] |= (byte & 0x0F) << 4 if x % 2 else byte & 0x0F
+            i += 1
+    return bytes(bitmap)
+
+
+def encode_rle(bitmap, width, height):
+    byte_width = (width + 1) // 2
+    pixels = []
+    for y in range(height):
+        for x in range(width):
+            value = bitmap[y * byte_width + x // 2]
+            pixels.append(value >> 4 if x % 2 else value & 0x0F)
+    data = bytearray()
+    i = 0
+    while i < len(pixels):
+        run = 1
+        while run < 16 and i + run < len(pixels) and pixels[i + run] == pixels[i]:
+            run += 1
+        data.append((run - 1) << 4 | pixels[i])
+        i += run
+    return bytes(data)
+
+
+def encode(bitmap, width, height, encoding):
+    if encoding == ENCODINGS["zlib"]:
+        return zlib.compress(bitmap, 9)
+    if encoding == ENCODINGS["rle"]:
+        return encode_rle(bitmap, width, height)
+    return bitmap
+
+
+def subset(font, ranges):
+    """Kept code points with their glyphs, in code point order"""
+    kept = []
+    for first, last, offset in font.intervals:
+        for cp in range(first, last + 1):
+            if any(r_first <= cp <= r_last for r_first, r_last in ranges):
+                kept.append((cp, font.glyphs[offset + cp - first]))
+    return kept
+
+
+def write_font(f, font, name, kept, encoding):
+    data = bytearray()
+    new_glyphs = []
+    for cp, glyph in kept:
+        width, height, advance_x, left, top, size, offset = glyph
+        if encoding == font.encoding:
+            # Copied as it is, so that the subset draws exactly like the full font
+            glyph_data = font.bitmap[offset:offset + size]
+        else:
+            glyph_data = encode(decode(font, glyph), width, height, encoding)
+        new_glyphs.append((cp, (width, height, advance_x, left, top, len(glyph_data), len(data))))
+        data += glyph_data
+    new_intervals = []
+    for index, (cp, _) in enumerate(kept):
+        if new_intervals and new_intervals[-1][1] == cp - 1:
+            new_intervals[-1][1] = cp
+        else:
+            new_intervals.append([cp, cp, index])
+
+    f.write("#pragma once\n")
+    f.write('#include "epd_driver.h"\n')
+    f.write(f"/* Generated by tools/font_subset.py: {len(kept)} glyphs */\n")
+    f.write(f"#define {name}_ENCODING {encoding}\n")
+    f.write(f"const uint8_t {name}Bitmaps[{len(data)}] = {{\n")
+    for i in range(0, len(data), 16):
+        f.write("    " + " ".join(f"0x{b:02X}," for b in data[i:i + 16]) + "\n")
+    f.write("};\n")
+    f.write(f"const EpdGlyph {name}Glyphs[] = {{\n")
+    for cp, glyph in new_glyphs:
+        f.write("    { " + ", ".join(str(n) for n in glyph) + f" }}, // U+{cp:04X}\n")
+    f.write("};\n")
+    f.write(f"const EpdUnicodeInterval {name}Intervals[] = {{\n")
+    for first, last, index in new_intervals:
+        f.write(f"    {{ 0x{first:X}, 0x{last:X}, 0x{index:X} }},\n")
+    f.write("};\n")
+    f.write(f"const EpdFont {name} = {{\n")
+    compressed = int(encoding == ENCODINGS["zlib"])
+    for field in (f"{name}Bitmaps", f"{name}Glyphs", f"{name}Intervals", len(new_intervals),
+                  compressed, font.advance_y, font.ascender, font.descender):
+        f.write(f"    {field},\n")
+    f.write("};\n")
+    return len(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--encoding", choices=ENCODINGS.keys(), default="zlib", help="encoding of the glyph bitmaps")
+    parser.add_argument("--name", help="name of the font in the output (default: as in the input)")
+    parser.add_argument("font", help="epdiy font header")
+    parser.add_argument("output", help="header to write")
+    parser.add_argument("ranges", help='code point ranges to keep, like "0x20-0x7E,0xA0-0xFF"')
+    args = parser.parse_args()
+
+    with open(args.font, encoding="utf-8") as f:
+        font = parse_font(f.read())
+    name = args.name or font.name
+    kept = subset(font, parse_ranges(args.ranges))
+    with open(args.output, "w", encoding="utf-8") as f:
+        size = write_font(f, font, name, kept, ENCODINGS[args.encoding])
+    glyph_size = 16     # sizeof(EpdGlyph)
+    print(f"{name}: {len(kept)} of {len(font.glyphs)} glyphs, {args.encoding}, "
+          f"{len(font.bitmap) + len(font.glyphs) * glyph_size} -> {size + len(kept) * glyph_size} bytes")
+
+
+if __name__ == "__main__":
+    sys.exit(main())
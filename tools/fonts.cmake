@@ -0,0 +1,85 @@
+# Build steps for the app's fonts, see font_subset.py and font_pack.py
+set(font_tools_dir ${CMAKE_CURRENT_LIST_DIR})
+set(font_source_dir ${CMAKE_CURRENT_LIST_DIR}/../main)
+set(font_names firasans_12 firasans_20)
+# The names of the EpdFont of each
+set(font_symbols FiraSans_12 FiraSans_20)
+
+# Write the ranges where the subset commands can depend on them; rewritten only when the
+# ranges change, which then regenerates the headers
+function(_font_ranges_file ranges out_file)
+    set(file ${CMAKE_CURRENT_BINARY_DIR}/fonts/ranges.txt)
+    file(CONFIGURE OUTPUT ${file} CONTENT "${ranges}\n")
+    set(${out_file} ${file} PARENT_SCOPE)
+endfunction()
+
+function(_font_subset_command font name encoding ranges header)
+    idf_build_get_property(python PYTHON)
+    _font_ranges_file("${ranges}" ranges_file)
+    add_custom_command(OUTPUT ${header}
+                       COMMAND ${python} ${font_tools_dir}/font_subset.py --encoding ${encoding} --name ${name}
+                               ${font_source_dir}/${font}.h ${header} ${ranges}
+                       DEPENDS ${font_source_dir}/${font}.h ${font_tools_dir}/font_subset.py ${ranges_file}
+                       COMMENT "Generating ${header}"
+                       VERBATIM)
+endfunction()
+
+# Generate the headers of the fonts with only the code points in ranges in the build
+# directory, and add it to the include directories of target. encodings has the encoding
+# of the glyph bitmaps of each font of font_names: raw, zlib or rle.
+function(font_subset_headers target ranges encodings)
+    set(font_dir ${CMAKE_CURRENT_BINARY_DIR}/fonts)
+    set(headers)
+    set(names ${font_symbols})
+    foreach(font ${font_names})
+        list(POP_FRONT names name)
+        list(POP_FRONT encodings encoding)
+        set(header ${font_dir}/${font}_subset.h)
+        _font_subset_command(${font} ${name} ${encoding} "${ranges}" ${header})
+        list(APPEND headers ${header})
+    endforeach()
+    add_custom_target(${target}_fonts DEPENDS ${headers})
+    add_dependencies(${target} ${target}_fonts)
+    target_include_directories(${target} PRIVATE ${font_dir})
+endfunction()
+
+# Generate a header of font in each of encodings, as <font>_<encoding>.h with the font
+# named <name>_<encoding>, to compare the encodings
+function(font_encoding_headers target font name ranges encodings)
+    set(font_dir ${CMAKE_CURRENT_BINARY_DIR}/fonts)
+    set(headers)
+    foreach(encoding ${encodings})
+        set(header ${font_dir}/${font}_${encoding}.h)
+        _font_subset_command(${font} ${name}_${encoding} ${encoding} "${ranges}" ${header})
+        list(APPEND headers ${header})
+    endforeach()
+    add_custom_target(${target}_${font}_encodings DEPENDS ${headers})
+    add_dependencies(${target} ${target}_${font}_encodings)
+    target_include_directories(${target} PRIVATE ${font_dir})
+endfunction()
+
+# Pack the headers generated by font_subset_headers into an image of the partition,
+# written by "idf.py flash" and "idf.py <partition>-flash"; the build fails if it doesn't fit
+function(font_pack_partition partition)
+    idf_build_get_property(python PYTHON)
+    partition_table_get_partition_info(size "--partition-name ${partition}" "size")
+    if(NOT size)
+        message(FATAL_ERROR "No ${partition} partition in the partition table")
+    endif()
+    set(font_dir ${CMAKE_CURRENT_BINARY_DIR}/fonts)
+    set(image ${font_dir}/${partition}.bin)
+    set(headers)
+    foreach(font ${font_names})
+        list(APPEND headers ${font_dir}/${font}_subset.h)
+    endforeach()
+    add_custom_command(OUTPUT ${image}
+                       COMMAND ${python} ${font_tools_dir}/font_pack.py --max-size ${size} ${image} ${headers}
+                       DEPENDS ${headers} ${font_tools_dir}/font_pack.py ${font_tools_dir}/font_subset.py
+                       COMMENT "Generating the font pack"
+                       VERBATIM)
+    add_custom_target(${partition}_bin ALL DEPENDS ${image})
+    esptool_py_flash_to_partition(${partition}-flash ${partition} ${image})
+    add_dependencies(${partition}-flash ${partition}_bin)
+    esptool_py_flash_to_partition(flash ${partition} ${image})
+    add_dependencies(flash ${partition}_bin)
+endfunction()